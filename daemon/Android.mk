@@ -4,7 +4,9 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= \
 	init.c \
 	opd_anon.c \
+	opd_capture.c \
 	opd_cookie.c \
+	opd_decode.c \
 	opd_events.c \
 	opd_extended.c \
 	opd_ibs.c \
@@ -13,10 +15,13 @@ LOCAL_SRC_FILES:= \
 	opd_mangling.c \
 	opd_perfmon.c \
 	opd_pipe.c \
+	opd_reader.c \
 	opd_sfile.c \
+	opd_size_hint.c \
 	opd_spu.c \
 	opd_stats.c \
 	opd_trans.c \
+	opd_workers.c \
 	oprofiled.c
 
 LOCAL_STATIC_LIBRARIES := \
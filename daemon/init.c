@@ -19,10 +19,13 @@
 #include "opd_stats.h"
 #include "opd_sfile.h"
 #include "opd_pipe.h"
+#include "opd_size_hint.h"
 #include "opd_kernel.h"
 #include "opd_trans.h"
 #include "opd_anon.h"
 #include "opd_perfmon.h"
+#include "opd_reader.h"
+#include "opd_capture.h"
 #include "opd_printf.h"
 
 #include "op_version.h"
@@ -139,6 +142,7 @@ retry:
 static void opd_do_samples(char const * opd_buf, ssize_t count)
 {
 	size_t num = count / kernel_pointer_size;
+	unsigned long long start = opd_now_usec();
  
 	opd_stats[OPD_DUMP_COUNT]++;
 
@@ -146,7 +150,18 @@ static void opd_do_samples(char const * opd_buf, ssize_t count)
  
 	opd_process_samples(opd_buf, num);
 
+	/* samples must be in sample files before opcontrol --dump returns */
+	sfile_flush_samples();
+
+	/* close files before running out of fds or memory */
+	sfile_lru_evict();
+
+	/* after the records made while processing it, see opd_capture.h */
+	opd_capture_buffer(opd_buf, count);
+
 	complete_dump();
+
+	opd_stats_buffer_done(opd_now_usec() - start);
 }
  
 static void opd_do_jitdumps(void)
@@ -192,6 +207,74 @@ static void opd_do_jitdumps(void)
 
 } 
 
+/** handle the signals received since the last call */
+static void opd_do_signals(void)
+{
+	/* we can lose an alarm or a hup but
+	 * we don't care.
+	 */
+	if (signal_alarm) {
+		signal_alarm = 0;
+		opd_alarm();
+	}
+
+	if (signal_hup) {
+		signal_hup = 0;
+		opd_sighup();
+	}
+
+	if (signal_term)
+		opd_sigterm();
+
+	if (signal_child)
+		opd_sigchild();
+
+	if (signal_usr1) {
+		signal_usr1 = 0;
+		perfmon_start();
+	}
+
+	if (signal_usr2) {
+		signal_usr2 = 0;
+		perfmon_stop();
+	}
+
+	if (is_jitconv_requested()) {
+		verbprintf(vmisc, "Start opjitconv was triggered\n");
+		opd_do_jitdumps();
+	}
+}
+
+
+/* signals don't interrupt the wait for a buffer read by the reader thread,
+ * so it must time out to handle them */
+#define OPD_READER_TIMEOUT 200
+
+/**
+ * opd_do_async_read - enter processing loop
+ * @param size  size of buffer
+ *
+ * Let a reader thread read the device in nr_read_buffers buffers,
+ * so the device is drained while we process the previous buffers.
+ */
+static void opd_do_async_read(size_t size)
+{
+	opd_reader_start(devfd, nr_read_buffers, size);
+
+	while (1) {
+		ssize_t count;
+		char const * buf = opd_reader_get(&count, OPD_READER_TIMEOUT);
+
+		opd_do_signals();
+
+		if (buf) {
+			opd_do_samples(buf, count);
+			opd_reader_put();
+		}
+	}
+}
+
+
 /**
  * opd_do_read - enter processing loop
  * @param buf  buffer to read into
@@ -204,46 +287,16 @@ static void opd_do_read(char * buf, size_t size)
 {
 	opd_open_pipe();
 
+	if (nr_read_buffers > 1)
+		opd_do_async_read(size);
+
 	while (1) {
 		ssize_t count = -1;
 
 		/* loop to handle EINTR */
 		while (count < 0) {
 			count = op_read_device(devfd, buf, size);
-
-			/* we can lose an alarm or a hup but
-			 * we don't care.
-			 */
-			if (signal_alarm) {
-				signal_alarm = 0;
-				opd_alarm();
-			}
-
-			if (signal_hup) {
-				signal_hup = 0;
-				opd_sighup();
-			}
-
-			if (signal_term)
-				opd_sigterm();
-
-			if (signal_child)
-				opd_sigchild();
-
-			if (signal_usr1) {
-				signal_usr1 = 0;
-				perfmon_start();
-			}
-
-			if (signal_usr2) {
-				signal_usr2 = 0;
-				perfmon_stop();
-			}
-
-			if (is_jitconv_requested()) {
-				verbprintf(vmisc, "Start opjitconv was triggered\n");
-				opd_do_jitdumps();
-			}
+			opd_do_signals();
 		}
 
 		opd_do_samples(buf, count);
@@ -256,7 +309,11 @@ static void opd_do_read(char * buf, size_t size)
 /** opd_alarm - sync files and report stats */
 static void opd_alarm(void)
 {
-	sfile_sync_files();
+	/* a sync over budget goes on at the next tick */
+	if (sfile_sync_files()) {
+		alarm(1);
+		return;
+	}
 	opd_print_stats();
 	alarm(60 * 10);
 }
@@ -268,6 +325,7 @@ static void opd_sighup(void)
 	printf("Received SIGHUP.\n");
 	/* We just close them, and re-open them lazily as usual. */
 	sfile_close_files();
+	size_hint_save();
 	close(1);
 	close(2);
 	opd_open_logfile();
@@ -284,6 +342,9 @@ static void clean_exit(void)
 static void opd_sigterm(void)
 {
 	opd_do_jitdumps();
+	/* only to record the size of sample files */
+	sfile_close_files();
+	size_hint_save();
 	opd_print_stats();
 	printf("oprofiled stopped %s", op_get_time());
 	exit(EXIT_FAILURE);
@@ -316,20 +377,25 @@ static void opd_26_init(void)
 
 	opd_buf_size = opd_read_fs_int("/dev/oprofile/", "buffer_size", 1);
 	kernel_pointer_size = opd_read_fs_int("/dev/oprofile/", "pointer_size", 1);
+	opd_capture_int_option("pointer-size", kernel_pointer_size);
 
 	s_buf_bytesize = opd_buf_size * kernel_pointer_size;
 
-	sbuf = xmalloc(s_buf_bytesize);
+	/* the reader thread allocates its own buffers */
+	if (nr_read_buffers <= 1)
+		sbuf = xmalloc(s_buf_bytesize);
 
 	opd_reread_module_info();
 
 	for (i = 0; i < OPD_MAX_STATS; i++)
 		opd_stats[i] = 0;
+	opd_stats_open();
 
 	perfmon_init();
 
 	cookie_init();
 	sfile_init();
+	size_hint_init();
 	anon_init();
 
 	/* must be /after/ perfmon_init() at least */
@@ -21,6 +21,8 @@
 #include "opd_trans.h"
 #include "opd_sfile.h"
 #include "opd_printf.h"
+#include "opd_stats.h"
+#include "opd_capture.h"
 #include "op_libiberty.h"
 
 #include <limits.h>
@@ -32,38 +34,82 @@
 #define HASH_BITS (HASH_SIZE - 1)
 
 /*
- * Note that this value is tempered by the fact that when we miss in the
- * anon cache, we'll tear down all the mappings for that tgid. Thus, LRU
- * of a mapping can potentially clear out a much larger number of
- * mappings.
+ * Note that this value is tempered by the fact that the mappings of a
+ * process are dropped together. Thus, LRU of a process can potentially
+ * clear out a much larger number of mappings.
  */
 #define LRU_SIZE 8192
 #define LRU_AMOUNT (LRU_SIZE/8)
 
+/** the anon mappings of a tgid/app pair */
+struct anon_process {
+	pid_t tgid;
+	cookie_t app_cookie;
+	/** mappings sorted by start address */
+	struct anon_mapping ** maps;
+	size_t nr_maps;
+	/**
+	 * opd_stats[OPD_DUMP_COUNT] when the maps were last read, a miss
+	 * in the same buffer doesn't read them again
+	 */
+	unsigned long reload_dump;
+	/** hash list */
+	struct list_head hash;
+	/** lru list */
+	struct list_head lru;
+};
+
 static struct list_head hashes[HASH_SIZE];
 static struct list_head lru;
+/** nr of processes plus nr of mappings of all processes */
 static size_t nr_lru;
 
-static void do_lru(struct transient * trans)
+/** the content of the last maps file read */
+static char * maps_buf;
+static size_t maps_buf_size;
+
+
+static void free_anon_mapping(struct transient * trans,
+                              struct anon_mapping * entry)
+{
+	if (trans->anon == entry)
+		clear_trans_current(trans);
+	if (trans->last_anon == entry)
+		clear_trans_last(trans);
+	sfile_clear_anon(entry);
+	--nr_lru;
+	free(entry);
+}
+
+
+static void free_anon_process(struct transient * trans,
+                              struct anon_process * proc)
+{
+	size_t i;
+
+	for (i = 0; i < proc->nr_maps; ++i)
+		free_anon_mapping(trans, proc->maps[i]);
+
+	list_del(&proc->hash);
+	list_del(&proc->lru);
+	--nr_lru;
+	free(proc->maps);
+	free(proc);
+}
+
+
+static void do_lru(struct transient * trans, struct anon_process * current)
 {
-	size_t nr_to_kill = LRU_AMOUNT;
 	struct list_head * pos;
 	struct list_head * pos2;
-	struct anon_mapping * entry;
+	struct anon_process * proc;
 
 	list_for_each_safe(pos, pos2, &lru) {
-		entry = list_entry(pos, struct anon_mapping, lru_list);
-		if (trans->anon == entry)
-			clear_trans_current(trans);
-		if (trans->last_anon == entry)
-			clear_trans_last(trans);
-		sfile_clear_anon(entry);
-		list_del(&entry->list);
-		list_del(&entry->lru_list);
-		--nr_lru;
-		free(entry);
-		if (nr_to_kill-- == 0)
+		if (nr_lru <= LRU_SIZE - LRU_AMOUNT)
 			break;
+		proc = list_entry(pos, struct anon_process, lru);
+		if (proc != current)
+			free_anon_process(trans, proc);
 	}
 }
 
@@ -72,92 +118,296 @@ static unsigned long hash_anon(pid_t tgid, cookie_t app)
 {
 	return ((app >> DCOOKIE_SHIFT) ^ (tgid >> 2)) & (HASH_SIZE - 1);
 }
- 
 
-static void clear_anon_maps(struct transient * trans)
+
+static struct anon_process * find_anon_process(struct transient * trans)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
-	pid_t tgid = trans->tgid;
-	cookie_t app = trans->app_cookie;
+	struct list_head * head;
 	struct list_head * pos;
-	struct list_head * pos2;
-	struct anon_mapping * entry;
-
-	clear_trans_current(trans);
-
-	list_for_each_safe(pos, pos2, &hashes[hash]) {
-		entry = list_entry(pos, struct anon_mapping, list);
-		if (entry->tgid == tgid && entry->app_cookie == app) {
-			if (trans->last_anon == entry)
-				clear_trans_last(trans);
-			sfile_clear_anon(entry);
-			list_del(&entry->list);
-			list_del(&entry->lru_list);
-			--nr_lru;
-			free(entry);
-		}
+	struct anon_process * proc;
+
+	head = &hashes[hash_anon(trans->tgid, trans->app_cookie)];
+	list_for_each(pos, head) {
+		proc = list_entry(pos, struct anon_process, hash);
+		if (proc->tgid == trans->tgid &&
+		    proc->app_cookie == trans->app_cookie)
+			goto found;
 	}
 
-	if (vmisc) {
-		char const * name = verbose_cookie(app);
-		printf("Cleared anon maps for tgid %u (%s).\n", tgid, name);
-	}
+	proc = xmalloc(sizeof(struct anon_process));
+	proc->tgid = trans->tgid;
+	proc->app_cookie = trans->app_cookie;
+	proc->maps = NULL;
+	proc->nr_maps = 0;
+	proc->reload_dump = opd_stats[OPD_DUMP_COUNT] - 1;
+	list_add(&proc->hash, head);
+	list_add_tail(&proc->lru, &lru);
+	++nr_lru;
+	return proc;
+
+found:
+	list_del(&proc->lru);
+	list_add_tail(&proc->lru, &lru);
+	return proc;
 }
 
 
-static void
-add_anon_mapping(struct transient * trans, vma_t start, vma_t end, char * name)
+static struct anon_mapping *
+create_anon_mapping(struct transient * trans, vma_t start, vma_t end,
+                    char const * name, size_t len)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
 	struct anon_mapping * m = xmalloc(sizeof(struct anon_mapping));
 	m->tgid = trans->tgid;
 	m->app_cookie = trans->app_cookie;
 	m->start = start;
 	m->end = end;
-	strncpy(m->name, name, MAX_IMAGE_NAME_SIZE + 1);
-	list_add_tail(&m->list, &hashes[hash]);
-	list_add_tail(&m->lru_list, &lru);
-	if (++nr_lru == LRU_SIZE)
-		do_lru(trans);
+	memcpy(m->name, name, len);
+	m->name[len] = '\0';
+	++nr_lru;
 	if (vmisc) {
 		char const * name = verbose_cookie(m->app_cookie);
 		printf("Added anon map 0x%llx-0x%llx for tgid %u (%s).\n",
 		       start, end, m->tgid, name);
 	}
+	return m;
 }
 
 
-/* 42000000-4212f000 r-xp 00000000 16:03 424334 /lib/tls/libc-2.3.2.so */
-static void get_anon_maps(struct transient * trans)
+/** read the whole file in maps_buf, return its size or -1 on failure */
+static ssize_t read_maps(pid_t tgid)
 {
-	FILE * fp = NULL;
-	char buf[PATH_MAX];
-	vma_t start, end;
-	int ret;
+	char path[PATH_MAX];
+	size_t size = 0;
+	size_t len;
+	FILE * fp;
 
-	snprintf(buf, PATH_MAX, "/proc/%d/maps", trans->tgid);
-	fp = fopen(buf, "r");
+	snprintf(path, PATH_MAX, "/proc/%d/maps", tgid);
+	fp = opd_capture_open_file(path);
 	if (!fp)
-		return;
-
-	while (fgets(buf, PATH_MAX, fp) != NULL) {
-		char tmp[MAX_IMAGE_NAME_SIZE + 1];
-		char name[MAX_IMAGE_NAME_SIZE + 1];
-		/* Some anon maps have labels like
-		 * [heap], [stack], [vdso], [vsyscall] ...
-		 * Keep track of these labels. If a map has no name, call it "anon".
-		 * Ignore all mappings starting with "/" (file or shared memory object)
-		 */
-		strcpy(name, "anon");
-		ret = sscanf(buf, "%llx-%llx %20s %20s %20s %20s %20s",
-		             &start, &end, tmp, tmp, tmp, tmp, name);
-		if (ret < 6 || name[0] == '/')
-			continue;
-
-		add_anon_mapping(trans, start, end, name);
+		return -1;
+
+	if (!maps_buf) {
+		maps_buf_size = 65536;
+		maps_buf = xmalloc(maps_buf_size);
+	}
+
+	while ((len = fread(maps_buf + size, 1, maps_buf_size - size, fp))) {
+		size += len;
+		if (size == maps_buf_size) {
+			maps_buf_size *= 2;
+			maps_buf = xrealloc(maps_buf, maps_buf_size);
+		}
 	}
 
 	fclose(fp);
+	return size;
+}
+
+
+static char const * parse_hex(char const * p, char const * end, vma_t * value)
+{
+	char const * start = p;
+	vma_t v = 0;
+
+	for (; p != end; ++p) {
+		if (*p >= '0' && *p <= '9')
+			v = (v << 4) | (*p - '0');
+		else if (*p >= 'a' && *p <= 'f')
+			v = (v << 4) | (*p - 'a' + 10);
+		else if (*p >= 'A' && *p <= 'F')
+			v = (v << 4) | (*p - 'A' + 10);
+		else
+			break;
+	}
+
+	*value = v;
+	return p != start ? p : NULL;
+}
+
+
+static char const * skip_blank(char const * p, char const * end)
+{
+	while (p != end && (*p == ' ' || *p == '\t'))
+		++p;
+	return p;
+}
+
+
+static char const * skip_word(char const * p, char const * end)
+{
+	while (p != end && *p != ' ' && *p != '\t' && *p != '\n')
+		++p;
+	return p;
+}
+
+
+static int compare_anon(void const * lhs, void const * rhs)
+{
+	struct anon_mapping const * l = *(struct anon_mapping * const *)lhs;
+	struct anon_mapping const * r = *(struct anon_mapping * const *)rhs;
+
+	if (l->start != r->start)
+		return l->start < r->start ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * 42000000-4212f000 r-xp 00000000 16:03 424334 /lib/tls/libc-2.3.2.so
+ *
+ * Some anon maps have labels like [heap], [stack], [vdso], [vsyscall] ...
+ * Keep track of these labels. If a map has no name, call it "anon".
+ * Ignore all mappings starting with "/" (file or shared memory object).
+ * Only the first MAX_IMAGE_NAME_SIZE characters of a name are kept.
+ */
+static size_t parse_maps(struct transient * trans, char const * p,
+                         char const * end, struct anon_mapping *** maps)
+{
+	struct anon_mapping ** result = NULL;
+	size_t nr = 0;
+	size_t max = 0;
+	int sorted = 1;
+
+	while (p != end) {
+		char const * eol = memchr(p, '\n', end - p);
+		char const * name;
+		size_t len;
+		vma_t start, stop;
+		int i;
+
+		if (!eol)
+			eol = end;
+
+		p = parse_hex(p, eol, &start);
+		if (!p || p == eol || *p != '-')
+			goto next;
+		p = parse_hex(p + 1, eol, &stop);
+		if (!p)
+			goto next;
+
+		/* permissions, offset, device and inode */
+		for (i = 0; i < 4; ++i) {
+			p = skip_blank(p, eol);
+			if (p == eol)
+				goto next;
+			p = skip_word(p, eol);
+		}
+
+		p = skip_blank(p, eol);
+		name = p;
+		len = skip_word(p, eol) - p;
+		if (!len) {
+			name = "anon";
+			len = 4;
+		} else if (name[0] == '/') {
+			goto next;
+		}
+		if (len > MAX_IMAGE_NAME_SIZE)
+			len = MAX_IMAGE_NAME_SIZE;
+
+		if (nr == max) {
+			max = max ? max * 2 : 64;
+			result = xrealloc(result, max * sizeof(*result));
+		}
+		result[nr] = create_anon_mapping(trans, start, stop, name, len);
+		if (nr && result[nr - 1]->start > start)
+			sorted = 0;
+		++nr;
+next:
+		p = eol == end ? end : eol + 1;
+	}
+
+	if (!sorted)
+		qsort(result, nr, sizeof(*result), compare_anon);
+
+	*maps = result;
+	return nr;
+}
+
+
+static int same_anon(struct anon_mapping const * lhs,
+                     struct anon_mapping const * rhs)
+{
+	return lhs->start == rhs->start && lhs->end == rhs->end &&
+		!strcmp(lhs->name, rhs->name);
+}
+
+
+/**
+ * Read again the maps of proc. The mappings which didn't change are kept
+ * with their sample files, the others are dropped.
+ */
+static void reload_anon_maps(struct transient * trans,
+                             struct anon_process * proc)
+{
+	struct anon_mapping ** new_maps = NULL;
+	struct anon_mapping ** old_maps = proc->maps;
+	size_t nr_new = 0;
+	size_t nr_old = proc->nr_maps;
+	ssize_t size;
+	size_t i = 0;
+	size_t j = 0;
+	unsigned long long start = opd_now_usec();
+
+	opd_stats[OPD_ANON_RELOAD]++;
+	proc->reload_dump = opd_stats[OPD_DUMP_COUNT];
+
+	size = read_maps(trans->tgid);
+	opd_stats[OPD_ANON_RELOAD_USEC] += opd_now_usec() - start;
+	if (size >= 0)
+		nr_new = parse_maps(trans, maps_buf, maps_buf + size, &new_maps);
+
+	/* both arrays are sorted, keep the old mapping when unchanged */
+	while (i < nr_old || j < nr_new) {
+		if (i < nr_old && j < nr_new &&
+		    same_anon(old_maps[i], new_maps[j])) {
+			--nr_lru;
+			free(new_maps[j]);
+			new_maps[j++] = old_maps[i++];
+		} else if (j == nr_new ||
+		           (i < nr_old &&
+		            old_maps[i]->start <= new_maps[j]->start)) {
+			free_anon_mapping(trans, old_maps[i++]);
+		} else {
+			++j;
+		}
+	}
+
+	free(old_maps);
+	proc->maps = new_maps;
+	proc->nr_maps = nr_new;
+
+	if (vmisc) {
+		char const * name = verbose_cookie(trans->app_cookie);
+		printf("Read anon maps for tgid %u (%s).\n", trans->tgid, name);
+	}
+
+	if (nr_lru > LRU_SIZE)
+		do_lru(trans, proc);
+}
+
+
+/** binary search of the mapping containing pc, NULL if none */
+static struct anon_mapping *
+lookup_anon(struct anon_process const * proc, vma_t pc)
+{
+	size_t low = 0;
+	size_t high = proc->nr_maps;
+	struct anon_mapping * entry;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (proc->maps[mid]->start <= pc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (!low)
+		return NULL;
+
+	entry = proc->maps[low - 1];
+	return pc < entry->end ? entry : NULL;
 }
 
 
@@ -178,38 +428,37 @@ anon_match(struct transient const * trans, struct anon_mapping const * anon)
 
 struct anon_mapping * find_anon_mapping(struct transient * trans)
 {
-	unsigned long hash = hash_anon(trans->tgid, trans->app_cookie);
-	struct list_head * pos;
+	struct anon_process * proc;
 	struct anon_mapping * entry;
-	int tried = 0;
 
 	if (anon_match(trans, trans->anon))
 		return (trans->anon);
 
-retry:
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct anon_mapping, list);
-		if (anon_match(trans, entry))
-			goto success;
-	}
+	opd_stats[OPD_ANON_LOOKUP]++;
 
-	if (!tried) {
-		clear_anon_maps(trans);
-		get_anon_maps(trans);
-		tried = 1;
-		goto retry;
-	}
+	proc = find_anon_process(trans);
+	entry = lookup_anon(proc, trans->pc);
+	if (entry)
+		goto success;
 
-	return NULL;
+	opd_stats[OPD_ANON_MISS]++;
+	clear_trans_current(trans);
 
-success:
 	/*
-	 * Typically, there's one big mapping that matches. Let's go
-	 * faster.
+	 * The maps were already read for this buffer, the pc is not in a
+	 * mapping we can know of before the next buffer.
 	 */
-	list_del(&entry->list);
-	list_add(&entry->list, &hashes[hash]);
+	if (proc->reload_dump == opd_stats[OPD_DUMP_COUNT]) {
+		opd_stats[OPD_ANON_NEGATIVE]++;
+		return NULL;
+	}
+
+	reload_anon_maps(trans, proc);
+	entry = lookup_anon(proc, trans->pc);
+	if (!entry)
+		return NULL;
 
+success:
 	verbprintf(vmisc, "Found range 0x%llx-0x%llx for tgid %u, pc %llx.\n",
 	           entry->start, entry->end, (unsigned int)entry->tgid,
 		   trans->pc);
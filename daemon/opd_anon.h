@@ -37,10 +37,6 @@ struct anon_mapping {
 	pid_t tgid;
 	/** cookie of the app */
 	cookie_t app_cookie;
-	/** hash list */
-	struct list_head list;
-	/** lru list */
-	struct list_head lru_list;
 	char name[MAX_IMAGE_NAME_SIZE+1];
 };
 
@@ -0,0 +1,477 @@
+/**
+ * @file daemon/opd_capture.c
+ * Recording and replay of the daemon input
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_capture.h"
+
+#include "op_list.h"
+#include "op_string.h"
+#include "op_libiberty.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum opd_capture_mode opd_capture_mode = OPD_CAPTURE_NONE;
+
+static FILE * capture_fp;
+
+/** payload of the last record read */
+static char * payload;
+static size_t payload_size;
+
+
+static void write_record(uint32_t type, uint64_t value,
+                         void const * data1, size_t size1,
+                         void const * data2, size_t size2)
+{
+	struct opd_capture_record record;
+
+	record.type = type;
+	record.size = size1 + size2;
+	record.value = value;
+
+	if (fwrite(&record, sizeof(record), 1, capture_fp) != 1 ||
+	    (size1 && fwrite(data1, size1, 1, capture_fp) != 1) ||
+	    (size2 && fwrite(data2, size2, 1, capture_fp) != 1)) {
+		perror("oprofiled: couldn't write capture file: ");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+void opd_capture_record(char const * filename)
+{
+	struct opd_capture_header header;
+
+	capture_fp = fopen(filename, "w");
+	if (!capture_fp) {
+		fprintf(stderr, "oprofiled: couldn't open capture file %s: "
+			"%s\n", filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&header, '\0', sizeof(header));
+	strcpy(header.magic, OPD_CAPTURE_MAGIC);
+	header.version = OPD_CAPTURE_VERSION;
+	if (fwrite(&header, sizeof(header), 1, capture_fp) != 1) {
+		perror("oprofiled: couldn't write capture file: ");
+		exit(EXIT_FAILURE);
+	}
+
+	opd_capture_mode = OPD_CAPTURE_RECORD;
+}
+
+
+void opd_capture_option(char const * name, char const * value)
+{
+	if (opd_capture_mode != OPD_CAPTURE_RECORD || !value)
+		return;
+
+	write_record(OPD_CAPTURE_OPTION, 0, name, strlen(name) + 1,
+		     value, strlen(value));
+}
+
+
+void opd_capture_int_option(char const * name, long value)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%ld", value);
+	opd_capture_option(name, buf);
+}
+
+
+void opd_capture_buffer(char const * buffer, size_t size)
+{
+	if (opd_capture_mode != OPD_CAPTURE_RECORD)
+		return;
+
+	write_record(OPD_CAPTURE_BUFFER, 0, buffer, size, NULL, 0);
+	/* a capture cut short by a crash is still usable */
+	fflush(capture_fp);
+}
+
+
+void opd_capture_cookie(cookie_t cookie, char const * name)
+{
+	if (opd_capture_mode != OPD_CAPTURE_RECORD)
+		return;
+
+	write_record(OPD_CAPTURE_COOKIE, cookie, name, name ? strlen(name) : 0,
+		     NULL, 0);
+}
+
+
+/** a FILE reading content, the daemon parses files with stdio */
+static FILE * content_file(char const * content, size_t size)
+{
+	FILE * fp = tmpfile();
+
+	if (!fp) {
+		perror("oprofiled: couldn't create a temporary file: ");
+		return NULL;
+	}
+
+	if (size && fwrite(content, size, 1, fp) != 1) {
+		fclose(fp);
+		return NULL;
+	}
+	rewind(fp);
+
+	return fp;
+}
+
+
+/** read the whole file content, NULL if it can't be opened */
+static char * read_file(char const * path, size_t * size)
+{
+	FILE * fp = fopen(path, "r");
+	size_t capacity = 4096;
+	char * content;
+	size_t len;
+
+	if (!fp)
+		return NULL;
+
+	content = xmalloc(capacity);
+	*size = 0;
+	while ((len = fread(content + *size, 1, capacity - *size, fp))) {
+		*size += len;
+		if (*size == capacity) {
+			capacity *= 2;
+			content = xrealloc(content, capacity);
+		}
+	}
+
+	fclose(fp);
+	return content;
+}
+
+
+static FILE * replay_file(char const * path);
+
+FILE * opd_capture_open_file(char const * path)
+{
+	char * content;
+	size_t size;
+	FILE * fp;
+
+	switch (opd_capture_mode) {
+	case OPD_CAPTURE_NONE:
+		return fopen(path, "r");
+	case OPD_CAPTURE_REPLAY:
+		return replay_file(path);
+	case OPD_CAPTURE_RECORD:
+		break;
+	}
+
+	content = read_file(path, &size);
+	if (!content) {
+		write_record(OPD_CAPTURE_FILE, 1, path, strlen(path) + 1,
+			     NULL, 0);
+		return NULL;
+	}
+
+	write_record(OPD_CAPTURE_FILE, 0, path, strlen(path) + 1,
+		     content, size);
+	fp = content_file(content, size);
+	free(content);
+
+	return fp;
+}
+
+
+/*
+ * Replay. The files recorded for a path are returned in the order they
+ * were recorded, the last one is returned again if the daemon opens the
+ * file more often than when recording.
+ */
+
+#define COOKIE_HASH_SIZE 512
+#define FILE_HASH_SIZE 256
+
+struct capture_cookie {
+	struct list_head next;
+	cookie_t cookie;
+	/** NULL if the cookie couldn't be resolved */
+	char * name;
+};
+
+struct capture_file {
+	struct capture_file * next;
+	char * content;
+	size_t size;
+	int failed;
+};
+
+struct capture_path {
+	struct list_head next;
+	char * path;
+	/** recorded files not yet returned */
+	struct capture_file * head;
+	struct capture_file ** tail;
+	/** last file returned */
+	struct capture_file * last;
+};
+
+struct capture_option {
+	struct list_head next;
+	char * name;
+	char * value;
+};
+
+static struct list_head cookie_hash[COOKIE_HASH_SIZE];
+static struct list_head path_hash[FILE_HASH_SIZE];
+static LIST_HEAD(options);
+
+
+static struct list_head * hash_cookie(cookie_t cookie)
+{
+	return &cookie_hash[(cookie >> DCOOKIE_SHIFT) & (COOKIE_HASH_SIZE - 1)];
+}
+
+
+static struct capture_path * find_path(char const * path, int create)
+{
+	struct list_head * head = &path_hash[op_hash_string(path) %
+	                                     FILE_HASH_SIZE];
+	struct capture_path * entry;
+	struct list_head * pos;
+
+	list_for_each(pos, head) {
+		entry = list_entry(pos, struct capture_path, next);
+		if (!strcmp(entry->path, path))
+			return entry;
+	}
+
+	if (!create)
+		return NULL;
+
+	entry = xmalloc(sizeof(struct capture_path));
+	entry->path = xstrdup(path);
+	entry->head = NULL;
+	entry->tail = &entry->head;
+	entry->last = NULL;
+	list_add(&entry->next, head);
+
+	return entry;
+}
+
+
+static FILE * replay_file(char const * path)
+{
+	struct capture_path * entry = find_path(path, 0);
+	struct capture_file * file;
+
+	if (entry && entry->head) {
+		file = entry->head;
+		entry->head = file->next;
+		if (!entry->head)
+			entry->tail = &entry->head;
+		if (entry->last) {
+			free(entry->last->content);
+			free(entry->last);
+		}
+		entry->last = file;
+	}
+
+	if (!entry || !entry->last || entry->last->failed) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	return content_file(entry->last->content, entry->last->size);
+}
+
+
+static void bad_capture(char const * why)
+{
+	fprintf(stderr, "bad capture file: %s\n", why);
+	exit(EXIT_FAILURE);
+}
+
+
+static void load_option(void)
+{
+	char const * name = payload;
+	size_t len = strlen(name) + 1;
+	struct capture_option * option;
+	struct list_head * pos;
+
+	if (len > payload_size)
+		bad_capture("truncated option record");
+
+	list_for_each(pos, &options) {
+		option = list_entry(pos, struct capture_option, next);
+		if (!strcmp(option->name, name)) {
+			free(option->value);
+			goto set_value;
+		}
+	}
+
+	option = xmalloc(sizeof(struct capture_option));
+	option->name = xstrdup(name);
+	list_add_tail(&option->next, &options);
+
+set_value:
+	option->value = op_xstrndup(payload + len, payload_size - len);
+}
+
+
+static void load_cookie(cookie_t cookie)
+{
+	struct list_head * head = hash_cookie(cookie);
+	struct capture_cookie * entry;
+	struct list_head * pos;
+
+	list_for_each(pos, head) {
+		entry = list_entry(pos, struct capture_cookie, next);
+		if (entry->cookie == cookie) {
+			free(entry->name);
+			goto set_name;
+		}
+	}
+
+	entry = xmalloc(sizeof(struct capture_cookie));
+	entry->cookie = cookie;
+	list_add(&entry->next, head);
+
+set_name:
+	entry->name = payload_size ? op_xstrndup(payload, payload_size) : NULL;
+}
+
+
+static void load_file(int failed)
+{
+	size_t len = strlen(payload) + 1;
+	struct capture_path * entry;
+	struct capture_file * file;
+
+	if (len > payload_size)
+		bad_capture("truncated file record");
+
+	entry = find_path(payload, 1);
+	file = xmalloc(sizeof(struct capture_file));
+	file->next = NULL;
+	file->size = payload_size - len;
+	file->content = xmalloc(file->size + 1);
+	memcpy(file->content, payload + len, file->size);
+	file->failed = failed;
+
+	*entry->tail = file;
+	entry->tail = &file->next;
+}
+
+
+void opd_capture_replay(char const * filename)
+{
+	struct opd_capture_header header;
+	size_t i;
+
+	capture_fp = fopen(filename, "r");
+	if (!capture_fp) {
+		fprintf(stderr, "couldn't open capture file %s: %s\n",
+			filename, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (fread(&header, sizeof(header), 1, capture_fp) != 1 ||
+	    memcmp(header.magic, OPD_CAPTURE_MAGIC, sizeof(OPD_CAPTURE_MAGIC)))
+		bad_capture("not a capture file");
+	if (header.version != OPD_CAPTURE_VERSION)
+		bad_capture("unsupported version");
+
+	for (i = 0; i < COOKIE_HASH_SIZE; ++i)
+		list_init(&cookie_hash[i]);
+	for (i = 0; i < FILE_HASH_SIZE; ++i)
+		list_init(&path_hash[i]);
+
+	opd_capture_mode = OPD_CAPTURE_REPLAY;
+}
+
+
+char const * opd_capture_next_buffer(size_t * size)
+{
+	static size_t capacity;
+	struct opd_capture_record record;
+
+	while (fread(&record, sizeof(record), 1, capture_fp) == 1) {
+		/* room for a terminating nul, needed by load_file() */
+		if (record.size >= capacity) {
+			capacity = record.size + 1;
+			payload = xrealloc(payload, capacity);
+		}
+		if (record.size &&
+		    fread(payload, record.size, 1, capture_fp) != 1)
+			bad_capture("truncated record");
+		payload_size = record.size;
+		payload[payload_size] = '\0';
+
+		switch (record.type) {
+		case OPD_CAPTURE_OPTION:
+			load_option();
+			break;
+		case OPD_CAPTURE_BUFFER:
+			*size = payload_size;
+			return payload;
+		case OPD_CAPTURE_COOKIE:
+			load_cookie(record.value);
+			break;
+		case OPD_CAPTURE_FILE:
+			load_file(record.value != 0);
+			break;
+		default:
+			bad_capture("unknown record");
+		}
+	}
+
+	return NULL;
+}
+
+
+char const * opd_capture_get_option(char const * name)
+{
+	struct list_head * pos;
+
+	list_for_each(pos, &options) {
+		struct capture_option * option =
+			list_entry(pos, struct capture_option, next);
+		if (!strcmp(option->name, name))
+			return option->value;
+	}
+
+	return NULL;
+}
+
+
+int opd_capture_find_cookie(cookie_t cookie, char * buf, size_t size)
+{
+	struct list_head * pos;
+
+	list_for_each(pos, hash_cookie(cookie)) {
+		struct capture_cookie * entry =
+			list_entry(pos, struct capture_cookie, next);
+		size_t len;
+
+		if (entry->cookie != cookie)
+			continue;
+		if (!entry->name)
+			break;
+
+		len = strlen(entry->name) + 1;
+		if (len > size) {
+			errno = ERANGE;
+			return -1;
+		}
+		memcpy(buf, entry->name, len);
+		return len;
+	}
+
+	errno = ENOENT;
+	return -1;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file daemon/opd_capture.h
+ * Recording and replay of the daemon input
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_CAPTURE_H
+#define OPD_CAPTURE_H
+
+#include "opd_cookie.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A capture file holds everything the daemon reads from the system: the
+ * buffers read from the kernel, the dcookie resolutions and the /proc
+ * files content, plus the options needed to interpret them. It is
+ * written in host byte order.
+ *
+ * The records made while processing a buffer are written before the
+ * buffer itself, so on replay all the records needed to process a buffer
+ * are loaded when the buffer is reached.
+ */
+
+#define OPD_CAPTURE_MAGIC "OPDCAPT"
+#define OPD_CAPTURE_VERSION 1
+
+enum opd_capture_type {
+	/** payload is name '\0' value */
+	OPD_CAPTURE_OPTION,
+	/** payload is the buffer read from the kernel */
+	OPD_CAPTURE_BUFFER,
+	/** value is the cookie, payload is its name, empty if unknown */
+	OPD_CAPTURE_COOKIE,
+	/** payload is path '\0' content, value is non zero if the file
+	 * couldn't be opened */
+	OPD_CAPTURE_FILE
+};
+
+struct opd_capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t padding;
+};
+
+struct opd_capture_record {
+	uint32_t type;
+	/** nr of bytes of payload following the record */
+	uint32_t size;
+	uint64_t value;
+};
+
+enum opd_capture_mode {
+	OPD_CAPTURE_NONE,
+	OPD_CAPTURE_RECORD,
+	OPD_CAPTURE_REPLAY
+};
+
+extern enum opd_capture_mode opd_capture_mode;
+
+/** start recording in filename, failure is fatal */
+void opd_capture_record(char const * filename);
+
+/** record an option */
+void opd_capture_option(char const * name, char const * value);
+
+/** record an integer option */
+void opd_capture_int_option(char const * name, long value);
+
+/** record a buffer read from the kernel, size is in bytes */
+void opd_capture_buffer(char const * buffer, size_t size);
+
+/** record the name of a cookie, NULL if it can't be resolved */
+void opd_capture_cookie(cookie_t cookie, char const * name);
+
+/**
+ * Open a /proc file for reading, its content is recorded in record mode
+ * and read from the capture in replay mode. Return NULL on failure.
+ */
+FILE * opd_capture_open_file(char const * path);
+
+/** start replaying filename, failure is fatal */
+void opd_capture_replay(char const * filename);
+
+/**
+ * Read the capture up to the next buffer and return it, its size in
+ * bytes is stored in size. Return NULL at end of capture. The buffer
+ * is valid until the next call.
+ */
+char const * opd_capture_next_buffer(size_t * size);
+
+/** the last value of an option read from the capture, NULL if none */
+char const * opd_capture_get_option(char const * name);
+
+/** like lookup_dcookie() from the capture */
+int opd_capture_find_cookie(cookie_t cookie, char * buf, size_t size);
+
+#endif /* OPD_CAPTURE_H */
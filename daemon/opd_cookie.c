@@ -9,15 +9,21 @@
  */
 
 #include "opd_cookie.h"
+#include "opd_capture.h"
+#include "opd_decode.h"
+#include "opd_stats.h"
+#include "opd_trans.h"
 #include "oprofiled.h"
-#include "op_list.h"
 #include "op_libiberty.h"
+#include "op_string.h"
 
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #ifndef __NR_lookup_dcookie
@@ -86,100 +92,260 @@ static inline int lookup_dcookie(cookie_t cookie, char * buf, size_t size)
 #endif
 
 
+/*
+ * Cookies are kept in an open addressed table, the names resolved are
+ * interned in a string arena: a name takes its length, not PATH_MAX, and
+ * the cookies of the same file share it. Nothing is ever freed, cookies
+ * are valid for the whole session.
+ *
+ * With --prefetch-cookies the reader thread resolves the cookies of a
+ * buffer before the main thread processes it, the table is protected by
+ * cookie_lock. The name returned by find_cookie() stays valid since the
+ * arena never moves a string.
+ */
+
 struct cookie_entry {
+	/** NO_COOKIE if the slot is free */
 	cookie_t value;
-	char * name;
+	/** NULL if the lookup failed */
+	char const * name;
 	int ignored;
-	struct list_head list;
 };
 
+struct name_entry {
+	unsigned long hash;
+	/** NULL if the slot is free */
+	char const * name;
+};
+
+#define TABLE_MIN 1024
+#define ARENA_CHUNK 65536
+
+static pthread_mutex_t cookie_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct cookie_entry * cookies;
+static size_t cookies_size;
+static size_t nr_cookies;
+
+static struct name_entry * names;
+static size_t names_size;
+static size_t nr_names;
 
-#define HASH_SIZE 512
-#define HASH_BITS (HASH_SIZE - 1)
+static char * arena;
+static size_t arena_left;
 
-static struct list_head hashes[HASH_SIZE];
 
-static struct cookie_entry * create_cookie(cookie_t cookie)
+/* Cookie monster want cookie! */
+static size_t hash_cookie(cookie_t cookie, size_t size)
 {
-	int err;
-	struct cookie_entry * entry = xmalloc(sizeof(struct cookie_entry));
+	unsigned long long hash = (cookie >> DCOOKIE_SHIFT) *
+		0x9e3779b97f4a7c15ULL;
+	return (hash ^ (hash >> 32)) & (size - 1);
+}
 
-	entry->value = cookie;
-	entry->name = xmalloc(PATH_MAX + 1);
 
-	err = lookup_dcookie(cookie, entry->name, PATH_MAX);
+/** the slot of cookie, or the free slot where to add it */
+static struct cookie_entry * cookie_slot(cookie_t cookie)
+{
+	size_t mask = cookies_size - 1;
+	size_t index = hash_cookie(cookie, cookies_size);
 
-	if (err < 0) {
-		fprintf(stderr, "Lookup of cookie %llx failed, errno=%d\n",
-		       cookie, errno); 
-		free(entry->name);
-		entry->name = NULL;
-		entry->ignored = 0;
-	} else {
-		entry->ignored = is_image_ignored(entry->name);
+	while (cookies[index].value != NO_COOKIE &&
+	       cookies[index].value != cookie)
+		index = (index + 1) & mask;
+
+	return &cookies[index];
+}
+
+
+static void grow_cookies(void)
+{
+	struct cookie_entry * old = cookies;
+	size_t old_size = cookies_size;
+	size_t i;
+
+	cookies_size = old_size ? old_size * 2 : TABLE_MIN;
+	cookies = xcalloc(cookies_size, sizeof(struct cookie_entry));
+
+	for (i = 0; i < old_size; ++i) {
+		if (old[i].value != NO_COOKIE)
+			*cookie_slot(old[i].value) = old[i];
 	}
 
-	return entry;
+	free(old);
 }
 
 
-/* Cookie monster want cookie! */
-static unsigned long hash_cookie(cookie_t cookie)
+static struct name_entry * name_slot(char const * name, unsigned long hash)
+{
+	size_t mask = names_size - 1;
+	size_t index = hash & mask;
+
+	while (names[index].name && (names[index].hash != hash ||
+	       strcmp(names[index].name, name)))
+		index = (index + 1) & mask;
+
+	return &names[index];
+}
+
+
+static void grow_names(void)
 {
-	return (cookie >> DCOOKIE_SHIFT) & (HASH_SIZE - 1);
+	struct name_entry * old = names;
+	size_t old_size = names_size;
+	size_t i;
+
+	names_size = old_size ? old_size * 2 : TABLE_MIN;
+	names = xcalloc(names_size, sizeof(struct name_entry));
+
+	for (i = 0; i < old_size; ++i) {
+		if (old[i].name)
+			*name_slot(old[i].name, old[i].hash) = old[i];
+	}
+
+	free(old);
 }
- 
 
-char const * find_cookie(cookie_t cookie)
+
+/** return the arena copy of name, the same for all equal names */
+static char const * intern_name(char const * name)
+{
+	unsigned long hash = op_hash_string(name);
+	struct name_entry * entry;
+	size_t len;
+	char * copy;
+
+	if ((nr_names + 1) * 2 > names_size)
+		grow_names();
+
+	entry = name_slot(name, hash);
+	if (entry->name)
+		return entry->name;
+
+	len = strlen(name) + 1;
+	if (len > arena_left) {
+		arena_left = len > ARENA_CHUNK ? len : ARENA_CHUNK;
+		arena = xmalloc(arena_left);
+	}
+	copy = arena;
+	memcpy(copy, name, len);
+	arena += len;
+	arena_left -= len;
+
+	entry->hash = hash;
+	entry->name = copy;
+	++nr_names;
+
+	return copy;
+}
+
+
+/**
+ * resolve cookie in buf, return a negative value on failure. The reader
+ * thread resolves cookies too, so the stats are updated atomically.
+ */
+static int resolve_cookie(cookie_t cookie, char * buf)
+{
+	unsigned long long start = opd_now_usec();
+	int ret;
+
+	if (opd_capture_mode == OPD_CAPTURE_REPLAY)
+		ret = opd_capture_find_cookie(cookie, buf, PATH_MAX);
+	else
+		ret = lookup_dcookie(cookie, buf, PATH_MAX);
+
+	__sync_fetch_and_add(&opd_stats[OPD_COOKIE_RESOLVE], 1);
+	__sync_fetch_and_add(&opd_stats[OPD_COOKIE_USEC],
+	                     opd_now_usec() - start);
+
+	return ret;
+}
+
+
+/** add a resolved cookie, called with cookie_lock held */
+static struct cookie_entry * add_cookie(cookie_t cookie, char const * name)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
 	struct cookie_entry * entry;
 
-	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
-		return NULL;
+	if ((nr_cookies + 1) * 2 > cookies_size)
+		grow_cookies();
+
+	entry = cookie_slot(cookie);
+	/* the reader thread added it while we were resolving it */
+	if (entry->value == cookie)
+		return entry;
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie)
-			goto out;
+	entry->value = cookie;
+	if (name) {
+		entry->name = intern_name(name);
+		entry->ignored = is_image_ignored(entry->name);
+	} else {
+		entry->name = NULL;
+		entry->ignored = 0;
 	}
+	++nr_cookies;
 
-	/* not sure this can ever happen due to is_cookie_ignored */
-	entry = create_cookie(cookie);
-	list_add(&entry->list, &hashes[hash]);
-out:
-	return entry->name;
+	return entry;
 }
 
 
-int is_cookie_ignored(cookie_t cookie)
+/** return a copy of the entry of cookie, resolving it if needed */
+static struct cookie_entry get_cookie(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
+	static char buf[PATH_MAX + 1];
 	struct cookie_entry * entry;
+	struct cookie_entry result;
+	int err;
 
-	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
-		return 1;
+	pthread_mutex_lock(&cookie_lock);
+	entry = cookie_slot(cookie);
+	if (entry->value == cookie)
+		goto out;
+	pthread_mutex_unlock(&cookie_lock);
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie)
-			goto out;
+	/* not sure this can ever happen due to is_cookie_ignored */
+	err = resolve_cookie(cookie, buf);
+
+	if (opd_capture_mode == OPD_CAPTURE_RECORD)
+		opd_capture_cookie(cookie, err < 0 ? NULL : buf);
+
+	if (err < 0) {
+		fprintf(stderr, "Lookup of cookie %llx failed, errno=%d\n",
+		       cookie, errno); 
 	}
 
-	entry = create_cookie(cookie);
-	list_add(&entry->list, &hashes[hash]);
+	pthread_mutex_lock(&cookie_lock);
+	entry = add_cookie(cookie, err < 0 ? NULL : buf);
 out:
-	return entry->ignored;
+	result = *entry;
+	pthread_mutex_unlock(&cookie_lock);
+
+	return result;
+}
+
+
+char const * find_cookie(cookie_t cookie)
+{
+	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
+		return NULL;
+
+	return get_cookie(cookie).name;
+}
+
+
+int is_cookie_ignored(cookie_t cookie)
+{
+	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
+		return 1;
+
+	return get_cookie(cookie).ignored;
 }
 
 
 char const * verbose_cookie(cookie_t cookie)
 {
-	unsigned long hash = hash_cookie(cookie);
-	struct list_head * pos;
 	struct cookie_entry * entry;
+	char const * name = "not hashed";
 
 	if (cookie == INVALID_COOKIE)
 		return "invalid";
@@ -187,23 +353,87 @@ char const * verbose_cookie(cookie_t cookie)
 	if (cookie == NO_COOKIE)
 		return "anonymous";
 
-	list_for_each(pos, &hashes[hash]) {
-		entry = list_entry(pos, struct cookie_entry, list);
-		if (entry->value == cookie) {
-			if (!entry->name)
-				return "failed lookup";
-			return entry->name;
-		}
-	}
+	pthread_mutex_lock(&cookie_lock);
+	entry = cookie_slot(cookie);
+	if (entry->value == cookie)
+		name = entry->name ? entry->name : "failed lookup";
+	pthread_mutex_unlock(&cookie_lock);
 
-	return "not hashed";
+	return name;
 }
 
 
-void cookie_init(void)
+/** resolve a cookie from the reader thread, failures are left to
+ * get_cookie() which reports them */
+static void prefetch_cookie(cookie_t cookie)
+{
+	static char buf[PATH_MAX + 1];
+	int known;
+
+	if (cookie == INVALID_COOKIE || cookie == NO_COOKIE)
+		return;
+
+	pthread_mutex_lock(&cookie_lock);
+	known = cookie_slot(cookie)->value == cookie;
+	pthread_mutex_unlock(&cookie_lock);
+
+	if (known || resolve_cookie(cookie, buf) < 0)
+		return;
+
+	pthread_mutex_lock(&cookie_lock);
+	add_cookie(cookie, buf);
+	pthread_mutex_unlock(&cookie_lock);
+}
+
+
+static cookie_t buffer_word(char const * buffer, size_t index)
+{
+	if (kernel_pointer_size == 4) {
+		uint32_t word;
+		memcpy(&word, buffer + index * 4, 4);
+		return word;
+	} else {
+		uint64_t word;
+		memcpy(&word, buffer + index * 8, 8);
+		return word;
+	}
+}
+
+
+void cookie_prefetch(char const * buffer, size_t count)
 {
+	static struct opd_record records[OPD_DECODE_BATCH];
+	size_t nr_record;
+	size_t nr_word;
 	size_t i;
 
-	for (i = 0; i < HASH_SIZE; ++i)
-		list_init(&hashes[i]);
+	/* a capture must see the cookies in the order they are used */
+	if (opd_capture_mode != OPD_CAPTURE_NONE)
+		return;
+
+	while (count) {
+		nr_word = opd_decode_buffer(records, &nr_record, buffer, count,
+		                            kernel_pointer_size);
+		for (i = 0; i < nr_record; ++i) {
+			struct opd_record const * rec = &records[i];
+			if (rec->code == COOKIE_SWITCH_CODE)
+				prefetch_cookie(buffer_word(buffer, rec->arg));
+			else if (rec->code == CTX_SWITCH_CODE)
+				prefetch_cookie(buffer_word(buffer, rec->arg + 1));
+		}
+
+		/* stop at an entry the decoder doesn't know, the rest of
+		 * the buffer may be misread */
+		if (!nr_word)
+			break;
+		buffer += nr_word * kernel_pointer_size;
+		count -= nr_word;
+	}
+}
+
+
+void cookie_init(void)
+{
+	grow_cookies();
+	grow_names();
 }
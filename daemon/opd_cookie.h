@@ -11,6 +11,8 @@
 #ifndef OPD_COOKIE_H
 #define OPD_COOKIE_H
 
+#include <stddef.h>
+
 typedef unsigned long long cookie_t;
 
 #define INVALID_COOKIE ~0LLU
@@ -34,6 +36,12 @@ int is_cookie_ignored(cookie_t cookie);
 /** give a textual description of the cookie */
 char const * verbose_cookie(cookie_t cookie);
 
+/**
+ * Resolve the cookies used in a buffer of count words ahead of its
+ * processing, called from the reader thread.
+ */
+void cookie_prefetch(char const * buffer, size_t count);
+
 void cookie_init(void);
 
 #endif /* OPD_COOKIE_H */
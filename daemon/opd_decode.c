@@ -0,0 +1,118 @@
+/**
+ * @file daemon/opd_decode.c
+ * Decoding of the sample buffer
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_decode.h"
+
+int const opd_code_nr_args[LAST_CODE] = {
+	-1,
+	/* CTX_SWITCH_CODE: tid, app cookie then ESCAPE_CODE, CTX_TGID_CODE,
+	 * tgid, see code_ctx_switch() */
+	5,
+	/* CPU_SWITCH_CODE */
+	1,
+	/* COOKIE_SWITCH_CODE */
+	1,
+	/* KERNEL_ENTER_SWITCH_CODE */
+	0,
+	/* USER_ENTER_SWITCH_CODE */
+	0,
+	/* MODULE_LOADED_CODE */
+	0,
+	/* CTX_TGID_CODE is only seen as part of CTX_SWITCH_CODE */
+	-1,
+	/* TRACE_BEGIN_CODE */
+	0,
+	-1,
+	/* XEN_ENTER_SWITCH_CODE */
+	0,
+	/* SPU and IBS codes are left to their own handler */
+	-1,
+	-1,
+	-1,
+	-1,
+};
+
+
+/* read the word i of a buffer of words of size bytes */
+#define BUFFER_WORD(buffer, i, size) \
+	((size) == 4 ? (uint64_t)((uint32_t const *)(buffer))[i] \
+	             : ((uint64_t const *)(buffer))[i])
+
+/*
+ * The main loop is written once, size is a constant in each caller so the
+ * word size tests are resolved at compile time.
+ */
+static inline __attribute__((always_inline)) size_t
+decode_words(struct opd_record * record, size_t * nr_record,
+             char const * buffer, size_t count, size_t const size)
+{
+	uint64_t const escape = size == 4 ? 0xffffffffULL : ~0ULL;
+	size_t pos = 0;
+	size_t nr = 0;
+
+	while (pos < count && nr < OPD_DECODE_BATCH) {
+		uint64_t word = BUFFER_WORD(buffer, pos, size);
+		struct opd_record * rec = &record[nr];
+		uint64_t arg;
+
+		/* every entry, a sample or an escape, is at least two words */
+		if (pos + 1 >= count)
+			break;
+		arg = BUFFER_WORD(buffer, pos + 1, size);
+
+		if (word != escape) {
+			/* a sample: pc then event */
+			if (arg > UINT32_MAX)
+				break;
+			rec->value = word;
+			rec->code = OPD_RECORD_SAMPLE;
+			rec->arg = arg;
+			pos += 2;
+		} else {
+			if (arg >= LAST_CODE || opd_code_nr_args[arg] < 0 ||
+			    pos + 2 + opd_code_nr_args[arg] > count)
+				break;
+			rec->value = 0;
+			rec->code = arg;
+			rec->arg = pos + 2;
+			pos += 2 + opd_code_nr_args[arg];
+		}
+		++nr;
+	}
+
+	*nr_record = nr;
+	return pos;
+}
+
+
+static size_t decode_32(struct opd_record * record, size_t * nr_record,
+                        char const * buffer, size_t count)
+{
+	return decode_words(record, nr_record, buffer, count, 4);
+}
+
+
+static size_t decode_64(struct opd_record * record, size_t * nr_record,
+                        char const * buffer, size_t count)
+{
+	return decode_words(record, nr_record, buffer, count, 8);
+}
+
+
+size_t opd_decode_buffer(struct opd_record * record, size_t * nr_record,
+                         char const * buffer, size_t count,
+                         size_t pointer_size)
+{
+	/* a record stores a buffer index on 32 bits */
+	if (count > UINT32_MAX)
+		count = UINT32_MAX;
+
+	if (pointer_size == 4)
+		return decode_32(record, nr_record, buffer, count);
+	return decode_64(record, nr_record, buffer, count);
+}
@@ -0,0 +1,57 @@
+/**
+ * @file daemon/opd_decode.h
+ * Decoding of the sample buffer
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_DECODE_H
+#define OPD_DECODE_H
+
+#include "opd_interface.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** record code of a sample, escape codes are all below */
+#define OPD_RECORD_SAMPLE	LAST_CODE
+
+/** max nr of record decoded in one go */
+#define OPD_DECODE_BATCH	1024
+
+/**
+ * A decoded buffer entry: a sample or an escape code. The arguments of an
+ * escape code are not copied, they are read in the buffer when the code is
+ * processed.
+ */
+struct opd_record {
+	/** pc of a sample, unused for an escape code */
+	uint64_t value;
+	/** OPD_RECORD_SAMPLE or the escape code */
+	uint32_t code;
+	/** event of a sample, else index in the buffer of the first
+	 * argument of the escape code */
+	uint32_t arg;
+};
+
+/** nr of arguments of an escape code, -1 if it can't be decoded */
+extern int const opd_code_nr_args[LAST_CODE];
+
+/**
+ * opd_decode_buffer - decode a sample buffer
+ * @param record  where to store at most OPD_DECODE_BATCH records
+ * @param nr_record  nr of records decoded
+ * @param buffer  the sample buffer
+ * @param count  nr of words in buffer
+ * @param pointer_size  size of a buffer word, 4 or 8
+ *
+ * Decoding stops before a truncated entry or an escape code with a
+ * variable number of arguments, caller must process it the slow way.
+ * Returns the nr of words decoded.
+ */
+size_t opd_decode_buffer(struct opd_record * record, size_t * nr_record,
+                         char const * buffer, size_t count,
+                         size_t pointer_size);
+
+#endif /* OPD_DECODE_H */
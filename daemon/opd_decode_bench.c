@@ -0,0 +1,181 @@
+/**
+ * @file daemon/opd_decode_bench.c
+ * Replay a captured sample buffer through the decoder
+ *
+ * usage: opd_decode_bench buffer_file [pointer_size [nr_pass]]
+ *
+ * The buffer file is a raw copy of what the daemon reads from the kernel
+ * buffer. The batched decoder is checked against a word by word decode
+ * then timed over nr_pass passes.
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_decode.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+static size_t pointer_size = sizeof(unsigned long);
+
+static char * buffer;
+static size_t nr_word;
+
+static struct opd_record records[OPD_DECODE_BATCH];
+
+
+static double used_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void read_buffer(char const * filename)
+{
+	FILE * fp = fopen(filename, "r");
+	size_t size = 0;
+	size_t len;
+
+	if (!fp) {
+		perror(filename);
+		exit(EXIT_FAILURE);
+	}
+
+	buffer = malloc(65536);
+	while ((len = fread(buffer + size, 1, 65536, fp)) != 0) {
+		size += len;
+		buffer = realloc(buffer, size + 65536);
+	}
+	fclose(fp);
+
+	nr_word = size / pointer_size;
+}
+
+
+static uint64_t word(size_t pos)
+{
+	if (pointer_size == 4)
+		return ((uint32_t const *)buffer)[pos];
+	return ((uint64_t const *)buffer)[pos];
+}
+
+
+/**
+ * Decode the buffer word by word like the legacy opd_process_samples()
+ * and check the batched decode gives the same records, return the
+ * nr of samples. An entry the decoder doesn't handle is skipped by both.
+ */
+static size_t check_decode(void)
+{
+	uint64_t const escape = pointer_size == 4 ? 0xffffffffULL : ~0ULL;
+	size_t nr_sample = 0;
+	size_t pos = 0;
+
+	while (pos < nr_word) {
+		size_t const chunk = pos;
+		size_t nr_record, i, nr;
+
+		nr = opd_decode_buffer(records, &nr_record,
+				       buffer + pos * pointer_size,
+				       nr_word - pos, pointer_size);
+		for (i = 0; i < nr_record; ++i) {
+			struct opd_record const * rec = &records[i];
+
+			if (word(pos) != escape) {
+				if (rec->code != OPD_RECORD_SAMPLE ||
+				    rec->value != word(pos) ||
+				    rec->arg != word(pos + 1))
+					goto mismatch;
+				++nr_sample;
+				pos += 2;
+			} else {
+				if (rec->code != word(pos + 1) ||
+				    rec->arg != pos + 2 - chunk)
+					goto mismatch;
+				pos += 2 + opd_code_nr_args[rec->code];
+			}
+			continue;
+mismatch:
+			fprintf(stderr, "mismatch at word %lu\n",
+				(unsigned long)pos);
+			exit(EXIT_FAILURE);
+		}
+
+		/* skip an entry the decoder stopped on, the escape code and
+		 * its type are enough to resume on a valid capture */
+		if (nr == 0)
+			pos += 2;
+	}
+
+	return nr_sample;
+}
+
+
+static size_t decode_pass(void)
+{
+	size_t nr_record_total = 0;
+	size_t pos = 0;
+
+	while (pos < nr_word) {
+		size_t nr_record;
+		size_t nr = opd_decode_buffer(records, &nr_record,
+					      buffer + pos * pointer_size,
+					      nr_word - pos, pointer_size);
+		nr_record_total += nr_record;
+		pos += nr ? nr : 2;
+	}
+
+	return nr_record_total;
+}
+
+
+int main(int argc, char * argv[])
+{
+	size_t nr_sample, nr_record = 0;
+	size_t nr_pass = 100;
+	double begin, end;
+	size_t i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s buffer_file [pointer_size "
+			"[nr_pass]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2)
+		pointer_size = strtoul(argv[2], NULL, 0);
+	if (pointer_size != 4 && pointer_size != 8) {
+		fprintf(stderr, "pointer size must be 4 or 8\n");
+		return EXIT_FAILURE;
+	}
+	if (argc > 3)
+		nr_pass = strtoul(argv[3], NULL, 0);
+	if (!nr_pass)
+		nr_pass = 1;
+
+	read_buffer(argv[1]);
+	nr_sample = check_decode();
+
+	begin = used_time();
+	for (i = 0; i < nr_pass; ++i)
+		nr_record += decode_pass();
+	end = used_time();
+
+	if (end <= begin)
+		end = begin + 1e-6;
+
+	printf("%lu words, %lu records, %lu samples per pass\n",
+	       (unsigned long)nr_word, (unsigned long)(nr_record / nr_pass),
+	       (unsigned long)nr_sample);
+	printf("%.0f words/sec, %.0f samples/sec\n",
+	       (nr_word * nr_pass) / (end - begin),
+	       (nr_sample * nr_pass) / (end - begin));
+
+	free(buffer);
+	return EXIT_SUCCESS;
+}
@@ -35,8 +35,6 @@
 
 extern op_cpu cpu_type;
 extern int no_event_ok;
-extern int sfile_equal(struct sfile const * sf, struct sfile const * sf2);
-extern void sfile_dup(struct sfile * to, struct sfile * from);
 
 /* IBS Select Arrays/Counters */
 static unsigned int ibs_selected_size;
@@ -576,7 +574,7 @@ static int ibs_sfile_close(struct sfile * sf)
 	unsigned int i;
 	if (sf->ext_files != NULL) {
 		for (i = 0; i < ibs_selected_size ; ++i)
-			odb_close(&sf->ext_files[i]);
+			opd_close_sample_file(&sf->ext_files[i]);
 
 		free(sf->ext_files);
 		sf->ext_files= NULL;
@@ -598,9 +596,6 @@ static odb_t * ibs_sfile_get(struct transient const * trans, int is_cg)
 {
 	struct sfile * sf = trans->current;
 	struct sfile * last = trans->last;
-	struct cg_entry * cg;
-	struct list_head * pos;
-	unsigned long hash;
 	odb_t * file;
 	unsigned long counter, ibs_vci, key;
 
@@ -621,28 +616,9 @@ static odb_t * ibs_sfile_get(struct transient const * trans, int is_cg)
 		ibs_sfile_create(sf);
 
 	file = &(sf->ext_files[ibs_vci]);
-	if (!is_cg)
-		goto open;
+	if (is_cg)
+		file = &(sfile_get_cg(sf, last)->to.ext_files[ibs_vci]);
 
-	hash = last->hashval & (CG_HASH_SIZE - 1);
-
-	/* Need to look for the right 'to'. Since we're looking for
-	 * 'last', we use its hash.
-	 */
-	list_for_each(pos, &sf->cg_hash[hash]) {
-		cg = list_entry(pos, struct cg_entry, hash);
-		if (sfile_equal(last, &cg->to)) {
-			file = &(cg->to.ext_files[ibs_vci]);
-			goto open;
-		}
-	}
-
-	cg = xmalloc(sizeof(struct cg_entry));
-	sfile_dup(&cg->to, last);
-	list_add(&cg->hash, &sf->cg_hash[hash]);
-	file = &(cg->to.ext_files[ibs_vci]);
-
-open:
 	if (!odb_open_count(file))
 		opd_open_sample_file(file, last, sf, counter, is_cg);
 
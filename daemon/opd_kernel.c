@@ -17,6 +17,7 @@
 #include "opd_trans.h"
 #include "opd_printf.h"
 #include "opd_stats.h"
+#include "opd_capture.h"
 #include "oprofiled.h"
 
 #include "op_fileio.h"
@@ -30,6 +31,13 @@
 
 static LIST_HEAD(modules);
 
+/** the modules sorted by start address, rebuilt with the modules list */
+static struct kernel_image ** module_index;
+static size_t nr_module_index;
+
+/** the module found by the last lookup, NULL if none */
+static struct kernel_image * last_module;
+
 static struct kernel_image vmlinux_image;
 
 static struct kernel_image xen_image;
@@ -90,42 +98,142 @@ void opd_create_xen(char const * name, char const * arg)
  * @param name image name
  * @param start start address
  * @param end end address
+ * @param list list to add the image to
  */
 static struct kernel_image *
-opd_create_module(char const * name, vma_t start, vma_t end)
+opd_create_module(char const * name, vma_t start, vma_t end,
+                  struct list_head * list)
 {
 	struct kernel_image * image = xmalloc(sizeof(struct kernel_image));
 
 	image->name = xstrdup(name);
 	image->start = start;
 	image->end = end;
-	list_add(&image->list, &modules);
+	list_add(&image->list, list);
 
 	return image;
 }
 
 
+static void opd_free_module(struct kernel_image * image)
+{
+	list_del(&image->list);
+	free(image->name);
+	free(image);
+}
+
+
+static int module_compare(void const * lhs, void const * rhs)
+{
+	struct kernel_image const * l = *(struct kernel_image * const *)lhs;
+	struct kernel_image const * r = *(struct kernel_image * const *)rhs;
+
+	if (l->start != r->start)
+		return l->start < r->start ? -1 : 1;
+	return 0;
+}
+
+
+/** build the sorted array of modules searched by find_kernel_image() */
+static void opd_index_modules(void)
+{
+	struct list_head * pos;
+	size_t nr = 0;
+
+	free(module_index);
+	module_index = NULL;
+	nr_module_index = 0;
+
+	list_for_each(pos, &modules)
+		++nr;
+
+	if (!nr)
+		return;
+
+	module_index = xmalloc(nr * sizeof(struct kernel_image *));
+	list_for_each(pos, &modules) {
+		module_index[nr_module_index++] =
+			list_entry(pos, struct kernel_image, list);
+	}
+
+	qsort(module_index, nr_module_index, sizeof(struct kernel_image *),
+	      module_compare);
+}
+
+
+/** binary search of the module containing pc, NULL if none */
+static struct kernel_image * find_module(vma_t pc)
+{
+	size_t low = 0;
+	size_t high = nr_module_index;
+	struct kernel_image * image;
+
+	/* find the last module starting at or below pc */
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (module_index[mid]->start <= pc)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	if (!low)
+		return NULL;
+
+	image = module_index[low - 1];
+	return image->end > pc ? image : NULL;
+}
+
+
 /**
- * Clear and free all kernel image information and reset
- * values.
+ * Replace the modules list by new_modules. The modules whose name and
+ * range didn't change are kept, so are their sample files, only the
+ * sample files of the modules gone or moved are closed.
  */
-static void opd_clear_modules(void)
+static void opd_update_modules(struct list_head * new_modules)
 {
+	LIST_HEAD(kept);
 	struct list_head * pos;
 	struct list_head * pos2;
 	struct kernel_image * image;
+	struct kernel_image * old;
+
+	list_for_each_safe(pos, pos2, new_modules) {
+		image = list_entry(pos, struct kernel_image, list);
+		old = find_module(image->start);
+		if (!old || old->start != image->start ||
+		    old->end != image->end || strcmp(old->name, image->name))
+			continue;
+
+		list_del(&old->list);
+		list_add(&old->list, &kept);
+		opd_free_module(image);
+	}
 
 	list_for_each_safe(pos, pos2, &modules) {
 		image = list_entry(pos, struct kernel_image, list);
-		if (image->name)
-			free(image->name);
-		free(image);
+		verbprintf(vmodule, "module %s start %llx end %llx removed\n",
+		           image->name, image->start, image->end);
+		/* clear out lingering references */
+		sfile_clear_kernel(image);
+		opd_free_module(image);
+	}
+
+	list_for_each_safe(pos, pos2, &kept) {
+		list_del(pos);
+		list_add(pos, &modules);
 	}
 
-	list_init(&modules);
+	list_for_each_safe(pos, pos2, new_modules) {
+		image = list_entry(pos, struct kernel_image, list);
+		verbprintf(vmodule, "module %s start %llx end %llx\n",
+		           image->name, image->start, image->end);
+		list_del(pos);
+		list_add(pos, &modules);
+	}
 
-	/* clear out lingering references */
-	sfile_clear_kernel();
+	last_module = NULL;
+	opd_index_modules();
 }
 
 
@@ -138,9 +246,9 @@ static void opd_clear_modules(void)
  */
 void opd_reread_module_info(void)
 {
+	LIST_HEAD(new_modules);
 	FILE * fp;
 	char * line;
-	struct kernel_image * image;
 	int module_size;
 	char ref_count[32+1];
 	int ret;
@@ -152,15 +260,14 @@ void opd_reread_module_info(void)
 	if (no_vmlinux)
 		return;
 
-	opd_clear_modules();
-
 	printf("Reading module info.\n");
 
-	fp = op_try_open_file("/proc/modules", "r");
+	fp = opd_capture_open_file("/proc/modules");
 
 	if (!fp) {
 		printf("oprofiled: /proc/modules not readable, "
 			"can't process module samples.\n");
+		opd_update_modules(&new_modules);
 		return;
 	}
 
@@ -184,16 +291,15 @@ void opd_reread_module_info(void)
 			continue;
 		}
 
-		image = opd_create_module(module_name, start_address,
-		                          start_address + module_size);
-
-		verbprintf(vmodule, "module %s start %llx end %llx\n",
-			   image->name, image->start, image->end);
+		opd_create_module(module_name, start_address,
+		                  start_address + module_size, &new_modules);
 
 		free(line);
 	}
 
 	op_close_file(fp);
+
+	opd_update_modules(&new_modules);
 }
 
 
@@ -207,7 +313,6 @@ void opd_reread_module_info(void)
  */
 struct kernel_image * find_kernel_image(struct transient const * trans)
 {
-	struct list_head * pos;
 	struct kernel_image * image = &vmlinux_image;
 
 	if (no_vmlinux)
@@ -216,10 +321,15 @@ struct kernel_image * find_kernel_image(struct transient const * trans)
 	if (image->start <= trans->pc && image->end > trans->pc)
 		return image;
 
-	list_for_each(pos, &modules) {
-		image = list_entry(pos, struct kernel_image, list);
-		if (image->start <= trans->pc && image->end > trans->pc)
-			return image;
+	/* consecutive samples tend to fall in the same module */
+	image = last_module;
+	if (image && image->start <= trans->pc && image->end > trans->pc)
+		return image;
+
+	image = find_module(trans->pc);
+	if (image) {
+		last_module = image;
+		return image;
 	}
 
 	if (xen_image.start <= trans->pc && xen_image.end > trans->pc)
@@ -227,3 +337,21 @@ struct kernel_image * find_kernel_image(struct transient const * trans)
 
 	return NULL;
 }
+
+
+int is_kernel_image(struct kernel_image const * image,
+                    struct transient const * trans)
+{
+	if (no_vmlinux)
+		return image == &vmlinux_image;
+
+	/* vmlinux is searched first, it hides the images overlapping it */
+	if (vmlinux_image.start <= trans->pc && vmlinux_image.end > trans->pc)
+		return image == &vmlinux_image;
+
+	/* then the modules, they hide the xen image overlapping them */
+	if (image == &xen_image && find_module(trans->pc))
+		return 0;
+
+	return image->start <= trans->pc && image->end > trans->pc;
+}
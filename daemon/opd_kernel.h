@@ -40,4 +40,12 @@ struct kernel_image {
 struct kernel_image *
 find_kernel_image(struct transient const * trans);
 
+/**
+ * Return non-zero if find_kernel_image(trans) returns image, checking
+ * only the range of image and of vmlinux, and the modules for the xen
+ * image. The modules are assumed to not overlap each other.
+ */
+int is_kernel_image(struct kernel_image const * image,
+                    struct transient const * trans);
+
 #endif /* OPD_KERNEL_H */
@@ -18,6 +18,8 @@
 #include "opd_anon.h"
 #include "opd_printf.h"
 #include "opd_events.h"
+#include "opd_size_hint.h"
+#include "opd_stats.h"
 #include "oprofiled.h"
 
 #include "op_file.h"
@@ -54,32 +56,38 @@ static char const * get_dep_name(struct sfile const * sf)
 }
 
 
-static char * mangle_anon(struct anon_mapping const * anon)
-{
-	char * name = xmalloc(PATH_MAX);
+/** large enough for the mangled name of any anon mapping */
+#define ANON_NAME_LEN 64
 
-	snprintf(name, 1024, "%u.0x%llx.0x%llx", (unsigned int)anon->tgid,
-	       anon->start, anon->end);
+static char const * mangle_anon(char * buf, struct anon_mapping const * anon)
+{
+	snprintf(buf, ANON_NAME_LEN, "%u.0x%llx.0x%llx",
+	         (unsigned int)anon->tgid, anon->start, anon->end);
 
-	return name;
+	return buf;
 }
 
 
-static char *
-mangle_filename(struct sfile * last, struct sfile const * sf, int counter, int cg)
+/** the image directory of sf sample files, cached in sf, NULL on failure */
+static char const * mangle_dir(struct sfile * sf)
 {
-	char * mangled;
+	char anon_name[ANON_NAME_LEN];
+	char buf[PATH_MAX];
 	struct mangle_values values;
-	struct opd_event * event = find_counter_event(counter);
+	size_t len;
+
+	if (sf->mangled_dir)
+		return sf->mangled_dir;
 
 	values.flags = 0;
+	values.anon_name = NULL;
 
 	if (sf->kernel) {
 		values.image_name = sf->kernel->name;
 		values.flags |= MANGLE_KERNEL;
 	} else if (sf->anon) {
 		values.flags |= MANGLE_ANON;
-		values.image_name = mangle_anon(sf->anon);
+		values.image_name = mangle_anon(anon_name, sf->anon);
 		values.anon_name = sf->anon->name;
 	} else {
 		values.image_name = find_cookie(sf->cookie);
@@ -88,74 +96,101 @@ mangle_filename(struct sfile * last, struct sfile const * sf, int counter, int c
 	values.dep_name = get_dep_name(sf);
 	if (!values.dep_name)
 		values.dep_name = values.image_name;
- 
+
 	/* FIXME: log */
 	if (!values.image_name || !values.dep_name)
 		return NULL;
 
-	if (separate_thread) {
-		values.flags |= MANGLE_TGID | MANGLE_TID;
-		values.tid = sf->tid;
-		values.tgid = sf->tgid;
-	}
- 
-	if (separate_cpu) {
-		values.flags |= MANGLE_CPU;
-		values.cpu = sf->cpu;
-	}
+	len = op_mangle_dir(buf, PATH_MAX, &values);
+	if (len >= PATH_MAX)
+		return NULL;
+
+	sf->mangled_dir = xmalloc(len + 1);
+	memcpy(sf->mangled_dir, buf, len + 1);
+	return sf->mangled_dir;
+}
+
+
+/**
+ * Write the sample filename of sf in buf of PATH_MAX bytes, for an arc
+ * from last if cg is non-zero. Return 0 on success.
+ */
+static int mangle_filename(char * buf, struct sfile * last,
+                           struct sfile * sf, int counter, int cg)
+{
+	char anon_name[ANON_NAME_LEN];
+	struct mangle_values values;
+	struct opd_event * event = find_counter_event(counter);
+	char const * dir = mangle_dir(sf);
+	size_t len;
+
+	if (!dir)
+		return -1;
+
+	len = strlen(dir);
+	memcpy(buf, dir, len + 1);
+
+	values.flags = sf->kernel ? MANGLE_KERNEL : 0;
 
 	if (cg) {
 		values.flags |= MANGLE_CALLGRAPH;
+		values.anon_name = NULL;
 		if (last->kernel) {
 			values.cg_image_name = last->kernel->name;
 		} else if (last->anon) {
 			values.flags |= MANGLE_CG_ANON;
-			values.cg_image_name = mangle_anon(last->anon);
+			values.cg_image_name = mangle_anon(anon_name,
+			                                   last->anon);
 			values.anon_name = last->anon->name;
 		} else {
 			values.cg_image_name = find_cookie(last->cookie);
 		}
 
 		/* FIXME: log */
-		if (!values.cg_image_name) {
-			if (values.flags & MANGLE_ANON)
-				free((char *)values.image_name);
-			return NULL;
-		}
+		if (!values.cg_image_name)
+			return -1;
+
+		len += op_mangle_cg_dir(buf + len, PATH_MAX - len, &values);
+		if (len >= PATH_MAX)
+			return -1;
+	}
+
+	if (separate_thread) {
+		values.flags |= MANGLE_TGID | MANGLE_TID;
+		values.tid = sf->tid;
+		values.tgid = sf->tgid;
+	}
+ 
+	if (separate_cpu) {
+		values.flags |= MANGLE_CPU;
+		values.cpu = sf->cpu;
 	}
 
 	values.event_name = event->name;
 	values.count = event->count;
 	values.unit_mask = event->um;
 
-	mangled = op_mangle_filename(&values);
+	len += op_mangle_name(buf + len, PATH_MAX - len, &values);
 
-	if (values.flags & MANGLE_ANON)
-		free((char *)values.image_name);
-	if (values.flags & MANGLE_CG_ANON)
-		free((char *)values.cg_image_name);
-	return mangled;
+	return len >= PATH_MAX ? -1 : 0;
 }
 
 
 int opd_open_sample_file(odb_t *file, struct sfile *last,
                          struct sfile * sf, int counter, int cg)
 {
-	char * mangled;
+	char mangled[PATH_MAX];
 	char const * binary;
 	int spu_profile = 0;
 	vma_t last_start = 0;
+	int path_created = 0;
 	int err;
 
-	mangled = mangle_filename(last, sf, counter, cg);
-
-	if (!mangled)
+	if (mangle_filename(mangled, last, sf, counter, cg))
 		return EINVAL;
 
 	verbprintf(vsfile, "Opening \"%s\"\n", mangled);
 
-	create_path(mangled);
-
 	/* locking sf will lock associated cg files too */
 	sfile_get(sf);
 	if (sf != last)
@@ -164,6 +199,14 @@ int opd_open_sample_file(odb_t *file, struct sfile *last,
 retry:
 	err = odb_open(file, mangled, ODB_RDWR, sizeof(struct opd_header));
 
+	/* the directories exist already when a file is reopened, they are
+	 * only created when missing */
+	if (err == ENOENT && !path_created) {
+		path_created = 1;
+		create_path(mangled);
+		goto retry;
+	}
+
 	/* This can naturally happen when racing against opcontrol --reset. */
 	if (err) {
 		if (err == EMFILE) {
@@ -179,6 +222,14 @@ retry:
 		goto out;
 	}
 
+	/* typically a file closed by sfile_lru_evict() */
+	if (odb_open_count(file) == 1 && odb_get_node_nr(file))
+		opd_stats[OPD_SFILE_REOPEN]++;
+
+	/* a new file for a binary profiled before: avoid to grow it again
+	 * step by step, on failure it will be grown as usual */
+	odb_presize(file, size_hint_find(mangled));
+
 	if (!sf->kernel)
 		binary = find_cookie(sf->cookie);
 	else
@@ -200,6 +251,14 @@ out:
 	sfile_put(sf);
 	if (sf != last)
 		sfile_put(last);
-	free(mangled);
 	return err;
 }
+
+
+void opd_close_sample_file(odb_t * file)
+{
+	/* it's OK to close a non-open odb file */
+	if (file->data)
+		size_hint_record(file->data->filename, odb_get_node_nr(file));
+	odb_close(file);
+}
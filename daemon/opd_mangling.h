@@ -30,4 +30,13 @@ struct sfile;
 int opd_open_sample_file(odb_t *file, struct sfile *last,
                          struct sfile * sf, int counter, int cg);
 
+/*
+ * opd_close_sample_file - close a sample file
+ * @param file  the sample file, can be not open
+ *
+ * Close a sample file opened by opd_open_sample_file() remembering its
+ * size for the next session.
+ */
+void opd_close_sample_file(odb_t * file);
+
 #endif /* OPD_MANGLING_H */
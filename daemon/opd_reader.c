@@ -0,0 +1,156 @@
+/**
+ * @file daemon/opd_reader.c
+ * Reading the kernel buffer from a separate thread
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_reader.h"
+#include "opd_cookie.h"
+#include "opd_stats.h"
+#include "opd_trans.h"
+#include "oprofiled.h"
+
+#include "op_deviceio.h"
+#include "op_libiberty.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+struct read_buffer {
+	char * buf;
+	ssize_t count;
+};
+
+static fd_t reader_fd;
+static size_t buffer_size;
+
+/** protect all the fields below */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/** signaled when a buffer is read */
+static pthread_cond_t not_empty = PTHREAD_COND_INITIALIZER;
+/** signaled when a buffer is processed */
+static pthread_cond_t not_full = PTHREAD_COND_INITIALIZER;
+static struct read_buffer * ring;
+static size_t nr_ring;
+/** oldest buffer read */
+static size_t head;
+/** nr of buffers read and not yet given back */
+static size_t nr_full;
+/** time the reader waited for a free buffer */
+static unsigned long blocked_usec;
+
+
+static unsigned long long now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+
+static void * reader_main(void * arg __attribute__((unused)))
+{
+	struct read_buffer * buffer;
+	ssize_t count;
+
+	while (1) {
+		pthread_mutex_lock(&lock);
+		if (nr_full == nr_ring) {
+			unsigned long long start = now_usec();
+			while (nr_full == nr_ring)
+				pthread_cond_wait(&not_full, &lock);
+			blocked_usec += now_usec() - start;
+		}
+		buffer = &ring[(head + nr_full) % nr_ring];
+		pthread_mutex_unlock(&lock);
+
+		/* the buffer is free, nobody else touches it */
+		count = op_read_device(reader_fd, buffer->buf, buffer_size);
+		if (count < 0)
+			continue;
+
+		/* take the dcookie lookups off the main thread */
+		if (prefetch_cookies)
+			cookie_prefetch(buffer->buf, count / kernel_pointer_size);
+
+		pthread_mutex_lock(&lock);
+		buffer->count = count;
+		++nr_full;
+		pthread_cond_signal(&not_empty);
+		pthread_mutex_unlock(&lock);
+	}
+
+	return NULL;
+}
+
+
+void opd_reader_start(fd_t devfd, size_t nr_buffer, size_t size)
+{
+	pthread_t thread;
+	sigset_t all_signals;
+	sigset_t old_mask;
+	size_t i;
+
+	reader_fd = devfd;
+	buffer_size = size;
+	nr_ring = nr_buffer;
+	ring = xmalloc(nr_ring * sizeof(struct read_buffer));
+	for (i = 0; i < nr_ring; ++i)
+		ring[i].buf = xmalloc(size);
+
+	/* signals are handled by the main thread only */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+	if (pthread_create(&thread, NULL, reader_main, NULL)) {
+		perror("oprofiled: couldn't create reader thread: ");
+		exit(EXIT_FAILURE);
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+
+char const * opd_reader_get(ssize_t * count, unsigned int msec)
+{
+	struct read_buffer * buffer = NULL;
+	unsigned long long timeout;
+	struct timespec ts;
+
+	timeout = now_usec() + msec * 1000ULL;
+	ts.tv_sec = timeout / 1000000;
+	ts.tv_nsec = (timeout % 1000000) * 1000;
+
+	pthread_mutex_lock(&lock);
+	while (!nr_full) {
+		if (pthread_cond_timedwait(&not_empty, &lock, &ts) == ETIMEDOUT)
+			break;
+	}
+
+	if (nr_full) {
+		buffer = &ring[head];
+		*count = buffer->count;
+		if (nr_full > opd_stats[OPD_READ_QUEUE_MAX])
+			opd_stats[OPD_READ_QUEUE_MAX] = nr_full;
+	}
+	opd_stats[OPD_READ_BLOCKED] = blocked_usec;
+	pthread_mutex_unlock(&lock);
+
+	return buffer ? buffer->buf : NULL;
+}
+
+
+void opd_reader_put(void)
+{
+	pthread_mutex_lock(&lock);
+	head = (head + 1) % nr_ring;
+	--nr_full;
+	pthread_cond_signal(&not_full);
+	pthread_mutex_unlock(&lock);
+}
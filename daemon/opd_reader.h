@@ -0,0 +1,34 @@
+/**
+ * @file daemon/opd_reader.h
+ * Reading the kernel buffer from a separate thread
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_READER_H
+#define OPD_READER_H
+
+#include "op_types.h"
+
+#include <sys/types.h>
+
+/**
+ * Start a thread reading the device devfd in a ring of nr_buffer buffers
+ * of size bytes. The thread reads the next buffer while the previous ones
+ * are processed, it blocks only when all buffers are waiting to be
+ * processed.
+ */
+void opd_reader_start(fd_t devfd, size_t nr_buffer, size_t size);
+
+/**
+ * Return the oldest buffer read and its size in bytes in count, or NULL if
+ * no buffer was read in the next msec milli-seconds. The buffer must be
+ * given back with opd_reader_put() once processed.
+ */
+char const * opd_reader_get(ssize_t * count, unsigned int msec);
+
+/** give back the buffer returned by opd_reader_get() */
+void opd_reader_put(void);
+
+#endif /* OPD_READER_H */
@@ -0,0 +1,296 @@
+/**
+ * @file daemon/opd_replay.c
+ * Replay a capture recorded by oprofiled --record
+ *
+ * usage: opd_replay --session-dir=dir [--workers=num] [--max-open-files=num]
+ *                   [--max-mapped=mbytes] [--stats] capture_file
+ *
+ * The buffers of the capture are processed as the daemon does, with the
+ * dcookie and /proc lookups answered from the capture, and the sample
+ * files are written in dir. This allows to measure the daemon processing
+ * speed without a kernel module.
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "oprofiled.h"
+#include "opd_capture.h"
+#include "opd_decode.h"
+#include "opd_events.h"
+#include "opd_extended.h"
+#include "opd_kernel.h"
+#include "opd_sfile.h"
+#include "opd_size_hint.h"
+#include "opd_anon.h"
+#include "opd_stats.h"
+#include "opd_trans.h"
+
+#include "op_config.h"
+#include "op_cpu_type.h"
+#include "op_libiberty.h"
+#include "op_popt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* the daemon globals, oprofiled.c and init.c are not linked in */
+uint op_nr_counters;
+op_cpu cpu_type;
+int no_event_ok;
+int vsfile;
+int vsamples;
+int varcs;
+int vmodule;
+int vmisc;
+int vext;
+int separate_lib;
+int separate_kernel;
+int separate_thread;
+int separate_cpu;
+int no_vmlinux;
+char * vmlinux;
+char * kernel_range;
+int no_xen;
+char * xenimage;
+char * xen_range;
+int nr_workers;
+int nr_read_buffers;
+int prefetch_cookies;
+int sync_budget;
+int max_open_files;
+int max_mapped;
+size_t kernel_pointer_size;
+
+static char * session_dir;
+static int show_stats;
+
+static struct poptOption options[] = {
+	{ "session-dir", 0, POPT_ARG_STRING, &session_dir, 0, "place sample database in dir", "dir", },
+	{ "workers", 0, POPT_ARG_INT, &nr_workers, 0, "nr of threads writing sample files", "num" },
+	{ "max-open-files", 0, POPT_ARG_INT, &max_open_files, 0, "nr of sample files kept open, 0 for the fd limit", "num" },
+	{ "max-mapped", 0, POPT_ARG_INT, &max_mapped, 0, "mbytes of sample files kept mapped, 0 for no limit", "mbytes" },
+	{ "stats", 0, POPT_ARG_NONE, &show_stats, 0, "print the daemon statistics", NULL, },
+	POPT_AUTOHELP
+	{ NULL, 0, 0, NULL, 0, NULL, NULL, },
+};
+
+
+/* the image filter is not recorded, all images are profiled */
+int is_image_ignored(char const * name __attribute__((unused)))
+{
+	return 0;
+}
+
+
+/* there is no oprofilefs to read */
+int opd_read_fs_int(char const * path __attribute__((unused)),
+                    char const * name __attribute__((unused)),
+                    int is_fatal __attribute__((unused)))
+{
+	return -1;
+}
+
+
+static char * string_option(char const * name)
+{
+	char const * value = opd_capture_get_option(name);
+	return value ? xstrdup(value) : NULL;
+}
+
+
+static long int_option(char const * name)
+{
+	char const * value = opd_capture_get_option(name);
+
+	if (!value) {
+		fprintf(stderr, "option %s missing in the capture\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	return strtol(value, NULL, 10);
+}
+
+
+/** set up the daemon state as oprofiled did when recording */
+static void replay_init(void)
+{
+	char * events;
+
+	cpu_type = int_option("cpu-type");
+	op_nr_counters = op_get_nr_counters(cpu_type);
+	kernel_pointer_size = int_option("pointer-size");
+	separate_lib = int_option("separate-lib");
+	separate_kernel = int_option("separate-kernel");
+	separate_thread = int_option("separate-thread");
+	separate_cpu = int_option("separate-cpu");
+	no_vmlinux = int_option("no-vmlinux");
+	vmlinux = string_option("vmlinux");
+	kernel_range = string_option("kernel-range");
+	no_xen = int_option("no-xen");
+	xenimage = string_option("xen-image");
+	xen_range = string_option("xen-range");
+
+	if (kernel_pointer_size != 4 && kernel_pointer_size != 8) {
+		fprintf(stderr, "bad pointer size in the capture\n");
+		exit(EXIT_FAILURE);
+	}
+
+	events = string_option("events");
+	if (events)
+		opd_parse_events(events);
+	opd_ext_initialize(NULL);
+
+	opd_create_vmlinux(vmlinux, kernel_range);
+	opd_create_xen(xenimage, xen_range);
+	opd_reread_module_info();
+
+	cookie_init();
+	sfile_init();
+	size_hint_init();
+	anon_init();
+
+	/* the replay can be watched with opstats as the daemon */
+	opd_stats_open();
+}
+
+
+/** nr of samples in a buffer, opd_stats[OPD_SAMPLES] counts sfile lookups */
+static size_t count_samples(char const * buffer, size_t count)
+{
+	static struct opd_record records[OPD_DECODE_BATCH];
+	size_t nr_sample = 0;
+	size_t nr_record;
+	size_t nr_word;
+	size_t i;
+
+	while (count) {
+		nr_word = opd_decode_buffer(records, &nr_record, buffer, count,
+		                            kernel_pointer_size);
+		for (i = 0; i < nr_record; ++i) {
+			if (records[i].code == OPD_RECORD_SAMPLE)
+				++nr_sample;
+		}
+
+		/* skip an entry the decoder doesn't know, approximately */
+		if (!nr_word)
+			nr_word = count < 2 ? count : 2;
+		buffer += nr_word * kernel_pointer_size;
+		count -= nr_word;
+	}
+
+	return nr_sample;
+}
+
+
+static unsigned long long now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+
+static int compare_latency(void const * lhs, void const * rhs)
+{
+	unsigned long l = *(unsigned long const *)lhs;
+	unsigned long r = *(unsigned long const *)rhs;
+
+	if (l != r)
+		return l < r ? -1 : 1;
+	return 0;
+}
+
+
+static unsigned long percentile(unsigned long const * latency, size_t nr,
+                                unsigned int percent)
+{
+	size_t index = (nr * percent) / 100;
+	return latency[index < nr ? index : nr - 1];
+}
+
+
+int main(int argc, char const * argv[])
+{
+	poptContext optcon;
+	char const * capture;
+	char const * buffer;
+	size_t size;
+	unsigned long * latency = NULL;
+	size_t nr_buffer = 0;
+	size_t max_buffer = 0;
+	unsigned long long nr_bytes = 0;
+	unsigned long long nr_sample = 0;
+	unsigned long long total = 0;
+	unsigned long long start;
+
+	optcon = op_poptGetContext(NULL, argc, argv, options, 0);
+	capture = poptGetArg(optcon);
+	if (!capture || !session_dir) {
+		poptPrintHelp(optcon, stderr, 0);
+		exit(EXIT_FAILURE);
+	}
+
+	init_op_config_dirs(session_dir);
+
+	opd_capture_replay(capture);
+	buffer = opd_capture_next_buffer(&size);
+	replay_init();
+
+	while (buffer) {
+		unsigned long usec;
+
+		start = now_usec();
+		opd_stats[OPD_DUMP_COUNT]++;
+		opd_process_samples(buffer, size / kernel_pointer_size);
+		sfile_flush_samples();
+		sfile_lru_evict();
+		usec = now_usec() - start;
+		opd_stats_buffer_done(usec);
+
+		if (nr_buffer == max_buffer) {
+			max_buffer = max_buffer ? max_buffer * 2 : 1024;
+			latency = xrealloc(latency,
+			                   max_buffer * sizeof(unsigned long));
+		}
+		latency[nr_buffer++] = usec;
+		total += usec;
+		nr_bytes += size;
+		nr_sample += count_samples(buffer, size / kernel_pointer_size);
+
+		buffer = opd_capture_next_buffer(&size);
+	}
+
+	start = now_usec();
+	sfile_close_files();
+	total += now_usec() - start;
+
+	if (!total)
+		total = 1;
+
+	printf("%lu buffers, %llu bytes, %llu samples in %llu usec\n",
+	       (unsigned long)nr_buffer, nr_bytes, nr_sample, total);
+	printf("%.0f samples/sec, %.1f MB/sec, %lu sample file lookups\n",
+	       nr_sample * 1000000.0 / total, nr_bytes / (double)total,
+	       opd_stats[OPD_SAMPLES]);
+
+	if (nr_buffer) {
+		qsort(latency, nr_buffer, sizeof(unsigned long),
+		      compare_latency);
+		printf("buffer latency (usec): p50 %lu p90 %lu p99 %lu "
+		       "max %lu\n", percentile(latency, nr_buffer, 50),
+		       percentile(latency, nr_buffer, 90),
+		       percentile(latency, nr_buffer, 99),
+		       latency[nr_buffer - 1]);
+	}
+
+	if (show_stats)
+		opd_print_stats();
+
+	free(latency);
+	poptFreeContext(optcon);
+
+	return EXIT_SUCCESS;
+}
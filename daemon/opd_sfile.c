@@ -18,63 +18,158 @@
 #include "opd_printf.h"
 #include "opd_stats.h"
 #include "opd_extended.h"
+#include "opd_workers.h"
 #include "oprofiled.h"
 
 #include "op_libiberty.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 
-#define HASH_SIZE 2048
-#define HASH_BITS (HASH_SIZE - 1)
+/** initial nr of slots of the sfile table, must be a power of two */
+#define SFILE_TABLE_MIN 1024
 
-/** All sfiles are hashed into these lists */
-static struct list_head hashes[HASH_SIZE];
+/**
+ * All sfiles are in an open addressed table, linearly probed from their
+ * hash value. The table doubles when half full so the probes stay short,
+ * and removal shifts back the following entries so no tombstone is left.
+ */
+struct sfile_slot {
+	/** hash value of sf, compared before touching sf */
+	unsigned long hashval;
+	/** NULL if the slot is free */
+	struct sfile * sf;
+};
+
+static struct sfile_slot * sfile_table;
+static size_t sfile_table_size;
+static size_t nr_sfile;
+
+/** cpus above are not cached, trans->cpu is -1 before a cpu switch */
+#define LAST_HIT_MAX_CPU 4096
+
+/** the last sfile found for each cpu, indexed by cpu number */
+static struct sfile ** last_hit;
+static size_t nr_last_hit;
 
 /** All sfiles are on this list. */
 static LIST_HEAD(lru_list);
 
+/* write combining buffer size, WC_HASH_SIZE must be a power of two and
+ * WC_NR_ENTRY fit in a slot[] entry */
+#define WC_HASH_SIZE 256
+#define WC_NR_ENTRY 128
+
+/**
+ * Tight loops produce the same pc many times in a buffer, samples for a
+ * sample file are coalesced here then written in pc order when the
+ * buffer is full or flushed.
+ */
+struct sample_wc {
+	/** link in a wc_dirty_lists[] entry if nr_entry != 0 */
+	struct list_head dirty;
+	/** the sample file this buffer is for */
+	odb_t * file;
+	/** nr used entry */
+	unsigned int nr_entry;
+	/** open addressed index of entry, zero if empty else index + 1 */
+	unsigned char slot[WC_HASH_SIZE];
+	struct wc_entry {
+		odb_key_t key;
+		unsigned long count;
+	} entry[WC_NR_ENTRY];
+};
+
+/**
+ * write combining buffers holding samples, one list per worker thread
+ * since each of them fills the buffers of its own sample files
+ */
+static struct list_head wc_dirty_lists[OPD_MAX_WORKERS];
+
+/** initial nr of slots of a sfile cg_table, must be a power of two */
+#define CG_TABLE_MIN 8
+
+/* arc write combining cache size, must be a power of two */
+#define ARC_WC_SIZE 4096
+
+/**
+ * Backtraces repeat the same arcs, they are coalesced in a direct mapped
+ * cache shared by all cg files before being written. An entry is written
+ * when another arc maps to its slot, the whole cache when samples are
+ * flushed and before any sfile is synced, closed or freed. Arcs are
+ * logged by the main thread only.
+ */
+static struct arc_wc_entry {
+	/** NULL if the entry is free */
+	odb_t * file;
+	odb_key_t key;
+	unsigned long count;
+} arc_wc[ARC_WC_SIZE];
+
+/** nr of used arc_wc entries */
+static unsigned int nr_arc_wc;
 
-/* FIXME: can undoubtedly improve this hashing */
-/** Hash the transient parameters for lookup. */
+/** mix value into hash, a step of the murmur3 64 bits finalizer */
+static unsigned long long
+hash_mix(unsigned long long hash, unsigned long long value)
+{
+	hash ^= value;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+
+/**
+ * The worker thread owning an opened sample file. Several sfiles can
+ * mangle to the same sample filename, e.g. two deleted binaries with the
+ * same name, and odb_open() gives them the same odb_data_t, so the owner
+ * is chosen from the odb_data_t, not from the sfile.
+ */
+static unsigned int file_shard(odb_t const * file)
+{
+	if (!nr_workers)
+		return 0;
+	return hash_mix(0, (unsigned long)file->data) % nr_workers;
+}
+
+
+/**
+ * Hash the transient parameters for lookup. Exactly the fields compared
+ * by do_match() are hashed, so all bits of the result are usable.
+ */
 static unsigned long
 sfile_hash(struct transient const * trans, struct kernel_image * ki)
 {
-	unsigned long val = 0;
-	
+	unsigned long long hash = 0x9e3779b97f4a7c15ULL;
+
 	if (separate_thread) {
-		val ^= trans->tid << 2;
-		val ^= trans->tgid << 2;
+		hash = hash_mix(hash, (unsigned long long)trans->tid);
+		hash = hash_mix(hash, (unsigned long long)trans->tgid);
 	}
 
-	if (separate_kernel || ((trans->anon || separate_lib) && !ki))
-		val ^= trans->app_cookie >> (DCOOKIE_SHIFT + 3);
-
 	if (separate_cpu)
-		val ^= trans->cpu;
+		hash = hash_mix(hash, trans->cpu);
 
-	/* cookie meaningless for kernel, shouldn't hash */
-	if (trans->in_kernel) {
-		val ^= ki->start >> 14;
-		val ^= ki->end >> 7;
-		return val & HASH_BITS;
-	}
+	if (separate_kernel || ((trans->anon || separate_lib) && !ki))
+		hash = hash_mix(hash, trans->app_cookie);
 
-	if (trans->cookie != NO_COOKIE) {
-		val ^= trans->cookie >> DCOOKIE_SHIFT;
-		return val & HASH_BITS;
+	/* cookie meaningless for kernel, shouldn't hash */
+	if (ki) {
+		hash = hash_mix(hash, (unsigned long)ki);
+	} else {
+		hash = hash_mix(hash, (unsigned long)trans->anon);
+		hash = hash_mix(hash, trans->cookie);
 	}
 
-	if (!separate_thread)
-		val ^= trans->tgid << 2;
-
-	if (trans->anon) {
-		val ^= trans->anon->start >> VMA_SHIFT;
-		val ^= trans->anon->end >> (VMA_SHIFT + 1);
-	}
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
 
-	return val & HASH_BITS;
+	return (unsigned long)hash;
 }
 
 
@@ -180,17 +275,23 @@ create_sfile(unsigned long hash, struct transient const * trans,
 	sf->cpu = 0;
 	sf->kernel = ki;
 	sf->anon = trans->anon;
+	sf->sync_pass = 0;
+	sf->hits = 0;
+	sf->mangled_dir = NULL;
 
-	for (i = 0 ; i < op_nr_counters ; ++i)
+	for (i = 0 ; i < op_nr_counters ; ++i) {
 		odb_init(&sf->files[i]);
+		sf->wc[i] = NULL;
+	}
 
 	if (trans->ext)
 		opd_ext_sfile_create(sf);
 	else
 		sf->ext_files = NULL;
 
-	for (i = 0; i < CG_HASH_SIZE; ++i)
-		list_init(&sf->cg_hash[i]);
+	sf->cg_table = NULL;
+	sf->cg_size = 0;
+	sf->nr_cg = 0;
 
 	if (separate_thread)
 		sf->tid = trans->tid;
@@ -217,16 +318,132 @@ create_sfile(unsigned long hash, struct transient const * trans,
 }
 
 
+static struct sfile *
+table_find(unsigned long hash, struct transient const * trans,
+           struct kernel_image const * ki)
+{
+	size_t mask = sfile_table_size - 1;
+	size_t index = hash & mask;
+	unsigned long probes = 1;
+
+	while (sfile_table[index].sf) {
+		if (sfile_table[index].hashval == hash &&
+		    trans_match(trans, sfile_table[index].sf, ki))
+			break;
+		index = (index + 1) & mask;
+		++probes;
+	}
+
+	opd_stats[OPD_SFILE_LOOKUP]++;
+	opd_stats[OPD_SFILE_PROBE] += probes;
+	if (probes > opd_stats[OPD_SFILE_PROBE_MAX])
+		opd_stats[OPD_SFILE_PROBE_MAX] = probes;
+
+	return sfile_table[index].sf;
+}
+
+
+static void table_add(struct sfile * sf)
+{
+	size_t mask = sfile_table_size - 1;
+	size_t index = sf->hashval & mask;
+
+	while (sfile_table[index].sf)
+		index = (index + 1) & mask;
+
+	sfile_table[index].hashval = sf->hashval;
+	sfile_table[index].sf = sf;
+}
+
+
+static void table_grow(void)
+{
+	struct sfile_slot * old_table = sfile_table;
+	size_t old_size = sfile_table_size;
+	size_t i;
+
+	sfile_table_size *= 2;
+	sfile_table = xcalloc(sfile_table_size, sizeof(struct sfile_slot));
+
+	for (i = 0; i < old_size; ++i) {
+		if (old_table[i].sf)
+			table_add(old_table[i].sf);
+	}
+
+	free(old_table);
+}
+
+
+static void table_insert(struct sfile * sf)
+{
+	if ((nr_sfile + 1) * 2 > sfile_table_size)
+		table_grow();
+
+	table_add(sf);
+	++nr_sfile;
+}
+
+
+static void table_remove(struct sfile * sf)
+{
+	size_t mask = sfile_table_size - 1;
+	size_t index = sf->hashval & mask;
+	size_t next;
+	size_t home;
+	size_t i;
+
+	while (sfile_table[index].sf != sf)
+		index = (index + 1) & mask;
+
+	/* move back into the hole the entries probed through it */
+	next = index;
+	while (1) {
+		next = (next + 1) & mask;
+		if (!sfile_table[next].sf)
+			break;
+		home = sfile_table[next].hashval & mask;
+		if (((next - home) & mask) >= ((next - index) & mask)) {
+			sfile_table[index] = sfile_table[next];
+			index = next;
+		}
+	}
+
+	sfile_table[index].sf = NULL;
+	--nr_sfile;
+
+	for (i = 0; i < nr_last_hit; ++i) {
+		if (last_hit[i] == sf)
+			last_hit[i] = NULL;
+	}
+}
+
+
+static void set_last_hit(unsigned long cpu, struct sfile * sf)
+{
+	if (cpu >= LAST_HIT_MAX_CPU)
+		return;
+
+	if (cpu >= nr_last_hit) {
+		last_hit = xrealloc(last_hit, (cpu + 1) * sizeof(struct sfile *));
+		memset(last_hit + nr_last_hit, '\0',
+		       (cpu + 1 - nr_last_hit) * sizeof(struct sfile *));
+		nr_last_hit = cpu + 1;
+	}
+
+	last_hit[cpu] = sf;
+}
+
+
 struct sfile * sfile_find(struct transient const * trans)
 {
 	struct sfile * sf;
-	struct list_head * pos;
 	struct kernel_image * ki = NULL;
 	unsigned long hash;
 
 	if (trans->tracing != TRACING_ON) {
 		opd_stats[OPD_SAMPLES]++;
 		opd_stats[trans->in_kernel == 1 ? OPD_KERNEL : OPD_PROCESS]++;
+		opd_stats_cpu_sample(trans->cpu);
 	}
 
 	/* There is a small race where this *can* happen, see
@@ -241,6 +458,19 @@ struct sfile * sfile_find(struct transient const * trans)
 
 	/* we might need a kernel image start/end to hash on */
 	if (trans->in_kernel) {
+		/* consecutive kernel samples of a cpu mostly fall in the
+		 * same image: try the image of the last sfile of the cpu
+		 * before searching the kernel images */
+		sf = trans->cpu < nr_last_hit ? last_hit[trans->cpu] : NULL;
+		if (sf && sf->kernel && is_kernel_image(sf->kernel, trans) &&
+		    trans_match(trans, sf, sf->kernel)) {
+			opd_stats[OPD_SFILE_KERNEL_HIT]++;
+			opd_stats[OPD_SFILE_LAST_HIT]++;
+			opd_stats[OPD_SFILE_HIT]++;
+			sfile_get(sf);
+			goto lru;
+		}
+
 		ki = find_kernel_image(trans);
 		if (!ki) {
 			verbprintf(vsamples, "Lost kernel sample %llx\n", trans->pc);
@@ -257,19 +487,32 @@ struct sfile * sfile_find(struct transient const * trans)
 		return NULL;
 	}
 
-	hash = sfile_hash(trans, ki);
-	list_for_each(pos, &hashes[hash]) {
-		sf = list_entry(pos, struct sfile, hash);
-		if (trans_match(trans, sf, ki)) {
+	/* the context switches back and forth between a few sfiles */
+	if (trans->cpu < nr_last_hit) {
+		sf = last_hit[trans->cpu];
+		if (sf && trans_match(trans, sf, ki)) {
+			opd_stats[OPD_SFILE_LAST_HIT]++;
+			opd_stats[OPD_SFILE_HIT]++;
 			sfile_get(sf);
 			goto lru;
 		}
 	}
 
-	sf = create_sfile(hash, trans, ki);
-	list_add(&sf->hash, &hashes[hash]);
+	hash = sfile_hash(trans, ki);
+	sf = table_find(hash, trans, ki);
+	if (sf) {
+		opd_stats[OPD_SFILE_HIT]++;
+		sfile_get(sf);
+	} else {
+		sf = create_sfile(hash, trans, ki);
+		table_insert(sf);
+	}
+
+	set_last_hit(trans->cpu, sf);
 
 lru:
+	if (sf->hits != UINT_MAX)
+		++sf->hits;
 	sfile_put(sf);
 	return sf;
 }
@@ -281,26 +524,85 @@ void sfile_dup(struct sfile * to, struct sfile * from)
 
 	memcpy(to, from, sizeof (struct sfile));
 
-	for (i = 0 ; i < op_nr_counters ; ++i)
+	for (i = 0 ; i < op_nr_counters ; ++i) {
 		odb_init(&to->files[i]);
+		to->wc[i] = NULL;
+	}
 
 	opd_ext_sfile_dup(to, from);
 
-	for (i = 0; i < CG_HASH_SIZE; ++i)
-		list_init(&to->cg_hash[i]);
+	to->cg_table = NULL;
+	to->cg_size = 0;
+	to->nr_cg = 0;
+	to->mangled_dir = NULL;
 
-	list_init(&to->hash);
 	list_init(&to->lru);
 }
 
 
+static void cg_insert(struct sfile * sf, struct cg_entry * cg)
+{
+	unsigned int index = cg->to.hashval & (sf->cg_size - 1);
+
+	while (sf->cg_table[index])
+		index = (index + 1) & (sf->cg_size - 1);
+	sf->cg_table[index] = cg;
+}
+
+
+/** rebuild the cg_table of sf with size slots, dropping the NULL ones */
+static void cg_rehash(struct sfile * sf, unsigned int size)
+{
+	struct cg_entry ** old_table = sf->cg_table;
+	unsigned int old_size = sf->cg_size;
+	unsigned int i;
+
+	sf->cg_table = xcalloc(size, sizeof(struct cg_entry *));
+	sf->cg_size = size;
+
+	for (i = 0; i < old_size; ++i) {
+		if (old_table[i])
+			cg_insert(sf, old_table[i]);
+	}
+
+	free(old_table);
+}
+
+
+struct cg_entry * sfile_get_cg(struct sfile * sf, struct sfile * last)
+{
+	struct cg_entry * cg;
+	unsigned int index;
+
+	/* the callee hash value is a hash of exactly the fields compared
+	 * by sfile_equal(), mismatching callees are skipped cheaply */
+	if (sf->cg_table) {
+		index = last->hashval & (sf->cg_size - 1);
+		while ((cg = sf->cg_table[index]) != NULL) {
+			if (cg->to.hashval == last->hashval &&
+			    sfile_equal(last, &cg->to))
+				return cg;
+			index = (index + 1) & (sf->cg_size - 1);
+		}
+	}
+
+	/* keep the table at most half full */
+	if ((sf->nr_cg + 1) * 2 > sf->cg_size)
+		cg_rehash(sf, sf->cg_size ? sf->cg_size * 2 : CG_TABLE_MIN);
+
+	cg = xmalloc(sizeof(struct cg_entry));
+	sfile_dup(&cg->to, last);
+	cg_insert(sf, cg);
+	++sf->nr_cg;
+
+	return cg;
+}
+
+
 static odb_t * get_file(struct transient const * trans, int is_cg)
 {
 	struct sfile * sf = trans->current;
 	struct sfile * last = trans->last;
-	struct cg_entry * cg;
-	struct list_head * pos;
-	unsigned long hash;
 	odb_t * file;
 
 	if ((trans->ext) != NULL)
@@ -314,28 +616,9 @@ static odb_t * get_file(struct transient const * trans, int is_cg)
 
 	file = &sf->files[trans->event];
 
-	if (!is_cg)
-		goto open;
-
-	hash = last->hashval & (CG_HASH_SIZE - 1);
+	if (is_cg)
+		file = &sfile_get_cg(sf, last)->to.files[trans->event];
 
-	/* Need to look for the right 'to'. Since we're looking for
-	 * 'last', we use its hash.
-	 */
-	list_for_each(pos, &sf->cg_hash[hash]) {
-		cg = list_entry(pos, struct cg_entry, hash);
-		if (sfile_equal(last, &cg->to)) {
-			file = &cg->to.files[trans->event];
-			goto open;
-		}
-	}
-
-	cg = xmalloc(sizeof(struct cg_entry));
-	sfile_dup(&cg->to, last);
-	list_add(&cg->hash, &sf->cg_hash[hash]);
-	file = &cg->to.files[trans->event];
-
-open:
 	if (!odb_open_count(file))
 		opd_open_sample_file(file, last, sf, trans->event, is_cg);
 
@@ -383,6 +666,60 @@ verbose_arc(struct transient const * trans, vma_t from, vma_t to)
 }
 
 
+static void write_arc(struct arc_wc_entry * entry)
+{
+	int err;
+
+	err = odb_update_node_with_offset(entry->file, entry->key,
+					  entry->count);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", __FUNCTION__, strerror(err));
+		abort();
+	}
+}
+
+
+/** write all the arcs of the arc cache */
+static void flush_arc_wc(void)
+{
+	size_t i;
+
+	for (i = 0; nr_arc_wc && i < ARC_WC_SIZE; ++i) {
+		if (arc_wc[i].file) {
+			write_arc(&arc_wc[i]);
+			arc_wc[i].file = NULL;
+			--nr_arc_wc;
+		}
+	}
+}
+
+
+static void log_arc_wc(odb_t * file, odb_key_t key)
+{
+	unsigned long long hash = key ^ (unsigned long)file;
+	struct arc_wc_entry * entry;
+
+	/* high bits of a fibonacci hash, as wc_hash() */
+	hash = (hash * 0x9e3779b97f4a7c15ULL) >> 40;
+	entry = &arc_wc[hash & (ARC_WC_SIZE - 1)];
+
+	if (entry->file == file && entry->key == key) {
+		++entry->count;
+		opd_stats[OPD_ARC_WC_HIT]++;
+		return;
+	}
+
+	if (entry->file)
+		write_arc(entry);
+	else
+		++nr_arc_wc;
+
+	entry->file = file;
+	entry->key = key;
+	entry->count = 1;
+}
+
+
 static void sfile_log_arc(struct transient const * trans)
 {
 	int err;
@@ -418,6 +755,12 @@ static void sfile_log_arc(struct transient const * trans)
 	key = to & (0xffffffff);
 	key |= ((uint64_t)from) << 32;
 
+	/* extended sample files are not buffered */
+	if (!trans->ext) {
+		log_arc_wc(file, key);
+		return;
+	}
+
 	err = odb_update_node(file, key);
 	if (err) {
 		fprintf(stderr, "%s: %s\n", __FUNCTION__, strerror(err));
@@ -432,6 +775,102 @@ void sfile_log_sample(struct transient const * trans)
 }
 
 
+static int wc_entry_compare(void const * lhs, void const * rhs)
+{
+	struct wc_entry const * l = lhs;
+	struct wc_entry const * r = rhs;
+
+	if (l->key != r->key)
+		return l->key < r->key ? -1 : 1;
+	return 0;
+}
+
+
+static void flush_wc(struct sample_wc * wc)
+{
+	unsigned int i;
+	int err;
+
+	if (!wc->nr_entry)
+		return;
+
+	qsort(wc->entry, wc->nr_entry, sizeof(struct wc_entry),
+	      wc_entry_compare);
+
+	for (i = 0; i < wc->nr_entry; ++i) {
+		err = odb_update_node_with_offset(wc->file, wc->entry[i].key,
+						  wc->entry[i].count);
+		if (err) {
+			fprintf(stderr, "%s: %s\n", __FUNCTION__,
+			        strerror(err));
+			abort();
+		}
+	}
+
+	wc->nr_entry = 0;
+	memset(wc->slot, '\0', sizeof(wc->slot));
+	list_del(&wc->dirty);
+}
+
+
+static unsigned int wc_hash(odb_key_t key)
+{
+	/* high bits of a fibonacci hash, consecutive pcs are spread */
+	return (unsigned int)((key * 0x9e3779b97f4a7c15ULL) >> 56) &
+		(WC_HASH_SIZE - 1);
+}
+
+
+static void
+log_sample_wc(struct sfile * sf, unsigned long event, odb_t * file,
+              odb_key_t key, unsigned long int count)
+{
+	struct sample_wc * wc = sf->wc[event];
+	struct wc_entry * entry;
+	unsigned int index;
+
+	if (!wc) {
+		wc = xmalloc(sizeof(struct sample_wc));
+		memset(wc->slot, '\0', sizeof(wc->slot));
+		wc->nr_entry = 0;
+		list_init(&wc->dirty);
+		wc->file = file;
+		sf->wc[event] = wc;
+	}
+
+	index = wc_hash(key);
+	while (wc->slot[index]) {
+		entry = &wc->entry[wc->slot[index] - 1];
+		if (entry->key == key) {
+			entry->count += count;
+			return;
+		}
+		index = (index + 1) & (WC_HASH_SIZE - 1);
+	}
+
+	if (wc->nr_entry == WC_NR_ENTRY) {
+		flush_wc(wc);
+		index = wc_hash(key);
+	}
+
+	if (!wc->nr_entry)
+		list_add(&wc->dirty, &wc_dirty_lists[file_shard(wc->file)]);
+
+	entry = &wc->entry[wc->nr_entry++];
+	entry->key = key;
+	entry->count = count;
+	wc->slot[index] = wc->nr_entry;
+}
+
+
+/** called by the worker threads */
+static void log_sample_work(struct opd_sample_work const * work)
+{
+	log_sample_wc(work->sf, work->event, work->file, work->key,
+	              work->count);
+}
+
+
 void sfile_log_sample_count(struct transient const * trans,
                             unsigned long int count)
 {
@@ -464,6 +903,25 @@ void sfile_log_sample_count(struct transient const * trans,
 		return;
 	}
 
+	/* extended sample files are not buffered */
+	if (!trans->ext && nr_workers) {
+		struct opd_sample_work work = {
+			.sf = trans->current,
+			.file = file,
+			.key = (odb_key_t)pc,
+			.count = count,
+			.event = trans->event
+		};
+		opd_workers_queue(file_shard(file), &work);
+		return;
+	}
+
+	if (!trans->ext) {
+		log_sample_wc(trans->current, trans->event, file,
+		              (odb_key_t)pc, count);
+		return;
+	}
+
 	err = odb_update_node_with_offset(file,
 					  (odb_key_t)pc,
 					  count);
@@ -479,8 +937,14 @@ static int close_sfile(struct sfile * sf, void * data __attribute__((unused)))
 	size_t i;
 
 	/* it's OK to close a non-open odb file */
-	for (i = 0; i < op_nr_counters; ++i)
-		odb_close(&sf->files[i]);
+	for (i = 0; i < op_nr_counters; ++i) {
+		if (sf->wc[i]) {
+			flush_wc(sf->wc[i]);
+			free(sf->wc[i]);
+			sf->wc[i] = NULL;
+		}
+		opd_close_sample_file(&sf->files[i]);
+	}
 
 	opd_ext_sfile_close(sf);
 
@@ -491,27 +955,51 @@ static int close_sfile(struct sfile * sf, void * data __attribute__((unused)))
 static void kill_sfile(struct sfile * sf)
 {
 	close_sfile(sf, NULL);
-	list_del(&sf->hash);
 	list_del(&sf->lru);
+	free(sf->mangled_dir);
 }
 
 
-static int sync_sfile(struct sfile * sf, void * data __attribute__((unused)))
+/** sync the sample files of sf, return the nr of bytes synced */
+static size_t sync_sfile(struct sfile * sf)
 {
+	size_t synced = 0;
 	size_t i;
 
-	for (i = 0; i < op_nr_counters; ++i)
-		odb_sync(&sf->files[i]);
+	for (i = 0; i < op_nr_counters; ++i) {
+		if (sf->wc[i])
+			flush_wc(sf->wc[i]);
+		/* most files are clean, they cost no msync */
+		if (odb_is_dirty(&sf->files[i])) {
+			synced += odb_sync(&sf->files[i]);
+			opd_stats[OPD_SYNC_FILES]++;
+		}
+	}
 
 	opd_ext_sfile_sync(sf);
 
-	return 0;
+	return synced;
 }
 
 
-static int is_sfile_kernel(struct sfile * sf, void * data __attribute__((unused)))
+/** sync sf and its cg files, return the nr of bytes synced */
+static size_t sync_sfile_cg(struct sfile * sf)
 {
-	return !!sf->kernel;
+	size_t synced = sync_sfile(sf);
+	unsigned int i;
+
+	for (i = 0; i < sf->cg_size; ++i) {
+		if (sf->cg_table[i])
+			synced += sync_sfile(&sf->cg_table[i]->to);
+	}
+
+	return synced;
+}
+
+
+static int is_sfile_kernel(struct sfile * sf, void * data)
+{
+	return sf->kernel == data;
 }
 
 
@@ -526,26 +1014,28 @@ typedef int (*sfile_func)(struct sfile *, void *);
 static void
 for_one_sfile(struct sfile * sf, sfile_func func, void * data)
 {
-	size_t i;
+	unsigned int nr_cg = sf->nr_cg;
+	unsigned int i;
 	int free_sf = func(sf, data);
 
-	for (i = 0; i < CG_HASH_SIZE; ++i) {
-		struct list_head * pos;
-		struct list_head * pos2;
-		list_for_each_safe(pos, pos2, &sf->cg_hash[i]) {
-			struct cg_entry * cg =
-				list_entry(pos, struct cg_entry, hash);
-			if (free_sf || func(&cg->to, data)) {
-				kill_sfile(&cg->to);
-				list_del(&cg->hash);
-				free(cg);
-			}
+	for (i = 0; i < sf->cg_size; ++i) {
+		struct cg_entry * cg = sf->cg_table[i];
+		if (cg && (free_sf || func(&cg->to, data))) {
+			kill_sfile(&cg->to);
+			free(cg);
+			sf->cg_table[i] = NULL;
+			--sf->nr_cg;
 		}
 	}
 
 	if (free_sf) {
 		kill_sfile(sf);
+		table_remove(sf);
+		free(sf->cg_table);
 		free(sf);
+	} else if (sf->nr_cg != nr_cg) {
+		/* the probe sequences are broken by the removed entries */
+		cg_rehash(sf, sf->cg_size);
 	}
 }
 
@@ -555,6 +1045,9 @@ static void for_each_sfile(sfile_func func, void * data)
 	struct list_head * pos;
 	struct list_head * pos2;
 
+	opd_workers_wait();
+	flush_arc_wc();
+
 	list_for_each_safe(pos, pos2, &lru_list) {
 		struct sfile * sf = list_entry(pos, struct sfile, lru);
 		for_one_sfile(sf, func, data);
@@ -562,9 +1055,9 @@ static void for_each_sfile(sfile_func func, void * data)
 }
 
 
-void sfile_clear_kernel(void)
+void sfile_clear_kernel(struct kernel_image * image)
 {
-	for_each_sfile(is_sfile_kernel, NULL);
+	for_each_sfile(is_sfile_kernel, image);
 }
 
 
@@ -574,9 +1067,70 @@ void sfile_clear_anon(struct anon_mapping * anon)
 }
 
 
-void sfile_sync_files(void)
+void sfile_flush_samples(void)
+{
+	struct list_head * pos;
+	struct list_head * pos2;
+	size_t i;
+
+	opd_workers_wait();
+	flush_arc_wc();
+
+	for (i = 0; i < OPD_MAX_WORKERS; ++i) {
+		list_for_each_safe(pos, pos2, &wc_dirty_lists[i])
+			flush_wc(list_entry(pos, struct sample_wc, dirty));
+	}
+}
+
+
+static unsigned long long now_usec(void)
 {
-	for_each_sfile(sync_sfile, NULL);
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+
+/** current pass, sfiles not yet synced in this pass have an older pass */
+static unsigned int sync_pass = 1;
+
+int sfile_sync_files(void)
+{
+	unsigned long long start = now_usec();
+	unsigned long budget = sync_budget * 1024UL;
+	unsigned long synced = 0;
+	struct list_head * pos;
+	unsigned long usec;
+	int left = 0;
+
+	opd_workers_wait();
+	flush_arc_wc();
+
+	list_for_each(pos, &lru_list) {
+		struct sfile * sf = list_entry(pos, struct sfile, lru);
+
+		if (sf->sync_pass == sync_pass)
+			continue;
+		if (budget && synced >= budget) {
+			left = 1;
+			break;
+		}
+
+		synced += sync_sfile_cg(sf);
+		sf->sync_pass = sync_pass;
+	}
+
+	/* the next pass syncs all sfiles again */
+	if (!left)
+		++sync_pass;
+
+	usec = now_usec() - start;
+	opd_stats[OPD_SYNC_BYTES] += synced;
+	opd_stats[OPD_SYNC_USEC] += usec;
+	if (usec > opd_stats[OPD_SYNC_MAX_USEC])
+		opd_stats[OPD_SYNC_MAX_USEC] = usec;
+
+	return left;
 }
 
 
@@ -586,7 +1140,8 @@ void sfile_close_files(void)
 }
 
 
-static int always_true(void)
+static int always_true(struct sfile * sf __attribute__((unused)),
+                       void * data __attribute__((unused)))
 {
 	return 1;
 }
@@ -608,18 +1163,129 @@ int sfile_lru_clear(void)
 	if (list_empty(&lru_list))
 		return 1;
 
+	opd_workers_wait();
+	flush_arc_wc();
+
 	list_for_each_safe(pos, pos2, &lru_list) {
 		struct sfile * sf;
 		if (!--amount)
 			break;
 		sf = list_entry(pos, struct sfile, lru);
-		for_one_sfile(sf, (sfile_func)always_true, NULL);
+		for_one_sfile(sf, always_true, NULL);
+		opd_stats[OPD_SFILE_EVICT]++;
 	}
 
 	return 0;
 }
 
 
+/** nr of least recently used sfiles among which sfile_lru_evict() picks */
+#define EVICT_SCAN 1024
+/** fds kept for the daemon own use when the budget comes from the rlimit */
+#define RESERVED_FDS 64
+
+/** budgets of sfile_lru_evict(), zero for no limit */
+static unsigned long max_files;
+static size_t max_mapped_bytes;
+
+struct evict_candidate {
+	struct sfile * sf;
+	unsigned int hits;
+	/** rank in the lru list, oldest first */
+	unsigned int age;
+};
+
+
+static int evict_compare(void const * lhs, void const * rhs)
+{
+	struct evict_candidate const * l = lhs;
+	struct evict_candidate const * r = rhs;
+
+	if (l->hits != r->hits)
+		return l->hits < r->hits ? -1 : 1;
+	if (l->age != r->age)
+		return l->age < r->age ? -1 : 1;
+	return 0;
+}
+
+
+/**
+ * usage above the high watermark (7/8 of a budget) starts an eviction,
+ * which goes on until usage is below the low watermark (3/4)
+ */
+static int over_budget(int high)
+{
+	struct odb_usage usage;
+	unsigned int num = high ? 7 : 6;
+
+	odb_get_usage(&usage);
+
+	if (max_files && usage.nr_file > max_files / 8 * num)
+		return 1;
+	if (max_mapped_bytes && usage.mapped > max_mapped_bytes / 8 * num)
+		return 1;
+	return 0;
+}
+
+
+void sfile_lru_evict(void)
+{
+	static struct evict_candidate candidates[EVICT_SCAN];
+	struct list_head * pos;
+	unsigned int nr;
+	unsigned int i;
+
+	if (!over_budget(1))
+		return;
+
+	opd_workers_wait();
+	flush_arc_wc();
+
+	/* the least used of the oldest sfiles go first, the others see
+	 * their count halved so it reflects recent use */
+	do {
+		nr = 0;
+		list_for_each(pos, &lru_list) {
+			struct sfile * sf = list_entry(pos, struct sfile, lru);
+			candidates[nr].sf = sf;
+			candidates[nr].hits = sf->hits;
+			candidates[nr].age = nr;
+			sf->hits /= 2;
+			if (++nr == EVICT_SCAN)
+				break;
+		}
+
+		qsort(candidates, nr, sizeof(struct evict_candidate),
+		      evict_compare);
+
+		for (i = 0; i < nr && over_budget(0); ++i) {
+			for_one_sfile(candidates[i].sf, always_true, NULL);
+			opd_stats[OPD_SFILE_EVICT]++;
+		}
+	} while (i && over_budget(0));
+}
+
+
+/** set the budgets of sfile_lru_evict() from the options */
+static void init_budgets(void)
+{
+	struct rlimit limit;
+
+	max_mapped_bytes = (size_t)max_mapped * 1024 * 1024;
+
+	if (max_open_files > 0) {
+		max_files = max_open_files;
+		return;
+	}
+
+	/* by default, evict before odb_open() fails with EMFILE */
+	if (!getrlimit(RLIMIT_NOFILE, &limit) &&
+	    limit.rlim_cur != RLIM_INFINITY &&
+	    limit.rlim_cur > 2 * RESERVED_FDS)
+		max_files = limit.rlim_cur - RESERVED_FDS;
+}
+
+
 void sfile_get(struct sfile * sf)
 {
 	if (sf)
@@ -636,8 +1302,19 @@ void sfile_put(struct sfile * sf)
 
 void sfile_init(void)
 {
-	size_t i = 0;
+	size_t i;
+
+	sfile_table_size = SFILE_TABLE_MIN;
+	sfile_table = xcalloc(sfile_table_size, sizeof(struct sfile_slot));
+
+	for (i = 0; i < OPD_MAX_WORKERS; ++i)
+		list_init(&wc_dirty_lists[i]);
+
+	init_budgets();
+
+	/* rehashing a big sample file at once can stall us long enough
+	 * to overflow the kernel buffer */
+	odb_set_grow_mode(ODB_GROW_INCREMENTAL);
 
-	for (; i < HASH_SIZE; ++i)
-		list_init(&hashes[i]);
+	opd_workers_start(log_sample_work);
 }
@@ -23,8 +23,8 @@
 
 struct kernel_image;
 struct transient;
+struct sample_wc;
 
-#define CG_HASH_SIZE 16
 #define UNUSED_EMBEDDED_OFFSET ~0LLU
 
 /**
@@ -32,7 +32,8 @@ struct transient;
  * types) will have one of these for it. We match against the
  * descriptions here to find which sample DB file we need to modify.
  *
- * cg files are stored in the hash.
+ * cg files are stored in cg_table, an open addressed table indexed by
+ * the hash value of the callee sfile.
  */
 struct sfile {
 	/** hash value for this sfile */
@@ -53,39 +54,57 @@ struct sfile {
 	struct anon_mapping * anon;
 	/** embedded offset for Cell BE SPU */
 	uint64_t embedded_offset;
+	/** image directory of the sample files, built when first opened */
+	char * mangled_dir;
 
-	/** hash table link */
-	struct list_head hash;
 	/** lru list */
 	struct list_head lru;
+	/** last sync pass of sfile_sync_files() which synced this sfile */
+	unsigned int sync_pass;
+	/** nr of lookups finding this sfile, halved at each eviction scan */
+	unsigned int hits;
 	/** true if this file should be ignored in profiles */
 	int ignored;
 	/** opened sample files */
 	odb_t files[OP_MAX_COUNTERS];
+	/** samples not yet written to files[], allocated on first use */
+	struct sample_wc * wc[OP_MAX_COUNTERS];
 	/** extended sample files */
 	odb_t * ext_files;
-	/** hash table of opened cg sample files */
-	struct list_head cg_hash[CG_HASH_SIZE];
+	/** table of cg_entry, NULL until the first arc from this sfile */
+	struct cg_entry ** cg_table;
+	/** nr of slots of cg_table, a power of two */
+	unsigned int cg_size;
+	/** nr of cg_entry in cg_table */
+	unsigned int nr_cg;
 };
 
 /** a call-graph entry */
 struct cg_entry {
 	/** where arc is to */
 	struct sfile to;
-	/** next in the hash slot */
-	struct list_head hash;
 };
 
-/** clear any sfiles that are for the kernel */
-void sfile_clear_kernel(void);
+/** find or create the call-graph entry of sf for arcs to the sfile last */
+struct cg_entry * sfile_get_cg(struct sfile * sf, struct sfile * last);
+
+/** clear any sfiles for the given kernel image */
+void sfile_clear_kernel(struct kernel_image * image);
 
 struct anon_mapping;
 
 /** clear any sfiles for the given anon mapping */
 void sfile_clear_anon(struct anon_mapping *);
 
-/** sync sample files */
-void sfile_sync_files(void);
+/** write all buffered samples to their sample files */
+void sfile_flush_samples(void);
+
+/**
+ * sync the sample files written since their previous sync, msyncing at
+ * most sync_budget kbytes (no limit if zero). Return non zero if files
+ * are left to sync, the next call goes on where this one stopped.
+ */
+int sfile_sync_files(void);
 
 /** close sample files */
 void sfile_close_files(void);
@@ -94,6 +113,13 @@ void sfile_close_files(void);
  * return non-zero if the lru is already empty */
 int sfile_lru_clear(void);
 
+/**
+ * If the sample files opened are near the --max-open-files or --max-mapped
+ * budgets, evict the least used sfiles among the least recently used ones
+ * until enough files are closed. Called between two buffers.
+ */
+void sfile_lru_evict(void);
+
 /** remove a sfile from the lru list, protecting it from sfile_lru_clear() */
 void sfile_get(struct sfile * sf);
 
@@ -0,0 +1,174 @@
+/**
+ * @file daemon/opd_size_hint.c
+ * Expected size of sample files, remembered across sessions
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_size_hint.h"
+#include "opd_printf.h"
+#include "oprofiled.h"
+
+#include "op_config.h"
+#include "op_list.h"
+#include "op_string.h"
+#include "op_libiberty.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * The sample file sizes are stored one per line in op_size_hint_file as
+ * "nr_node age filename", age being the number of sessions since the size
+ * was recorded. A hint is kept across sessions which don't use its file
+ * but dropped after SIZE_HINT_MAX_AGE of them, so the file doesn't grow
+ * forever with files belonging to dead processes.
+ */
+
+/* smaller sample files are not worth a hint, they never grow */
+#define SIZE_HINT_MIN 256
+#define SIZE_HINT_MAX_AGE 8
+#define HASH_SIZE 2048
+
+struct size_hint {
+	struct list_head next;
+	char * filename;
+	odb_node_nr_t nr_node;
+	/** nr of sessions since the size was recorded, 0 for this one */
+	unsigned int age;
+};
+
+static struct list_head hashes[HASH_SIZE];
+
+
+static struct size_hint * find_hint(char const * filename, size_t hash)
+{
+	struct list_head * pos;
+
+	list_for_each(pos, &hashes[hash]) {
+		struct size_hint * hint = list_entry(pos, struct size_hint, next);
+		if (!strcmp(hint->filename, filename))
+			return hint;
+	}
+
+	return NULL;
+}
+
+
+static struct size_hint * get_hint(char const * filename)
+{
+	size_t hash = op_hash_string(filename) % HASH_SIZE;
+	struct size_hint * hint = find_hint(filename, hash);
+
+	if (!hint) {
+		hint = xmalloc(sizeof(struct size_hint));
+		hint->filename = xstrdup(filename);
+		hint->nr_node = 0;
+		hint->age = 0;
+		list_add(&hint->next, &hashes[hash]);
+	}
+
+	return hint;
+}
+
+
+void size_hint_init(void)
+{
+	char line[PATH_MAX + 32];
+	FILE * fp;
+	size_t i;
+
+	for (i = 0; i < HASH_SIZE; ++i)
+		list_init(&hashes[i]);
+
+	fp = fopen(op_size_hint_file, "r");
+	if (!fp)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		struct size_hint * hint;
+		unsigned int nr_node;
+		unsigned int age;
+		int pos;
+		size_t len = strlen(line);
+
+		if (!len || line[len - 1] != '\n')
+			continue;
+		line[len - 1] = '\0';
+
+		if (sscanf(line, "%u %u %n", &nr_node, &age, &pos) != 2 ||
+		    !line[pos])
+			continue;
+
+		hint = get_hint(line + pos);
+		hint->nr_node = nr_node;
+		/* this session is one more for the hint */
+		hint->age = age + 1;
+	}
+
+	fclose(fp);
+}
+
+
+odb_node_nr_t size_hint_find(char const * filename)
+{
+	size_t hash = op_hash_string(filename) % HASH_SIZE;
+	struct size_hint * hint = find_hint(filename, hash);
+
+	return hint ? hint->nr_node : 0;
+}
+
+
+void size_hint_record(char const * filename, odb_node_nr_t nr_node)
+{
+	struct size_hint * hint;
+
+	/* a new line can't be stored in op_size_hint_file */
+	if (nr_node < SIZE_HINT_MIN || strchr(filename, '\n'))
+		return;
+
+	hint = get_hint(filename);
+	hint->nr_node = nr_node;
+	hint->age = 0;
+}
+
+
+void size_hint_save(void)
+{
+	char * tmp_name;
+	FILE * fp;
+	size_t i;
+
+	tmp_name = xmalloc(strlen(op_size_hint_file) + 5);
+	strcpy(tmp_name, op_size_hint_file);
+	strcat(tmp_name, ".tmp");
+
+	fp = fopen(tmp_name, "w");
+	if (!fp) {
+		verbprintf(vmisc, "can't write %s: %s\n",
+			   tmp_name, strerror(errno));
+		goto out;
+	}
+
+	for (i = 0; i < HASH_SIZE; ++i) {
+		struct list_head * pos;
+		list_for_each(pos, &hashes[i]) {
+			struct size_hint * hint =
+				list_entry(pos, struct size_hint, next);
+			if (hint->age < SIZE_HINT_MAX_AGE)
+				fprintf(fp, "%u %u %s\n", hint->nr_node,
+					hint->age, hint->filename);
+		}
+	}
+
+	/* rename() makes the update atomic for the next session */
+	if (fclose(fp) || rename(tmp_name, op_size_hint_file))
+		unlink(tmp_name);
+out:
+	free(tmp_name);
+}
@@ -0,0 +1,32 @@
+/**
+ * @file daemon/opd_size_hint.h
+ * Expected size of sample files, remembered across sessions
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_SIZE_HINT_H
+#define OPD_SIZE_HINT_H
+
+#include "odb.h"
+
+/** load the sample file sizes saved by the previous session */
+void size_hint_init(void);
+
+/**
+ * return the nr of key the sample file had at the end of the previous
+ * session or when it was last closed, zero if unknown
+ */
+odb_node_nr_t size_hint_find(char const * filename);
+
+/** remember the nr of key of a sample file, called when it is closed */
+void size_hint_record(char const * filename, odb_node_nr_t nr_node);
+
+/**
+ * write to the session directory the sizes recorded by this session and
+ * the ones of the previous sessions which are not too old
+ */
+void size_hint_save(void);
+
+#endif /* OPD_SIZE_HINT_H */
@@ -11,16 +11,100 @@
 
 #include "opd_stats.h"
 #include "opd_extended.h"
+#include "opd_workers.h"
 #include "oprofiled.h"
 
+#include "op_config.h"
 #include "op_get_time.h"
+#include "op_stats_page.h"
+#include "odb.h"
 
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 
 unsigned long opd_stats[OPD_MAX_STATS];
 
+/** names of the opd_stats[] counters in the stats page, in enum order */
+static char const * const stat_names[OPD_MAX_STATS] = {
+	"samples",
+	"kernel_samples",
+	"process_samples",
+	"lost_no_ctx",
+	"lost_kernel",
+	"lost_samplefile",
+	"lost_no_mapping",
+	"buffers",
+	"dangling_code",
+	"read_queue_max",
+	"read_blocked_usec",
+	"sfile_last_hit",
+	"sfile_lookup",
+	"sfile_probe",
+	"sfile_probe_max",
+	"anon_lookup",
+	"anon_miss",
+	"anon_reload",
+	"anon_negative",
+	"sync_files",
+	"sync_bytes",
+	"sync_usec",
+	"sync_max_usec",
+	"arc_wc_hit",
+	"sfile_hit",
+	"sfile_evict",
+	"sfile_reopen",
+	"cookie_resolve",
+	"cookie_usec",
+	"anon_reload_usec",
+	"sfile_kernel_hit",
+};
+
+enum {	ODB_GROW = OPD_MAX_STATS,
+	ODB_GROW_USEC,
+	ODB_FILES,
+	ODB_MAPPED,
+	KERNEL_STATS
+};
+
+/** the oprofilefs counters, the per cpu ones are summed over all cpus */
+static char const * const kernel_stats[] = {
+	"event_lost_overflow",
+	"sample_lost_no_mapping",
+	"bt_lost_no_mapping",
+	"sample_lost_no_mm",
+};
+
+static char const * const kernel_cpu_stats[] = {
+	"sample_lost_overflow",
+	"sample_lost_task_exit",
+	"sample_received",
+	"backtrace_aborted",
+	"sample_invalid_eip",
+};
+
+#define NR_KERNEL_STATS (sizeof(kernel_stats) / sizeof(kernel_stats[0]))
+#define NR_KERNEL_CPU_STATS \
+	(sizeof(kernel_cpu_stats) / sizeof(kernel_cpu_stats[0]))
+#define NR_COUNTERS (KERNEL_STATS + NR_KERNEL_STATS + NR_KERNEL_CPU_STATS)
+
+/** oprofilefs is read at most once per period, in usec */
+#define KERNEL_STATS_PERIOD 10000000ULL
+
+static struct op_stats_page * page;
+static unsigned long cpu_samples[OP_STATS_MAX_CPUS];
+static unsigned int nr_cpu;
+static unsigned long latency[OP_STATS_NR_BUCKETS];
+static unsigned long kernel_values[NR_KERNEL_STATS + NR_KERNEL_CPU_STATS];
+static unsigned long long kernel_time;
+
 /**
  * print_if - print an integer value read from file filename,
  * do nothing if the value read == -1 except if force is non-zero
@@ -33,13 +117,52 @@ static void print_if(char const * fmt, char const * path, char const * filename,
 }
 
 /**
- * opd_print_stats - print out latest statistics
+ * for_each_cpu_stats - call func with the number and the oprofilefs
+ * statistics directory of each cpu
  */
-void opd_print_stats(void)
+static void for_each_cpu_stats(void (*func)(int cpu_nr, char const * path))
 {
 	DIR * dir;
 	struct dirent * dirent;
 
+	if (!(dir = opendir("/dev/oprofile/stats/")))
+		return;
+	while ((dirent = readdir(dir))) {
+		int cpu_nr;
+		char path[PATH_MAX];
+		if (sscanf(dirent->d_name, "cpu%d", &cpu_nr) != 1)
+			continue;
+		snprintf(path, PATH_MAX, "/dev/oprofile/stats/%s",
+			 dirent->d_name);
+		func(cpu_nr, path);
+	}
+	closedir(dir);
+}
+
+
+static void print_cpu_stats(int cpu_nr, char const * path)
+{
+	printf("\n---- Statistics for cpu : %d\n", cpu_nr);
+	print_if("Nr. samples lost cpu buffer overflow: %u\n",
+	     path, "sample_lost_overflow", 1);
+	print_if("Nr. samples lost task exit: %u\n",
+	     path, "sample_lost_task_exit", 0);
+	print_if("Nr. samples received: %u\n",
+	     path, "sample_received", 1);
+	print_if("Nr. backtrace aborted: %u\n", 
+	     path, "backtrace_aborted", 0);
+	print_if("Nr. samples lost invalid pc: %u\n", 
+	     path, "sample_invalid_eip", 0);
+}
+
+
+/**
+ * opd_print_stats - print out latest statistics
+ */
+void opd_print_stats(void)
+{
+	struct odb_grow_stat grow_stat;
+
 	printf("\n%s\n", op_get_time());
 	printf("\n-- OProfile Statistics --\n");
 	printf("Nr. sample dumps: %lu\n", opd_stats[OPD_DUMP_COUNT]);
@@ -52,6 +175,55 @@ void opd_print_stats(void)
 		opd_stats[OPD_LOST_SAMPLEFILE]);
 	printf("Nr. samples lost due to no permanent mapping: %lu\n",
 		opd_stats[OPD_LOST_NO_MAPPING]);
+	printf("Nr. sample file lookups from the per cpu cache: %lu\n",
+		opd_stats[OPD_SFILE_LAST_HIT]);
+	printf("Nr. kernel samples in the image of the per cpu cache: %lu\n",
+		opd_stats[OPD_SFILE_KERNEL_HIT]);
+	printf("Nr. sample file table lookups: %lu\n",
+		opd_stats[OPD_SFILE_LOOKUP]);
+	printf("Nr. sample file lookups finding an open sfile: %lu\n",
+		opd_stats[OPD_SFILE_HIT]);
+	printf("Nr. sfiles evicted: %lu\n", opd_stats[OPD_SFILE_EVICT]);
+	printf("Nr. sample files reopened: %lu\n",
+		opd_stats[OPD_SFILE_REOPEN]);
+	printf("Nr. dcookies resolved: %lu\n", opd_stats[OPD_COOKIE_RESOLVE]);
+	printf("Time spent resolving dcookies (usec): %lu\n",
+		opd_stats[OPD_COOKIE_USEC]);
+	if (opd_stats[OPD_SFILE_LOOKUP]) {
+		printf("Average sample file table probe length: %.2f\n",
+			(double)opd_stats[OPD_SFILE_PROBE] /
+			opd_stats[OPD_SFILE_LOOKUP]);
+	}
+	printf("Max sample file table probe length: %lu\n",
+		opd_stats[OPD_SFILE_PROBE_MAX]);
+	printf("Nr. anon mapping lookups: %lu\n", opd_stats[OPD_ANON_LOOKUP]);
+	printf("Nr. anon mapping lookup misses: %lu\n",
+		opd_stats[OPD_ANON_MISS]);
+	printf("Nr. anon mapping maps read: %lu\n", opd_stats[OPD_ANON_RELOAD]);
+	printf("Nr. anon mapping misses not reading maps: %lu\n",
+		opd_stats[OPD_ANON_NEGATIVE]);
+	printf("Time spent reading anon maps (usec): %lu\n",
+		opd_stats[OPD_ANON_RELOAD_USEC]);
+	printf("Nr. arcs coalesced before writing: %lu\n",
+		opd_stats[OPD_ARC_WC_HIT]);
+	printf("Nr. sample files synced: %lu\n", opd_stats[OPD_SYNC_FILES]);
+	printf("Nr. sample file bytes synced: %lu\n",
+		opd_stats[OPD_SYNC_BYTES]);
+	printf("Time spent syncing sample files (usec): %lu\n",
+		opd_stats[OPD_SYNC_USEC]);
+	printf("Longest sample files sync (usec): %lu\n",
+		opd_stats[OPD_SYNC_MAX_USEC]);
+	odb_get_grow_stat(&grow_stat);
+	printf("Nr. sample file grow: %lu\n", grow_stat.nr_grow);
+	printf("Time spent growing sample files (usec): %lu\n",
+		grow_stat.usec);
+	opd_workers_print_stats();
+	if (nr_read_buffers > 1) {
+		printf("Max nr. of buffers waiting processing: %lu\n",
+			opd_stats[OPD_READ_QUEUE_MAX]);
+		printf("Time spent waiting for a free buffer (usec): %lu\n",
+			opd_stats[OPD_READ_BLOCKED]);
+	}
 	print_if("Nr. event lost due to buffer overflow: %u\n",
 	       "/dev/oprofile/stats", "event_lost_overflow", 1);
 	print_if("Nr. samples lost due to no mapping: %u\n",
@@ -63,28 +235,175 @@ void opd_print_stats(void)
 
 	opd_ext_print_stats();
 
-	if (!(dir = opendir("/dev/oprofile/stats/")))
-		goto out;
-	while ((dirent = readdir(dir))) {
-		int cpu_nr;
-		char path[256];
-		if (sscanf(dirent->d_name, "cpu%d", &cpu_nr) != 1)
-			continue;
-		snprintf(path, 256, "/dev/oprofile/stats/%s", dirent->d_name);
-
-		printf("\n---- Statistics for cpu : %d\n", cpu_nr);
-		print_if("Nr. samples lost cpu buffer overflow: %u\n",
-		     path, "sample_lost_overflow", 1);
-		print_if("Nr. samples lost task exit: %u\n",
-		     path, "sample_lost_task_exit", 0);
-		print_if("Nr. samples received: %u\n",
-		     path, "sample_received", 1);
-		print_if("Nr. backtrace aborted: %u\n", 
-		     path, "backtrace_aborted", 0);
-		print_if("Nr. samples lost invalid pc: %u\n", 
-		     path, "sample_invalid_eip", 0);
-	}
-	closedir(dir);
-out:
+	for_each_cpu_stats(print_cpu_stats);
+
 	fflush(stdout);
 }
+
+
+unsigned long long opd_now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+
+void opd_stats_open(void)
+{
+	size_t i;
+	int fd;
+
+	if (NR_COUNTERS > OP_STATS_MAX_COUNTERS) {
+		fprintf(stderr, "oprofiled: too many statistics for %s\n",
+			op_stats_file);
+		return;
+	}
+
+	/* a new inode, readers may still map the file of a previous run */
+	unlink(op_stats_file);
+	fd = open(op_stats_file, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd == -1 || ftruncate(fd, sizeof(struct op_stats_page))) {
+		fprintf(stderr, "oprofiled: couldn't create %s: %s\n",
+			op_stats_file, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+
+	page = mmap(NULL, sizeof(struct op_stats_page),
+		    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		fprintf(stderr, "oprofiled: couldn't map %s: %s\n",
+			op_stats_file, strerror(errno));
+		page = NULL;
+		return;
+	}
+
+	/* the file is new and zeroed, only the names are set once */
+	for (i = 0; i < OPD_MAX_STATS; ++i)
+		strcpy(page->counter[i].name, stat_names[i]);
+	page->counter[OPD_READ_QUEUE_MAX].type = OP_STATS_GAUGE;
+	page->counter[OPD_SFILE_PROBE_MAX].type = OP_STATS_GAUGE;
+	page->counter[OPD_SYNC_MAX_USEC].type = OP_STATS_GAUGE;
+	strcpy(page->counter[ODB_GROW].name, "odb_grow");
+	strcpy(page->counter[ODB_GROW_USEC].name, "odb_grow_usec");
+	strcpy(page->counter[ODB_FILES].name, "odb_files");
+	strcpy(page->counter[ODB_MAPPED].name, "odb_mapped_bytes");
+	page->counter[ODB_FILES].type = OP_STATS_GAUGE;
+	page->counter[ODB_MAPPED].type = OP_STATS_GAUGE;
+	for (i = 0; i < NR_KERNEL_STATS; ++i)
+		snprintf(page->counter[KERNEL_STATS + i].name,
+			 OP_STATS_NAME_LEN, "kernel_%s", kernel_stats[i]);
+	for (i = 0; i < NR_KERNEL_CPU_STATS; ++i)
+		snprintf(page->counter[KERNEL_STATS + NR_KERNEL_STATS + i].name,
+			 OP_STATS_NAME_LEN, "kernel_%s", kernel_cpu_stats[i]);
+
+	page->nr_counter = NR_COUNTERS;
+	page->pid = getpid();
+	page->version = OP_STATS_PAGE_VERSION;
+	page->magic = OP_STATS_PAGE_MAGIC;
+}
+
+
+void opd_stats_cpu_sample(unsigned long cpu)
+{
+	if (cpu >= OP_STATS_MAX_CPUS)
+		return;
+	cpu_samples[cpu]++;
+	if (cpu >= nr_cpu)
+		nr_cpu = cpu + 1;
+}
+
+
+/** an oprofilefs value, 0 if it doesn't exist */
+static unsigned long read_kernel_stat(char const * path, char const * name)
+{
+	int value = opd_read_fs_int(path, name, 0);
+	return value == -1 ? 0 : value;
+}
+
+
+/** add the oprofilefs values of a cpu to kernel_values */
+static void add_cpu_stats(int cpu_nr __attribute__((unused)),
+			  char const * path)
+{
+	unsigned long * cpu_values = kernel_values + NR_KERNEL_STATS;
+	size_t i;
+
+	for (i = 0; i < NR_KERNEL_CPU_STATS; ++i)
+		cpu_values[i] += read_kernel_stat(path, kernel_cpu_stats[i]);
+}
+
+
+/** read oprofilefs in kernel_values, outside of the page update */
+static void read_kernel_stats(void)
+{
+	size_t i;
+
+	for (i = 0; i < NR_KERNEL_STATS; ++i)
+		kernel_values[i] = read_kernel_stat("/dev/oprofile/stats",
+						    kernel_stats[i]);
+
+	for (i = 0; i < NR_KERNEL_CPU_STATS; ++i)
+		kernel_values[NR_KERNEL_STATS + i] = 0;
+	for_each_cpu_stats(add_cpu_stats);
+}
+
+
+static unsigned int latency_bucket(unsigned long usec)
+{
+	unsigned int bucket = 0;
+
+	while (usec && bucket < OP_STATS_NR_BUCKETS - 1) {
+		usec >>= 1;
+		++bucket;
+	}
+
+	return bucket;
+}
+
+
+void opd_stats_buffer_done(unsigned long usec)
+{
+	struct odb_grow_stat grow_stat;
+	struct odb_usage usage;
+	unsigned long long now;
+	size_t i;
+
+	latency[latency_bucket(usec)]++;
+
+	if (!page)
+		return;
+
+	now = opd_now_usec();
+	if (now - kernel_time >= KERNEL_STATS_PERIOD) {
+		read_kernel_stats();
+		kernel_time = now;
+	}
+	odb_get_grow_stat(&grow_stat);
+	odb_get_usage(&usage);
+
+	/* readers retry while seq is odd or changed under them */
+	page->seq++;
+	__sync_synchronize();
+
+	page->time = now;
+	for (i = 0; i < OPD_MAX_STATS; ++i)
+		page->counter[i].value = opd_stats[i];
+	page->counter[ODB_GROW].value = grow_stat.nr_grow;
+	page->counter[ODB_GROW_USEC].value = grow_stat.usec;
+	page->counter[ODB_FILES].value = usage.nr_file;
+	page->counter[ODB_MAPPED].value = usage.mapped;
+	for (i = 0; i < NR_KERNEL_STATS + NR_KERNEL_CPU_STATS; ++i)
+		page->counter[KERNEL_STATS + i].value = kernel_values[i];
+	for (i = 0; i < OP_STATS_NR_BUCKETS; ++i)
+		page->latency[i] = latency[i];
+	for (i = 0; i < nr_cpu; ++i)
+		page->cpu_samples[i] = cpu_samples[i];
+	page->nr_cpu = nr_cpu;
+
+	__sync_synchronize();
+	page->seq++;
+}
@@ -23,9 +23,49 @@ enum {	OPD_SAMPLES, /**< nr. samples */
 	OPD_LOST_NO_MAPPING, /**< nr samples lost due to no mapping */
 	OPD_DUMP_COUNT, /**< nr. of times buffer is read */
 	OPD_DANGLING_CODE, /**< nr. partial code notifications (buffer overflow */
+	OPD_READ_QUEUE_MAX, /**< max nr. of buffers read and not yet processed */
+	OPD_READ_BLOCKED, /**< usec the reader thread waited for a free buffer */
+	OPD_SFILE_LAST_HIT, /**< nr. sfile lookups hitting the per cpu cache */
+	OPD_SFILE_LOOKUP, /**< nr. sfile table lookups */
+	OPD_SFILE_PROBE, /**< nr. sfile table slots probed */
+	OPD_SFILE_PROBE_MAX, /**< longest sfile table probe */
+	OPD_ANON_LOOKUP, /**< nr. anon mapping lookups */
+	OPD_ANON_MISS, /**< nr. anon mapping lookups missing */
+	OPD_ANON_RELOAD, /**< nr. /proc/pid/maps read */
+	OPD_ANON_NEGATIVE, /**< nr. anon misses not reading the maps again */
+	OPD_SYNC_FILES, /**< nr. sample files msynced */
+	OPD_SYNC_BYTES, /**< nr. bytes msynced */
+	OPD_SYNC_USEC, /**< usec spent syncing sample files */
+	OPD_SYNC_MAX_USEC, /**< longest sfile_sync_files() in usec */
+	OPD_ARC_WC_HIT, /**< nr. arcs coalesced in the arc cache */
+	OPD_SFILE_HIT, /**< nr. sfile lookups finding an existing sfile */
+	OPD_SFILE_EVICT, /**< nr. sfiles evicted */
+	OPD_SFILE_REOPEN, /**< nr. sample files opened with samples already */
+	OPD_COOKIE_RESOLVE, /**< nr. dcookies resolved, from both threads */
+	OPD_COOKIE_USEC, /**< usec spent resolving dcookies */
+	OPD_ANON_RELOAD_USEC, /**< usec spent reading /proc/pid/maps */
+	OPD_SFILE_KERNEL_HIT, /**< nr. kernel samples in the image of the per cpu cache */
 	OPD_MAX_STATS /**< end of stats */
 };
 
 void opd_print_stats(void);
 
+/**
+ * Create op_stats_file and publish the statistics in it from now on, see
+ * op_stats_page.h. Failure is not fatal, the statistics are only printed.
+ */
+void opd_stats_open(void);
+
+/** count a sample received from cpu */
+void opd_stats_cpu_sample(unsigned long cpu);
+
+/**
+ * Account a buffer processed in usec and publish the statistics, called
+ * by the main thread after each buffer.
+ */
+void opd_stats_buffer_done(unsigned long usec);
+
+/** current time in usec, for the time spent counters */
+unsigned long long opd_now_usec(void);
+
 #endif /* OPD_STATS_H */
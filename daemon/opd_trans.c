@@ -17,6 +17,7 @@
  */
 
 #include "opd_trans.h"
+#include "opd_decode.h"
 #include "opd_kernel.h"
 #include "opd_sfile.h"
 #include "opd_anon.h"
@@ -82,23 +83,16 @@ int enough_remaining(struct transient * trans, size_t size)
 }
 
 
-static void opd_put_sample(struct transient * trans, unsigned long long pc)
+static void put_sample(struct transient * trans, unsigned long long pc,
+                       unsigned long long event)
 {
-	unsigned long long event;
-
-	if (!enough_remaining(trans, 1)) {
-		trans->remaining = 0;
-		return;
-	}
-
-	event = pop_buffer_value(trans);
-
 	if (trans->tracing != TRACING_ON)
 		trans->event = event;
 
 	trans->pc = pc;
 
-	/* sfile can change at each sample for kernel */
+	/* sfile can change at each sample for kernel, sfile_find() tries
+	 * the image of the last sfile of this cpu first */
 	if (trans->in_kernel != 0)
 		clear_trans_current(trans);
 
@@ -132,6 +126,17 @@ out:
 }
 
 
+static void opd_put_sample(struct transient * trans, unsigned long long pc)
+{
+	if (!enough_remaining(trans, 1)) {
+		trans->remaining = 0;
+		return;
+	}
+
+	put_sample(trans, pc, pop_buffer_value(trans));
+}
+
+
 static void code_unknown(struct transient * trans __attribute__((unused)))
 {
 	fprintf(stderr, "Unknown code !\n");
@@ -287,6 +292,70 @@ handler_t handlers[LAST_CODE + 1] = {
 
 extern void (*special_processor)(struct transient *);
 
+/** records decoded by opd_decode_buffer() */
+static struct opd_record records[OPD_DECODE_BATCH];
+
+/** process one entry of the buffer, a sample or an escape code */
+static void process_entry(struct transient * trans)
+{
+	/* FIXME: was uint64_t but it can't compile on alpha where uint64_t
+	 * is an unsigned long and below the printf("..." %llu\n", code)
+	 * generate a warning, this look like a stopper to use c98 types :/
+	 */
+	unsigned long long code;
+
+	code = pop_buffer_value(trans);
+
+	if (!is_escape_code(code)) {
+		opd_put_sample(trans, code);
+		return;
+	}
+
+	if (!trans->remaining) {
+		verbprintf(vmisc, "Dangling ESCAPE_CODE.\n");
+		opd_stats[OPD_DANGLING_CODE]++;
+		return;
+	}
+
+	// started with ESCAPE_CODE, next is type
+	code = pop_buffer_value(trans);
+
+	if (code >= LAST_CODE) {
+		fprintf(stderr, "Unknown code %llu\n", code);
+		abort();
+	}
+
+	handlers[code](trans);
+}
+
+
+/**
+ * process a decoded entry, escape code arguments are read by the handlers
+ * from the buffer the record was decoded from
+ */
+static void process_record(struct transient * trans,
+                           struct opd_record const * record,
+                           char const * buffer)
+{
+	char const * next;
+	size_t remaining;
+
+	if (record->code == OPD_RECORD_SAMPLE) {
+		put_sample(trans, record->value, record->arg);
+		return;
+	}
+
+	next = trans->buffer;
+	remaining = trans->remaining;
+
+	trans->buffer = buffer + record->arg * kernel_pointer_size;
+	trans->remaining = opd_code_nr_args[record->code];
+	handlers[record->code](trans);
+
+	trans->buffer = next;
+	trans->remaining = remaining;
+}
+
 void opd_process_samples(char const * buffer, size_t count)
 {
 	struct transient trans = {
@@ -310,39 +379,27 @@ void opd_process_samples(char const * buffer, size_t count)
 		.ext = NULL
 	};
 
-	/* FIXME: was uint64_t but it can't compile on alpha where uint64_t
-	 * is an unsigned long and below the printf("..." %llu\n", code)
-	 * generate a warning, this look like a stopper to use c98 types :/
-	 */
-	unsigned long long code;
-
 	if (special_processor) {
 		special_processor(&trans);
 		return;
 	}
 
 	while (trans.remaining) {
-		code = pop_buffer_value(&trans);
-
-		if (!is_escape_code(code)) {
-			opd_put_sample(&trans, code);
-			continue;
-		}
-
-		if (!trans.remaining) {
-			verbprintf(vmisc, "Dangling ESCAPE_CODE.\n");
-			opd_stats[OPD_DANGLING_CODE]++;
-			break;
-		}
-
-		// started with ESCAPE_CODE, next is type
-		code = pop_buffer_value(&trans);
-	
-		if (code >= LAST_CODE) {
-			fprintf(stderr, "Unknown code %llu\n", code);
-			abort();
-		}
-
-		handlers[code](&trans);
+		char const * buffer = trans.buffer;
+		size_t remaining = trans.remaining;
+		size_t nr_record;
+		size_t nr_word;
+		size_t i;
+
+		nr_word = opd_decode_buffer(records, &nr_record, buffer,
+					    remaining, kernel_pointer_size);
+		trans.buffer += nr_word * kernel_pointer_size;
+		trans.remaining -= nr_word;
+		for (i = 0; i < nr_record; ++i)
+			process_record(&trans, &records[i], buffer);
+
+		/* the decoder stopped on an entry it can't handle */
+		if (nr_word == 0)
+			process_entry(&trans);
 	}
 }
@@ -0,0 +1,232 @@
+/**
+ * @file daemon/opd_workers.c
+ * Threads writing samples to the sample files
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include "opd_workers.h"
+#include "oprofiled.h"
+
+#include "op_libiberty.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * The decoding thread fills a batch of works per worker thread and hands
+ * it over when full, so the lock is taken once per batch, not per sample.
+ * A worker can have at most MAX_QUEUED_BATCH batches queued, after that
+ * the decoding thread waits for it rather than buffering without limit.
+ */
+#define WORK_BATCH 512
+#define MAX_QUEUED_BATCH 16
+
+struct work_batch {
+	struct work_batch * next;
+	size_t nr_work;
+	struct opd_sample_work work[WORK_BATCH];
+};
+
+struct worker {
+	pthread_t thread;
+	/** protect all fields below except pending */
+	pthread_mutex_t lock;
+	/** signaled when a batch is queued */
+	pthread_cond_t work_cond;
+	/** signaled when a batch is done */
+	pthread_cond_t done_cond;
+	/** queued batches, oldest first */
+	struct work_batch * head;
+	struct work_batch ** tail;
+	size_t nr_queued;
+	/** non zero while a batch is processed */
+	int busy;
+	/** done batches, ready for reuse */
+	struct work_batch * free_list;
+	/** nr of works done */
+	unsigned long nr_work;
+	/** nr of times the queue was full */
+	unsigned long nr_wait;
+
+	/** the batch being filled, only used by the decoding thread */
+	struct work_batch * pending;
+};
+
+static struct worker * workers;
+static opd_work_func work_func;
+
+
+static void * worker_main(void * arg)
+{
+	struct worker * w = arg;
+	struct work_batch * batch;
+	size_t i;
+
+	pthread_mutex_lock(&w->lock);
+	while (1) {
+		while (!w->head)
+			pthread_cond_wait(&w->work_cond, &w->lock);
+
+		batch = w->head;
+		w->head = batch->next;
+		if (!w->head)
+			w->tail = &w->head;
+		--w->nr_queued;
+		w->busy = 1;
+		pthread_mutex_unlock(&w->lock);
+
+		for (i = 0; i < batch->nr_work; ++i)
+			work_func(&batch->work[i]);
+
+		pthread_mutex_lock(&w->lock);
+		w->nr_work += batch->nr_work;
+		batch->next = w->free_list;
+		w->free_list = batch;
+		w->busy = 0;
+		pthread_cond_signal(&w->done_cond);
+	}
+
+	return NULL;
+}
+
+
+static struct work_batch * get_batch(struct worker * w)
+{
+	struct work_batch * batch;
+
+	pthread_mutex_lock(&w->lock);
+	batch = w->free_list;
+	if (batch)
+		w->free_list = batch->next;
+	pthread_mutex_unlock(&w->lock);
+
+	if (!batch)
+		batch = xmalloc(sizeof(struct work_batch));
+	batch->next = NULL;
+	batch->nr_work = 0;
+
+	return batch;
+}
+
+
+/** hand the pending batch to the worker thread */
+static void submit_batch(struct worker * w)
+{
+	struct work_batch * batch = w->pending;
+
+	if (!batch || !batch->nr_work)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->nr_queued >= MAX_QUEUED_BATCH) {
+		++w->nr_wait;
+		while (w->nr_queued >= MAX_QUEUED_BATCH)
+			pthread_cond_wait(&w->done_cond, &w->lock);
+	}
+	*w->tail = batch;
+	w->tail = &batch->next;
+	++w->nr_queued;
+	pthread_cond_signal(&w->work_cond);
+	pthread_mutex_unlock(&w->lock);
+
+	w->pending = NULL;
+}
+
+
+void opd_workers_start(opd_work_func func)
+{
+	sigset_t all_signals;
+	sigset_t old_mask;
+	int i;
+
+	if (nr_workers <= 0) {
+		nr_workers = 0;
+		return;
+	}
+
+	if (nr_workers > OPD_MAX_WORKERS) {
+		fprintf(stderr, "oprofiled: too many worker threads, "
+			"using %d\n", OPD_MAX_WORKERS);
+		nr_workers = OPD_MAX_WORKERS;
+	}
+
+	work_func = func;
+	workers = xcalloc(nr_workers, sizeof(struct worker));
+
+	/* signals are handled by the main thread only */
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+	for (i = 0; i < nr_workers; ++i) {
+		struct worker * w = &workers[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->work_cond, NULL);
+		pthread_cond_init(&w->done_cond, NULL);
+		w->tail = &w->head;
+
+		if (pthread_create(&w->thread, NULL, worker_main, w)) {
+			perror("oprofiled: couldn't create worker thread: ");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+}
+
+
+void opd_workers_queue(unsigned int shard, struct opd_sample_work const * work)
+{
+	struct worker * w = &workers[shard];
+
+	if (!w->pending)
+		w->pending = get_batch(w);
+
+	w->pending->work[w->pending->nr_work++] = *work;
+
+	if (w->pending->nr_work == WORK_BATCH)
+		submit_batch(w);
+}
+
+
+void opd_workers_wait(void)
+{
+	int i;
+
+	for (i = 0; i < nr_workers; ++i)
+		submit_batch(&workers[i]);
+
+	for (i = 0; i < nr_workers; ++i) {
+		struct worker * w = &workers[i];
+
+		pthread_mutex_lock(&w->lock);
+		while (w->head || w->busy)
+			pthread_cond_wait(&w->done_cond, &w->lock);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+
+void opd_workers_print_stats(void)
+{
+	int i;
+
+	for (i = 0; i < nr_workers; ++i) {
+		struct worker * w = &workers[i];
+		unsigned long nr_work, nr_wait;
+
+		pthread_mutex_lock(&w->lock);
+		nr_work = w->nr_work;
+		nr_wait = w->nr_wait;
+		pthread_mutex_unlock(&w->lock);
+
+		printf("Nr. samples logged by worker thread %d: %lu\n",
+		       i, nr_work);
+		printf("Nr. waits for worker thread %d: %lu\n", i, nr_wait);
+	}
+}
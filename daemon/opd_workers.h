@@ -0,0 +1,52 @@
+/**
+ * @file daemon/opd_workers.h
+ * Threads writing samples to the sample files
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OPD_WORKERS_H
+#define OPD_WORKERS_H
+
+#include "odb.h"
+
+struct sfile;
+
+/** max nr of worker threads */
+#define OPD_MAX_WORKERS 64
+
+/** a sample to add to a sample file */
+struct opd_sample_work {
+	struct sfile * sf;
+	odb_t * file;
+	odb_key_t key;
+	unsigned long count;
+	unsigned int event;
+};
+
+typedef void (*opd_work_func)(struct opd_sample_work const * work);
+
+/**
+ * Start nr_workers threads (from the --workers option), do nothing if it's
+ * zero. Each sample file belongs to one worker thread, chosen by
+ * opd_workers_queue() callers, so only this thread ever updates it and the
+ * sample file doesn't need a lock. func is called by the worker threads for
+ * each queued work.
+ */
+void opd_workers_start(opd_work_func func);
+
+/** queue a work for the worker thread shard */
+void opd_workers_queue(unsigned int shard, struct opd_sample_work const * work);
+
+/**
+ * Wait until all works queued are done. It must be called before any
+ * access to a sample file or a sfile owned by a worker thread, as syncing,
+ * closing or freeing them.
+ */
+void opd_workers_wait(void);
+
+/** print statistics about worker threads */
+void opd_workers_print_stats(void);
+
+#endif /* OPD_WORKERS_H */
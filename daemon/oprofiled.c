@@ -18,6 +18,7 @@
 #include "opd_printf.h"
 #include "opd_events.h"
 #include "opd_extended.h"
+#include "opd_capture.h"
 
 #include "op_config.h"
 #include "op_version.h"
@@ -64,6 +65,12 @@ int separate_lib;
 int separate_kernel;
 int separate_thread;
 int separate_cpu;
+int nr_workers;
+int nr_read_buffers;
+int prefetch_cookies;
+int sync_budget;
+int max_open_files;
+int max_mapped;
 int no_vmlinux;
 char * vmlinux;
 char * kernel_range;
@@ -75,6 +82,7 @@ static char * verbose;
 static char * binary_name_filter;
 static char * events;
 static char * ext_feature;
+static char * record_file;
 static int showvers;
 static struct oprofiled_ops * opd_ops;
 extern struct oprofiled_ops opd_24_ops;
@@ -95,9 +103,16 @@ static struct poptOption options[] = {
 	{ "separate-kernel", 0, POPT_ARG_INT, &separate_kernel, 0, "separate kernel samples for each distinct application", "[0|1]", },
 	{ "separate-thread", 0, POPT_ARG_INT, &separate_thread, 0, "thread-profiling mode", "[0|1]" },
 	{ "separate-cpu", 0, POPT_ARG_INT, &separate_cpu, 0, "separate samples for each CPU", "[0|1]" },
+	{ "read-buffers", 0, POPT_ARG_INT, &nr_read_buffers, 0, "nr of buffers read ahead by a reader thread, 0 or 1 to read from the main thread", "num" },
+	{ "prefetch-cookies", 0, POPT_ARG_NONE, &prefetch_cookies, 0, "resolve the cookies of a buffer from the reader thread", NULL, },
+	{ "workers", 0, POPT_ARG_INT, &nr_workers, 0, "nr of threads writing sample files, 0 to write them from the main thread", "num" },
+	{ "sync-budget", 0, POPT_ARG_INT, &sync_budget, 0, "kbytes of sample files synced per second, 0 for no limit", "kbytes" },
+	{ "max-open-files", 0, POPT_ARG_INT, &max_open_files, 0, "nr of sample files kept open, 0 for the fd limit", "num" },
+	{ "max-mapped", 0, POPT_ARG_INT, &max_mapped, 0, "mbytes of sample files kept mapped, 0 for no limit", "mbytes" },
 	{ "events", 'e', POPT_ARG_STRING, &events, 0, "events list", "[events]" },
 	{ "version", 'v', POPT_ARG_NONE, &showvers, 0, "show version", NULL, },
 	{ "verbose", 'V', POPT_ARG_STRING, &verbose, 0, "be verbose in log file", "all,sfile,arcs,samples,module,misc", },
+	{ "record", 0, POPT_ARG_STRING, &record_file, 0, "record the daemon input in a capture file for opd_replay", "file", },
 	{ "ext-feature", 'x', POPT_ARG_STRING, &ext_feature, 1, "enable extended feature", "<extended-feature-name>:[args]", },
 	POPT_AUTOHELP
 	{ NULL, 0, 0, NULL, 0, NULL, NULL, },
@@ -462,6 +477,25 @@ static void opd_options(int argc, char const * argv[])
 		}
 	}
 
+	if (prefetch_cookies && nr_read_buffers <= 1) {
+		fprintf(stderr, "oprofiled: --prefetch-cookies needs "
+			"--read-buffers=2 or more, ignored.\n");
+		prefetch_cookies = 0;
+	}
+
+	if (sync_budget < 0) {
+		fprintf(stderr, "oprofiled: negative --sync-budget, "
+			"ignored.\n");
+		sync_budget = 0;
+	}
+
+	if (max_open_files < 0 || max_mapped < 0) {
+		fprintf(stderr, "oprofiled: negative --max-open-files or "
+			"--max-mapped, ignored.\n");
+		max_open_files = max_open_files < 0 ? 0 : max_open_files;
+		max_mapped = max_mapped < 0 ? 0 : max_mapped;
+	}
+
 	if (events != NULL)
 		opd_parse_events(events);
 
@@ -471,6 +505,26 @@ static void opd_options(int argc, char const * argv[])
 }
 
 
+/** start recording, with the options needed to replay the capture */
+static void opd_record_options(void)
+{
+	opd_capture_record(record_file);
+
+	opd_capture_int_option("cpu-type", cpu_type);
+	opd_capture_option("events", events);
+	opd_capture_int_option("separate-lib", separate_lib);
+	opd_capture_int_option("separate-kernel", separate_kernel);
+	opd_capture_int_option("separate-thread", separate_thread);
+	opd_capture_int_option("separate-cpu", separate_cpu);
+	opd_capture_int_option("no-vmlinux", no_vmlinux);
+	opd_capture_option("vmlinux", vmlinux);
+	opd_capture_option("kernel-range", kernel_range);
+	opd_capture_int_option("no-xen", no_xen);
+	opd_capture_option("xen-image", xenimage);
+	opd_capture_option("xen-range", xen_range);
+}
+
+
 /* determine what kernel we're running and which daemon
  * to use
  */
@@ -513,6 +567,9 @@ int main(int argc, char const * argv[])
 
 	opd_ops = get_ops();
 
+	if (record_file)
+		opd_record_options();
+
 	opd_ops->init();
 
 	opd_go_daemon();
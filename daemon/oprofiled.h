@@ -59,6 +59,12 @@ extern int separate_lib;
 extern int separate_kernel;
 extern int separate_thread;
 extern int separate_cpu;
+extern int nr_workers;
+extern int nr_read_buffers;
+extern int prefetch_cookies;
+extern int sync_budget;
+extern int max_open_files;
+extern int max_mapped;
 extern int no_vmlinux;
 extern char * vmlinux;
 extern char * kernel_range;
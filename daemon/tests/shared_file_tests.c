@@ -0,0 +1,292 @@
+/**
+ * @file shared_file_tests.c
+ * Tests for the sample files written by the worker threads
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "op_cpu_type.h"
+#include "op_sample_file.h"
+#include "odb.h"
+#include "opd_capture.h"
+#include "opd_interface.h"
+
+/* the image of all the cookies, its sample file is shared by their sfiles */
+#define IMAGE "/usr/bin/foo (deleted)"
+
+#define SAMPLE_FILE "samples/current/{root}" IMAGE "/{dep}/{root}" IMAGE \
+	"/TIMER.0.0.all.all.all"
+
+#define NR_COOKIE 4
+#define NR_BUFFER 400
+#define NR_SWITCH 200
+#define NR_SAMPLE 20
+
+#define ESCAPE ~0UL
+
+struct pair {
+	odb_key_t key;
+	odb_value_t value;
+};
+
+static char tmp_dir[] = "/tmp/shared-file-tests-XXXXXX";
+static char capture[sizeof(tmp_dir) + 16];
+
+
+static void write_record(FILE * fp, uint32_t type, uint64_t value,
+                         void const * payload, uint32_t size)
+{
+	struct opd_capture_record record;
+
+	record.type = type;
+	record.size = size;
+	record.value = value;
+	fwrite(&record, sizeof(record), 1, fp);
+	fwrite(payload, size, 1, fp);
+}
+
+
+static void write_option(FILE * fp, char const * name, char const * value)
+{
+	char buf[256];
+	size_t len = strlen(name) + 1;
+
+	strcpy(buf, name);
+	strcpy(buf + len, value);
+	write_record(fp, OPD_CAPTURE_OPTION, 0, buf, len + strlen(value));
+}
+
+
+/**
+ * Write a capture where NR_COOKIE dcookies resolve to the same name, as
+ * two binaries replaced while running. Their sfiles differ but mangle to
+ * the same sample file.
+ */
+static void write_capture(void)
+{
+	struct opd_capture_header header;
+	unsigned long * words;
+	char buf[32];
+	unsigned long seed = 1;
+	size_t nr_word;
+	size_t i, j, k;
+	FILE * fp;
+
+	fp = fopen(capture, "w");
+	if (!fp) {
+		perror(capture);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&header, '\0', sizeof(header));
+	memcpy(header.magic, OPD_CAPTURE_MAGIC, sizeof(OPD_CAPTURE_MAGIC));
+	header.version = OPD_CAPTURE_VERSION;
+	fwrite(&header, sizeof(header), 1, fp);
+
+	sprintf(buf, "%d", CPU_TIMER_INT);
+	write_option(fp, "cpu-type", buf);
+	sprintf(buf, "%lu", (unsigned long)sizeof(unsigned long));
+	write_option(fp, "pointer-size", buf);
+	write_option(fp, "separate-lib", "0");
+	write_option(fp, "separate-kernel", "0");
+	write_option(fp, "separate-thread", "0");
+	write_option(fp, "separate-cpu", "0");
+	write_option(fp, "no-vmlinux", "1");
+	write_option(fp, "no-xen", "1");
+	write_option(fp, "events", "TIMER:0:0:0:0:1:1");
+	write_record(fp, OPD_CAPTURE_FILE, 0, "/proc/modules", 14);
+
+	for (i = 0; i < NR_COOKIE; ++i)
+		write_record(fp, OPD_CAPTURE_COOKIE, (i + 1) << 12, IMAGE,
+		             strlen(IMAGE));
+
+	words = malloc(NR_SWITCH * (15 + 2 * NR_SAMPLE) * sizeof(*words));
+
+	for (i = 0; i < NR_BUFFER; ++i) {
+		nr_word = 0;
+		for (j = 0; j < NR_SWITCH; ++j) {
+			unsigned long cookie = ((j % NR_COOKIE) + 1) << 12;
+			unsigned long tgid = 100 + j % 7;
+
+			words[nr_word++] = ESCAPE;
+			words[nr_word++] = CPU_SWITCH_CODE;
+			words[nr_word++] = 0;
+			words[nr_word++] = ESCAPE;
+			words[nr_word++] = USER_ENTER_SWITCH_CODE;
+			words[nr_word++] = ESCAPE;
+			words[nr_word++] = CTX_SWITCH_CODE;
+			words[nr_word++] = tgid;
+			words[nr_word++] = cookie;
+			words[nr_word++] = ESCAPE;
+			words[nr_word++] = CTX_TGID_CODE;
+			words[nr_word++] = tgid;
+			words[nr_word++] = ESCAPE;
+			words[nr_word++] = COOKIE_SWITCH_CODE;
+			words[nr_word++] = cookie;
+			/* many distinct pcs so the sample file grows */
+			for (k = 0; k < NR_SAMPLE; ++k) {
+				seed = seed * 1103515245 + 12345;
+				words[nr_word++] = ((seed >> 8) & 0xfffff) * 4;
+				words[nr_word++] = 0;
+			}
+		}
+		write_record(fp, OPD_CAPTURE_BUFFER, 0, words,
+		             nr_word * sizeof(*words));
+	}
+
+	free(words);
+	fclose(fp);
+}
+
+
+/** replay the capture in tmp_dir/name with nr_workers worker threads */
+static void replay(char const * name, int nr_workers)
+{
+	char cmd[256];
+	char dir[128];
+
+	sprintf(dir, "%s/%s", tmp_dir, name);
+	if (mkdir(dir, 0755)) {
+		perror(dir);
+		exit(EXIT_FAILURE);
+	}
+
+	sprintf(cmd, "../opd_replay --session-dir=%s --workers=%d %s "
+	        ">/dev/null", dir, nr_workers, capture);
+	if (system(cmd)) {
+		fprintf(stderr, "%s failed\n", cmd);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static int compare_pair(void const * lhs, void const * rhs)
+{
+	struct pair const * l = lhs;
+	struct pair const * r = rhs;
+
+	if (l->key != r->key)
+		return l->key < r->key ? -1 : 1;
+	return 0;
+}
+
+
+/** read the sorted samples of tmp_dir/name, return their nr */
+static size_t read_samples(char const * name, struct pair ** pairs)
+{
+	char filename[256];
+	odb_iterator_t it;
+	odb_key_t key;
+	odb_value_t value;
+	size_t nr = 0;
+	size_t max = 1024;
+	odb_t file;
+	int rc;
+
+	sprintf(filename, "%s/%s/" SAMPLE_FILE, tmp_dir, name);
+	rc = odb_open(&file, filename, ODB_RDONLY, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+
+	*pairs = malloc(max * sizeof(struct pair));
+	odb_iterator_init(&it, &file);
+	while (odb_iterator_next(&it, &key, &value)) {
+		if (nr == max) {
+			max *= 2;
+			*pairs = realloc(*pairs, max * sizeof(struct pair));
+		}
+		(*pairs)[nr].key = key;
+		(*pairs)[nr].value = value;
+		++nr;
+	}
+	odb_close(&file);
+
+	qsort(*pairs, nr, sizeof(struct pair), compare_pair);
+
+	return nr;
+}
+
+
+/**
+ * The sfiles of all the cookies share one sample file, the workers must
+ * write it as the main thread does.
+ */
+static int test_shared_file(void)
+{
+	struct pair * serial;
+	struct pair * workers;
+	size_t nr_serial, nr_workers;
+	unsigned long long total = 0;
+	size_t i;
+	int err = 0;
+
+	replay("serial", 0);
+	replay("workers", 4);
+
+	nr_serial = read_samples("serial", &serial);
+	nr_workers = read_samples("workers", &workers);
+
+	for (i = 0; i < nr_serial; ++i)
+		total += serial[i].value;
+
+	if (total != NR_BUFFER * NR_SWITCH * NR_SAMPLE) {
+		fprintf(stderr, "serial replay: %llu samples, expected %d\n",
+		        total, NR_BUFFER * NR_SWITCH * NR_SAMPLE);
+		err = 1;
+	}
+
+	if (nr_serial != nr_workers) {
+		fprintf(stderr, "replay with workers: %lu keys, expected %lu\n",
+		        (unsigned long)nr_workers, (unsigned long)nr_serial);
+		err = 1;
+	}
+
+	for (i = 0; !err && i < nr_serial; ++i) {
+		if (serial[i].key != workers[i].key ||
+		    serial[i].value != workers[i].value) {
+			fprintf(stderr, "replay with workers: key %llx value "
+			        "%u, expected key %llx value %u\n",
+			        (unsigned long long)workers[i].key,
+			        workers[i].value,
+			        (unsigned long long)serial[i].key,
+			        serial[i].value);
+			err = 1;
+		}
+	}
+
+	free(serial);
+	free(workers);
+
+	return err;
+}
+
+
+int main(void)
+{
+	char cmd[64];
+	int err;
+
+	if (!mkdtemp(tmp_dir)) {
+		perror(tmp_dir);
+		exit(EXIT_FAILURE);
+	}
+	sprintf(capture, "%s/capture", tmp_dir);
+
+	write_capture();
+	err = test_shared_file();
+
+	sprintf(cmd, "rm -rf %s", tmp_dir);
+	system(cmd);
+
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -32,6 +32,7 @@ static struct op_abi_entry const abi_entries[] = {
 	{ "sizeof_odb_node_nr_t", sizeof(odb_node_nr_t) },
 	{ "sizeof_odb_descr_t", sizeof(odb_descr_t) },
 	{ "sizeof_odb_node_t", sizeof(odb_node_t) },
+	{ "sizeof_odb_bucket_t", sizeof(odb_bucket_t) },
 	{ "sizeof_struct_opd_header", sizeof(struct opd_header) },
 	
 	{ "offsetof_node_key", offsetof(odb_node_t, key) },
@@ -40,6 +41,14 @@ static struct op_abi_entry const abi_entries[] = {
 	
 	{ "offsetof_descr_size", offsetof(odb_descr_t, size) },
 	{ "offsetof_descr_current_size", offsetof(odb_descr_t, current_size) },
+	{ "offsetof_descr_layout", offsetof(odb_descr_t, layout) },
+	{ "offsetof_descr_base", offsetof(odb_descr_t, base) },
+	{ "offsetof_descr_old_left", offsetof(odb_descr_t, old_left) },
+	{ "offsetof_descr_old_base", offsetof(odb_descr_t, old_base) },
+
+	{ "offsetof_bucket_key", offsetof(odb_bucket_t, key) },
+	{ "offsetof_bucket_value", offsetof(odb_bucket_t, value) },
+	{ "offsetof_bucket_nr_used", offsetof(odb_bucket_t, nr_used) },
 	
 	{ "offsetof_header_magic", offsetof(struct opd_header, magic) },
 	{ "offsetof_header_version", offsetof(struct opd_header, version) },
@@ -12,9 +12,11 @@
 #include "odb.h"
 #include "popt_options.h"
 #include "op_sample_file.h"
+#include "op_config.h"
 
 #include <fstream>
 #include <iostream>
+#include <set>
 #include <vector>
 #include <cassert>
 #include <cstring>
@@ -104,6 +106,90 @@ void extractor::extract(T & targ, void const * src_,
 }
 
 
+/**
+ * import nr_bucket buckets from src, the keys of skip are not imported. If
+ * seen is not NULL the imported keys are inserted in it.
+ */
+void import_bucket_array(abi const & abi, extractor & ext,
+                         unsigned char const * src, odb_node_nr_t nr_bucket,
+                         set<odb_key_t> const & skip, set<odb_key_t> * seen,
+                         odb_t * dest)
+{
+	unsigned int step = abi.need("sizeof_odb_bucket_t");
+	unsigned int key_size = abi.need("sizeof_odb_key_t");
+	unsigned int value_size = abi.need("sizeof_odb_value_t");
+
+	if (verbose)
+		cerr << "extracting " << nr_bucket << " buckets of " << step
+		     << " bytes each " << endl;
+
+	for (odb_node_nr_t i = 0 ; i < nr_bucket ; ++i, src += step) {
+		uint32_t nr_used;
+		ext.extract(nr_used, src, "sizeof_u32", "offsetof_bucket_nr_used");
+		assert(nr_used <= ODB_BUCKET_SLOTS);
+		for (uint32_t j = 0 ; j < nr_used ; ++j) {
+			odb_key_t key;
+			odb_value_t val;
+			ext.extract(key, src + j * key_size,
+			            "sizeof_odb_key_t", "offsetof_bucket_key");
+			ext.extract(val, src + j * value_size,
+			            "sizeof_odb_value_t", "offsetof_bucket_value");
+			if (skip.find(key) != skip.end())
+				continue;
+			if (seen)
+				seen->insert(key);
+			int rc = odb_add_node(dest, key, val);
+			if (rc != EXIT_SUCCESS) {
+				cerr << strerror(rc) << endl;
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+
+void import_buckets(abi const & abi, extractor & ext,
+                    unsigned char const * begin, size_t len,
+                    odb_node_nr_t nr_bucket, odb_node_nr_t base,
+                    odb_node_nr_t old_left, odb_node_nr_t old_base,
+                    odb_t * dest)
+{
+	size_t offset = abi.need("sizeof_struct_opd_header") +
+		abi.need("sizeof_odb_descr_t");
+	offset = (offset + ODB_BUCKET_ALIGN - 1) & ~(ODB_BUCKET_ALIGN - 1);
+
+	unsigned int step = abi.need("sizeof_odb_bucket_t");
+	unsigned char const * src = begin + offset + base * step;
+	unsigned char const * old_src = begin + offset + old_base * step;
+
+	// a growing is published old_left, size then base, see odb_open()
+	if (old_left && nr_bucket < old_left * 2)
+		nr_bucket = old_left * 2;
+	if (old_left) {
+		base = nr_bucket;
+		src = begin + offset + base * step;
+	}
+
+	assert(src + (nr_bucket * step) <= begin + len);
+	assert(old_left <= nr_bucket / 2);
+	assert(old_src + (old_left * step) <= begin + len);
+
+	set<odb_key_t> none;
+	set<odb_key_t> moving;
+
+	// the not yet migrated part of the previous array of a file which
+	// was being grown, the pairs of its last bucket can be in both
+	// arrays
+	if (old_left) {
+		import_bucket_array(abi, ext, old_src, old_left - 1, none, 0,
+		                    dest);
+		import_bucket_array(abi, ext, old_src + (old_left - 1) * step,
+		                    1, none, &moving, dest);
+	}
+	import_bucket_array(abi, ext, src, nr_bucket, moving, 0, dest);
+}
+
+
 void import_from_abi(abi const & abi, void const * srcv,
                      size_t len, odb_t * dest) throw (abi_exception)
 {
@@ -117,6 +203,15 @@ void import_from_abi(abi const & abi, void const * srcv,
 
 	// begin extracting opd header
 	ext.extract(head->version, src, "sizeof_u32", "offsetof_header_version");
+	if (head->version != OPD_VERSION &&
+	    head->version != OPD_VERSION_CHAINED) {
+		cerr << "unsupported sample file version " << hex
+		     << head->version << endl;
+		exit(EXIT_FAILURE);
+	}
+	// the imported file is written with the current layout
+	u32 const version = head->version;
+	head->version = OPD_VERSION;
 	ext.extract(head->cpu_type, src, "sizeof_u32", "offsetof_header_cpu_type");
 	ext.extract(head->ctr_event, src, "sizeof_u32", "offsetof_header_ctr_event");
 	ext.extract(head->ctr_um, src, "sizeof_u32", "offsetof_header_ctr_um");
@@ -137,9 +232,36 @@ void import_from_abi(abi const & abi, void const * srcv,
 	// begin extracting necessary parts of descr
 	odb_node_nr_t node_nr;
 	ext.extract(node_nr, src, "sizeof_odb_node_nr_t", "offsetof_descr_current_size");
+	odb_node_nr_t size;
+	ext.extract(size, src, "sizeof_odb_node_nr_t", "offsetof_descr_size");
+	int layout = ODB_LAYOUT_CHAINED;
+	odb_node_nr_t base = 0;
+	odb_node_nr_t old_left = 0;
+	odb_node_nr_t old_base = 0;
+	// an older file has no layout, whatever the abi says
+	if (version != OPD_VERSION_CHAINED) {
+		try {
+			ext.extract(layout, src, "sizeof_int",
+			            "offsetof_descr_layout");
+			ext.extract(base, src, "sizeof_odb_node_nr_t",
+			            "offsetof_descr_base");
+			ext.extract(old_left, src, "sizeof_odb_node_nr_t",
+			            "offsetof_descr_old_left");
+			ext.extract(old_base, src, "sizeof_odb_node_nr_t",
+			            "offsetof_descr_old_base");
+		} catch (abi_exception const &) {
+			// abi older than bucketed file
+		}
+	}
 	src += abi.need("sizeof_odb_descr_t");
 	// done extracting descr
 
+	if (layout == ODB_LAYOUT_BUCKET) {
+		import_buckets(abi, ext, begin, len, size, base, old_left,
+		               old_base, dest);
+		return;
+	}
+
 	// skip node zero, it is reserved and contains nothing usefull
 	src += abi.need("sizeof_odb_node_t");
 
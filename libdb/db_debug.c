@@ -66,26 +66,103 @@ static int check_circular_list(odb_data_t const * data)
 	return do_abort;
 }
 
-static int check_redundant_key(odb_data_t const * data, odb_key_t max)
+static int check_redundant_key(odb_t const * odb, odb_key_t max)
 {
-	odb_node_nr_t pos;
+	odb_iterator_t it;
+	odb_key_t key;
+	odb_value_t value;
 
 	unsigned char * bitmap = malloc(max + 1);
 	memset(bitmap, '\0', max + 1);
 
-	for (pos = 1 ; pos < data->descr->current_size ; ++pos) {
-		if (bitmap[data->node_base[pos].key]) {
+	odb_iterator_init(&it, odb);
+	while (odb_iterator_next(&it, &key, &value)) {
+		if (bitmap[key]) {
 			printf("redundant key found %lld\n",
-			       (unsigned long long)data->node_base[pos].key);
+			       (unsigned long long)key);
+			free(bitmap);
 			return 1;
 		}
-		bitmap[data->node_base[pos].key] = 1;
+		bitmap[key] = 1;
 	}
 	free(bitmap);
 
 	return 0;
 }
 
+/**
+ * check all keys are reachable: every bucket between the hash slot of a
+ * key and the bucket holding it must be full, else a lookup stops before
+ * finding the key. Only the nr_check first buckets of the array are
+ * checked, return the nr of key found in nr_node.
+ */
+static int check_bucket_array(odb_data_t const * data,
+                              odb_bucket_t const * bucket_base,
+                              odb_hash_mask_t mask, odb_node_nr_t nr_check,
+                              odb_key_t * max, odb_node_nr_t * nr_node)
+{
+	odb_index_t pos;
+	odb_index_t index;
+	unsigned int i;
+	int ret = 0;
+
+	for (pos = 0 ; pos < nr_check ; ++pos) {
+		odb_bucket_t const * bucket = &bucket_base[pos];
+
+		if (bucket->nr_used > ODB_BUCKET_SLOTS) {
+			printf("bucket %d corrupted, %d slot used\n",
+			       pos, bucket->nr_used);
+			ret = 1;
+			continue;
+		}
+
+		for (i = 0 ; i < bucket->nr_used ; ++i) {
+			odb_key_t key = bucket->key[i];
+
+			++*nr_node;
+			if (key > *max)
+				*max = key;
+
+			index = odb_hash_key(data, key) & mask;
+			while (index != pos) {
+				if (bucket_base[index].nr_used !=
+				    ODB_BUCKET_SLOTS) {
+					printf("unreachable key %lld\n",
+					       (unsigned long long)key);
+					ret = 1;
+					break;
+				}
+				index = (index + 1) & mask;
+			}
+		}
+	}
+
+	return ret;
+}
+
+
+static int check_buckets(odb_data_t const * data, odb_key_t * max)
+{
+	odb_node_nr_t nr_node = 0;
+	int ret;
+
+	ret = check_bucket_array(data, data->bucket_base, data->hash_mask,
+				 data->descr->size, max, &nr_node);
+	/* the not yet migrated part of the previous array */
+	ret |= check_bucket_array(data, data->old_bucket_base,
+				  data->descr->size / 2 - 1,
+				  data->descr->old_left, max, &nr_node);
+
+	if (nr_node != data->descr->current_size - 1) {
+		printf("bucket walk found %d node expect %d node\n",
+		       nr_node, data->descr->current_size - 1);
+		ret = 1;
+	}
+
+	return ret;
+}
+
+
 int odb_check_hash(odb_t const * odb)
 {
 	odb_node_nr_t pos;
@@ -95,6 +172,13 @@ int odb_check_hash(odb_t const * odb)
 	odb_key_t max = 0;
 	odb_data_t * data = odb->data;
 
+	if (odb_is_bucketed(data)) {
+		ret = check_buckets(data, &max);
+		if (ret == 0)
+			ret = check_redundant_key(odb, max);
+		return ret;
+	}
+
 	for (pos = 0 ; pos < data->descr->size * BUCKET_FACTOR ; ++pos) {
 		odb_index_t index = data->hash_base[pos];
 		while (index) {
@@ -126,7 +210,7 @@ int odb_check_hash(odb_t const * odb)
 		ret = check_circular_list(data);
 
 	if (ret == 0)
-		ret = check_redundant_key(data, max);
+		ret = check_redundant_key(odb, max);
 
 	return ret;
 }
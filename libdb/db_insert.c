@@ -42,6 +42,8 @@ static inline int add_node(odb_data_t * data, odb_key_t key, odb_value_t value)
 	index = odb_do_hash(data, key);
 	node->next = data->hash_base[index];
 	data->hash_base[index] = new_node;
+	odb_mark_dirty(data, node, sizeof(odb_node_t));
+	odb_mark_dirty(data, &data->hash_base[index], sizeof(odb_index_t));
 
 	/* FIXME: we need wrmb() here */
 	odb_commit_reservation(data);
@@ -49,6 +51,87 @@ static inline int add_node(odb_data_t * data, odb_key_t key, odb_value_t value)
 	return 0;
 }
 
+
+/**
+ * store a new key/value pair in a bucketed file, bucket is the first non
+ * full bucket in the probe sequence of key if the caller already knows
+ * it, NULL otherwise.
+ */
+static inline int add_bucket_node(odb_data_t * data, odb_bucket_t * bucket,
+                                  odb_key_t key, odb_value_t value)
+{
+	if (data->descr->current_size > odb_bucket_capacity(data->descr->size)) {
+		if (odb_grow_hashtable(data))
+			return EINVAL;
+		/* the table has been rebuilt, bucket is stale */
+		bucket = NULL;
+	}
+
+	if (!bucket)
+		bucket = odb_free_bucket(data, key);
+
+	bucket->key[bucket->nr_used] = key;
+	bucket->value[bucket->nr_used] = value;
+
+	/* same as odb_commit_reservation(), a reader see the new pair only
+	 * after nr_used is incremented. FIXME: we need wrmb() here */
+	++bucket->nr_used;
+	++data->descr->current_size;
+	odb_mark_dirty(data, bucket, sizeof(odb_bucket_t));
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+
+	return 0;
+}
+
+
+static int update_bucket_node(odb_data_t * data, odb_key_t key,
+                              unsigned long int offset)
+{
+	odb_bucket_t * bucket;
+	odb_value_t * value;
+	odb_index_t index;
+	unsigned int i;
+
+	if (data->descr->old_left)
+		odb_migrate_buckets(data, ODB_MIGRATE_STEP);
+
+	index = odb_do_hash(data, key);
+
+	while (1) {
+		bucket = &data->bucket_base[index];
+		for (i = 0; i < bucket->nr_used; ++i) {
+			if (bucket->key[i] == key) {
+				value = &bucket->value[i];
+				goto found;
+			}
+		}
+
+		/* a non full bucket ends the probe sequence */
+		if (bucket->nr_used < ODB_BUCKET_SLOTS)
+			break;
+
+		index = (index + 1) & data->hash_mask;
+	}
+
+	if (!data->descr->old_left)
+		return add_bucket_node(data, bucket, key, offset);
+
+	/* a migrated key is found first in the new array */
+	index = odb_find_old_key(data, key, &i);
+	if (index == ODB_NODE_NR_INVALID)
+		return add_bucket_node(data, bucket, key, offset);
+	value = &data->old_bucket_base[index].value[i];
+
+found:
+	/* see overflow comment in odb_update_node_with_offset() */
+	if (*value + offset != 0) {
+		*value += offset;
+		odb_mark_dirty(data, value, sizeof(odb_value_t));
+	}
+	return 0;
+}
+
+
 int odb_update_node(odb_t * odb, odb_key_t key)
 {
 	return odb_update_node_with_offset(odb, key, 1);
@@ -63,12 +146,17 @@ int odb_update_node_with_offset(odb_t * odb,
 	odb_data_t * data;
 
 	data = odb->data;
+	if (odb_is_bucketed(data))
+		return update_bucket_node(data, key, offset);
+
 	index = data->hash_base[odb_do_hash(data, key)];
 	while (index) {
 		node = &data->node_base[index];
 		if (node->key == key) {
 			if (node->value + offset != 0) {
 				node->value += offset;
+				odb_mark_dirty(data, &node->value,
+				               sizeof(odb_value_t));
 			} else {
 				/* post profile tools must handle overflow */
 				/* FIXME: the tricky way will be just to add
@@ -105,5 +193,10 @@ int odb_update_node_with_offset(odb_t * odb,
 
 int odb_add_node(odb_t * odb, odb_key_t key, odb_value_t value)
 {
+	if (odb_is_bucketed(odb->data)) {
+		if (odb->data->descr->old_left)
+			odb_migrate_buckets(odb->data, ODB_MIGRATE_STEP);
+		return add_bucket_node(odb->data, NULL, key, value);
+	}
 	return add_node(odb->data, key, value);
 }
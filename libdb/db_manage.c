@@ -16,11 +16,14 @@
 #else
 #include <sys/fcntl.h>
 #endif
+#include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -48,14 +51,32 @@ static __inline odb_index_t * odb_to_hash_base(odb_data_t * data)
 				(data->descr->size * sizeof(odb_node_t)));
 }
 
- 
+
+/** setup the pointers and mask of a bucketed file after a (re)mapping */
+static void setup_buckets(odb_data_t * data)
+{
+	odb_bucket_t * first = (odb_bucket_t *)(((char *)data->base_memory) +
+						data->offset_bucket);
+
+	data->bucket_base = first + data->descr->base;
+	data->old_bucket_base = first + data->descr->old_base;
+	data->hash_mask = data->descr->size - 1;
+}
+
+
 /**
- * return the number of bytes used by hash table, node table and header.
+ * return the number of bytes used by a file of the given layout: header,
+ * hash table and node table or bucket array. node_nr is a bucket number
+ * for a bucketed file.
  */
-static unsigned int tables_size(odb_data_t const * data, odb_node_nr_t node_nr)
+static unsigned int
+layout_size(odb_data_t const * data, int layout, odb_node_nr_t node_nr)
 {
 	size_t size;
 
+	if (layout == ODB_LAYOUT_BUCKET)
+		return data->offset_bucket + node_nr * sizeof(odb_bucket_t);
+
 	size = node_nr * (sizeof(odb_index_t) * BUCKET_FACTOR);
 	size += node_nr * sizeof(odb_node_t);
 	size += data->offset_node;
@@ -64,7 +85,280 @@ static unsigned int tables_size(odb_data_t const * data, odb_node_nr_t node_nr)
 }
 
 
-int odb_grow_hashtable(odb_data_t * data)
+/**
+ * return the number of bytes used by hash table, node table and header.
+ */
+static unsigned int tables_size(odb_data_t const * data, odb_node_nr_t node_nr)
+{
+	if (odb_is_bucketed(data))
+		node_nr += data->descr->base;
+	return layout_size(data, data->descr->layout, node_nr);
+}
+
+
+/**
+ * (re)size the dirty page bitmap to cover a mapping of size bytes, the
+ * pages added are clean. Only a file opened for writing has a bitmap.
+ */
+static void resize_dirty(odb_data_t * data, size_t size)
+{
+	size_t nr_page = (size + (1UL << data->page_shift) - 1) >>
+		data->page_shift;
+	size_t old_words = (data->nr_page + ODB_DIRTY_BITS - 1) /
+		ODB_DIRTY_BITS;
+	size_t new_words = (nr_page + ODB_DIRTY_BITS - 1) / ODB_DIRTY_BITS;
+
+	if (!data->dirty || new_words > old_words) {
+		data->dirty = xrealloc(data->dirty,
+				       new_words * sizeof(unsigned long));
+		memset(data->dirty + old_words, '\0',
+		       (new_words - old_words) * sizeof(unsigned long));
+	}
+	data->nr_page = nr_page;
+}
+
+
+/** mark all the tables of a file dirty, used when they are rebuilt */
+static void mark_all_dirty(odb_data_t * data)
+{
+	odb_mark_dirty(data, data->base_memory,
+		       tables_size(data, data->descr->size));
+}
+
+
+static enum odb_grow_mode grow_mode = ODB_GROW_SYNC;
+/** files are grown by several threads, updated atomically */
+static struct odb_grow_stat grow_stat;
+static struct odb_usage usage;
+
+
+/** account for a mapping resized from old_size to new_size bytes */
+static void account_mapped(size_t old_size, size_t new_size)
+{
+	/* size_t wraps, a shrink is correctly accounted */
+	__sync_fetch_and_add(&usage.mapped, new_size - old_size);
+}
+
+
+void odb_get_usage(struct odb_usage * result)
+{
+	result->nr_file = usage.nr_file;
+	result->mapped = __sync_fetch_and_add(&usage.mapped, 0);
+}
+
+void odb_set_grow_mode(enum odb_grow_mode mode)
+{
+	grow_mode = mode;
+}
+
+
+void odb_get_grow_stat(struct odb_grow_stat * stat)
+{
+	stat->nr_grow = __sync_fetch_and_add(&grow_stat.nr_grow, 0);
+	stat->nr_migrated = __sync_fetch_and_add(&grow_stat.nr_migrated, 0);
+	stat->usec = __sync_fetch_and_add(&grow_stat.usec, 0);
+}
+
+
+static unsigned long get_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000UL + tv.tv_usec;
+}
+
+
+/**
+ * Start growing a bucketed file: the new bucket array, twice as big, is
+ * put at bucket descr->size * 2, after the current one which becomes the
+ * previous array. Nothing is copied here, odb_migrate_buckets() does it
+ * later. Open addressing can't be rehashed in place, so this is also the
+ * first step of a synchronous growing.
+ */
+static int start_migration(odb_data_t * data)
+{
+	odb_node_nr_t old_size = data->descr->size;
+	odb_node_nr_t base = old_size * 2;
+	size_t start = layout_size(data, ODB_LAYOUT_BUCKET, base);
+	size_t file_size = layout_size(data, ODB_LAYOUT_BUCKET, base * 2);
+	struct stat stat_buf;
+	void * new_map;
+
+	if (fstat(data->fd, &stat_buf))
+		return 1;
+
+	/* the file is bigger if it couldn't be truncated after a growing */
+	if ((size_t)stat_buf.st_size < file_size &&
+	    ftruncate(data->fd, file_size))
+		return 1;
+
+	if (data->map_size < file_size) {
+		new_map = mremap(data->base_memory, data->map_size, file_size,
+				 MREMAP_MAYMOVE);
+
+		if (new_map == MAP_FAILED)
+			return 1;
+
+		account_mapped(data->map_size, file_size);
+		data->base_memory = new_map;
+		data->map_size = file_size;
+		data->descr = odb_to_descr(data);
+		resize_dirty(data, file_size);
+	}
+
+	/* the new array is zeroed by ftruncate(), except the part which was
+	 * already in the file */
+	if ((size_t)stat_buf.st_size > start) {
+		memset((char *)data->base_memory + start, '\0',
+		       file_size - start);
+		odb_mark_dirty(data, (char *)data->base_memory + start,
+			       file_size - start);
+	}
+
+	/* the reverse of the order read_bucket_state() reads them */
+	data->descr->old_base = data->descr->base;
+	__sync_synchronize();
+	data->descr->old_left = old_size;
+	__sync_synchronize();
+	data->descr->size = old_size * 2;
+	__sync_synchronize();
+	data->descr->base = base;
+	setup_buckets(data);
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+
+	return 0;
+}
+
+
+/**
+ * The previous bucket array is no longer used: copy the bucket array to
+ * the start, the space of the previous array, and truncate the file.
+ * Without this each growing would leave the space of the previous arrays
+ * unused and a file would stay about twice as big as its bucket array.
+ * base is descr->size so the copy doesn't overlap the array, which stays
+ * published until the copy is done. A reader can walk the array or the
+ * end of the file, this is done only if no reader holds the lock of the
+ * file, else the next growing, odb_sync() or odb_close() retries.
+ */
+static void compact_buckets(odb_data_t * data)
+{
+	size_t bytes = data->descr->size * sizeof(odb_bucket_t);
+	odb_bucket_t * first = data->bucket_base - data->descr->base;
+	size_t file_size;
+
+	if (data->descr->old_left || !data->descr->base ||
+	    flock(data->fd, LOCK_EX | LOCK_NB))
+		return;
+
+	memcpy(first, data->bucket_base, bytes);
+	odb_mark_dirty(data, first, bytes);
+	__sync_synchronize();
+	data->descr->base = 0;
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+	setup_buckets(data);
+
+	/* shrinking a mapping doesn't move it */
+	file_size = tables_size(data, data->descr->size);
+	if (mremap(data->base_memory, data->map_size, file_size, 0) ==
+	    MAP_FAILED)
+		goto out;
+
+	account_mapped(data->map_size, file_size);
+	data->map_size = file_size;
+	resize_dirty(data, file_size);
+
+	/* on failure odb_open() ignores the end of the file */
+	if (ftruncate(data->fd, file_size))
+		goto out;
+out:
+	flock(data->fd, LOCK_UN);
+}
+
+
+/** return the value of key in the bucket array, NULL if not found */
+static odb_value_t * find_bucket_node(odb_data_t * data, odb_key_t key)
+{
+	odb_index_t index = odb_do_hash(data, key);
+	unsigned int i;
+
+	while (1) {
+		odb_bucket_t * bucket = &data->bucket_base[index];
+		for (i = 0; i < bucket->nr_used; ++i) {
+			if (bucket->key[i] == key)
+				return &bucket->value[i];
+		}
+
+		if (bucket->nr_used < ODB_BUCKET_SLOTS)
+			return NULL;
+
+		index = (index + 1) & data->hash_mask;
+	}
+}
+
+
+/**
+ * move the last not yet migrated bucket of the previous array to the
+ * bucket array. redo must be set if a crash could have stopped a previous
+ * move of this bucket, its pairs already moved are then overwritten.
+ */
+static void move_bucket(odb_data_t * data, int redo)
+{
+	odb_bucket_t const * old =
+		&data->old_bucket_base[data->descr->old_left - 1];
+	odb_value_t * value;
+	unsigned int i;
+
+	for (i = 0; i < old->nr_used; ++i) {
+		odb_bucket_t * bucket;
+
+		if (redo && (value = find_bucket_node(data, old->key[i]))) {
+			*value = old->value[i];
+			odb_mark_dirty(data, value, sizeof(odb_value_t));
+			continue;
+		}
+
+		bucket = odb_free_bucket(data, old->key[i]);
+		bucket->key[bucket->nr_used] = old->key[i];
+		bucket->value[bucket->nr_used] = old->value[i];
+		++bucket->nr_used;
+		odb_mark_dirty(data, bucket, sizeof(odb_bucket_t));
+	}
+
+	/* the pairs are in both arrays until old_left is decremented, a
+	 * reader ignores them in the bucket array */
+	__sync_synchronize();
+	--data->descr->old_left;
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+}
+
+
+static void migrate_buckets(odb_data_t * data, odb_node_nr_t nr)
+{
+	unsigned long nr_migrated = 0;
+
+	for (; nr && data->descr->old_left; --nr) {
+		move_bucket(data, 0);
+		++nr_migrated;
+	}
+
+	if (nr_migrated)
+		__sync_fetch_and_add(&grow_stat.nr_migrated, nr_migrated);
+
+	compact_buckets(data);
+}
+
+
+void odb_migrate_buckets(odb_data_t * data, odb_node_nr_t nr)
+{
+	unsigned long start = get_usec();
+
+	migrate_buckets(data, nr);
+	__sync_fetch_and_add(&grow_stat.usec, get_usec() - start);
+}
+
+
+static int grow_chained(odb_data_t * data)
 {
 	unsigned int old_file_size;
 	unsigned int new_file_size;
@@ -83,12 +377,16 @@ int odb_grow_hashtable(odb_data_t * data)
 	if (new_map == MAP_FAILED)
 		return 1;
 
+	account_mapped(old_file_size, new_file_size);
 	data->base_memory = new_map;
+	data->map_size = new_file_size;
 	data->descr = odb_to_descr(data);
 	data->descr->size *= 2;
 	data->node_base = odb_to_node_base(data);
 	data->hash_base = odb_to_hash_base(data);
 	data->hash_mask = (data->descr->size * BUCKET_FACTOR) - 1;
+	resize_dirty(data, new_file_size);
+	mark_all_dirty(data);
 
 	/* rebuild the hash table, node zero is never used. This works
 	 * because layout of file is node table then hash table,
@@ -121,17 +419,135 @@ int odb_grow_hashtable(odb_data_t * data)
 }
 
 
+int odb_grow_hashtable(odb_data_t * data)
+{
+	unsigned long start = get_usec();
+	int err;
+
+	if (!odb_is_bucketed(data)) {
+		err = grow_chained(data);
+	} else {
+		/* a new growing can't start before the previous one ends */
+		migrate_buckets(data, data->descr->old_left);
+		err = start_migration(data);
+		/* pairs are never moved inside the array a reader is
+		 * walking, a synchronous growing moves them all at once */
+		if (!err && grow_mode == ODB_GROW_SYNC)
+			migrate_buckets(data, data->descr->old_left);
+	}
+
+	if (!err)
+		__sync_fetch_and_add(&grow_stat.nr_grow, 1);
+	__sync_fetch_and_add(&grow_stat.usec, get_usec() - start);
+
+	return err;
+}
+
+
+int odb_presize(odb_t * odb, odb_node_nr_t nr_node)
+{
+	odb_data_t * data = odb->data;
+	odb_node_nr_t size = data->descr->size;
+	unsigned int old_file_size;
+	unsigned int new_file_size;
+	void * new_map;
+
+	if (data->descr->current_size != 1)
+		return 0;
+
+	if (odb_is_bucketed(data)) {
+		while (odb_bucket_capacity(size) < nr_node)
+			size *= 2;
+	} else {
+		/* add_node() grows when current_size reaches size */
+		while (size <= nr_node)
+			size *= 2;
+	}
+
+	if (size == data->descr->size)
+		return 0;
+
+	old_file_size = data->map_size;
+	new_file_size = tables_size(data, size);
+
+	if (ftruncate(data->fd, new_file_size))
+		return 1;
+
+	new_map = mremap(data->base_memory,
+			 old_file_size, new_file_size, MREMAP_MAYMOVE);
+
+	if (new_map == MAP_FAILED)
+		return 1;
+
+	/* the file is empty so the old table and the grown part are zeroed,
+	 * nothing to rehash */
+	account_mapped(old_file_size, new_file_size);
+	data->base_memory = new_map;
+	data->map_size = new_file_size;
+	data->descr = odb_to_descr(data);
+	data->descr->size = size;
+	if (odb_is_bucketed(data)) {
+		setup_buckets(data);
+	} else {
+		data->node_base = odb_to_node_base(data);
+		data->hash_base = odb_to_hash_base(data);
+		data->hash_mask = (data->descr->size * BUCKET_FACTOR) - 1;
+	}
+	resize_dirty(data, new_file_size);
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+
+	return 0;
+}
+
+
 void odb_init(odb_t * odb)
 {
 	odb->data = NULL;
 }
 
 
+/** log2 of the system page size */
+static unsigned int page_shift(void)
+{
+	static unsigned int shift;
+	long size;
+
+	if (!shift) {
+		size = sysconf(_SC_PAGESIZE);
+		if (size <= 0)
+			size = 4096;
+		for (shift = 0; (1L << shift) < size; ++shift)
+			;
+	}
+
+	return shift;
+}
+
+
+static enum odb_layout create_layout = ODB_LAYOUT_BUCKET;
+static enum odb_hash create_hash = ODB_HASH_MIX;
+
+void odb_set_layout(enum odb_layout layout)
+{
+	create_layout = layout;
+}
+
+
+void odb_set_hash(enum odb_hash hash)
+{
+	create_hash = hash;
+}
+
+
 /* the default number of page, calculated to fit in 4096 bytes */
 #define DEFAULT_NODE_NR(offset_node)	128
+/* same thing for a bucketed file, nr of bucket */
+#define DEFAULT_BUCKET_NR		32
 #define FILES_HASH_SIZE                 512
 
 static struct list_head files_hash[FILES_HASH_SIZE];
+/** protect files_hash, ref_count and usage.nr_file */
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 static void init_hash()
@@ -163,23 +579,116 @@ find_samples_data(size_t hash, char const * filename)
 }
 
 
+/** copy the fields of a bucketed file state in the reverse order
+ * start_migration() writes them */
+static void read_descr(odb_descr_t * dest, odb_descr_t volatile const * src)
+{
+	dest->base = src->base;
+	__sync_synchronize();
+	dest->size = src->size;
+	__sync_synchronize();
+	dest->old_left = src->old_left;
+	__sync_synchronize();
+	dest->old_base = src->old_base;
+	dest->current_size = src->current_size;
+	dest->layout = src->layout;
+	dest->hash = src->hash;
+}
+
+
+/**
+ * copy the state of a bucketed file, the writer can grow it meanwhile.
+ * The copy has the last growing not published, fully published or with
+ * old_left or old_left and size published, which is also the state left
+ * by a crash during the publication. Its publication is then completed.
+ */
+static void read_bucket_state(odb_descr_t * dest, odb_descr_t const * src)
+{
+	odb_descr_t check;
+
+	/* until the same state is read twice, a reader could otherwise
+	 * read old_left after a growing and size before it */
+	read_descr(dest, src);
+	do {
+		check = *dest;
+		read_descr(dest, src);
+	} while (check.base != dest->base || check.size != dest->size ||
+		 check.old_left != dest->old_left ||
+		 check.old_base != dest->old_base);
+
+	if (dest->old_left && dest->size < dest->old_left * 2)
+		dest->size = dest->old_left * 2;
+	if (dest->old_left)
+		dest->base = dest->size;
+}
+
+
+/**
+ * check the state of an existing bucketed file once mapped. A reader uses
+ * a copy of the state as the file can be grown meanwhile, a writer
+ * completes the publication of a growing stopped by a crash.
+ */
+static int open_buckets(odb_data_t * data, enum odb_rw rw)
+{
+	odb_descr_t * descr = odb_to_descr(data);
+	odb_descr_t * state = &data->descr_copy;
+	size_t nr_bucket;
+
+	if (data->map_size < data->offset_bucket)
+		return EINVAL;
+
+	read_bucket_state(state, descr);
+
+	/* the end of the file is unused if it couldn't be truncated after
+	 * a growing */
+	nr_bucket = (data->map_size - data->offset_bucket) /
+		sizeof(odb_bucket_t);
+	if (!state->size || (state->size & (state->size - 1)) ||
+	    state->base > nr_bucket || state->size > nr_bucket - state->base)
+		return EINVAL;
+
+	if (state->old_left) {
+		if (state->old_left > state->size / 2 ||
+		    state->old_base > state->base - state->size / 2)
+			return EINVAL;
+	} else if (state->base && state->base != state->size) {
+		return EINVAL;
+	}
+
+	if (rw == ODB_RDONLY) {
+		data->descr = state;
+		return 0;
+	}
+
+	descr->size = state->size;
+	descr->base = state->base;
+	data->descr = descr;
+
+	return 0;
+}
+
+
 int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 	     size_t sizeof_header)
 {
 	struct stat stat_buf;
 	odb_node_nr_t nr_node;
+	size_t map_size;
 	odb_data_t * data;
 	size_t hash;
+	int layout;
 	int err = 0;
 
 	int flags = (rw == ODB_RDWR) ? (O_CREAT | O_RDWR) : O_RDONLY;
 	int mmflags = (rw == ODB_RDWR) ? (PROT_READ | PROT_WRITE) : PROT_READ;
 
 	hash = op_hash_string(filename) % FILES_HASH_SIZE;
+	pthread_mutex_lock(&files_lock);
 	data = find_samples_data(hash, filename);
 	if (data) {
 		odb->data = data;
 		data->ref_count++;
+		pthread_mutex_unlock(&files_lock);
 		return 0;
 	}
 
@@ -187,6 +696,8 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 	memset(data, '\0', sizeof(odb_data_t));
 	list_init(&data->list);
 	data->offset_node = sizeof_header + sizeof(odb_descr_t);
+	data->offset_bucket = (data->offset_node + ODB_BUCKET_ALIGN - 1) &
+		~(ODB_BUCKET_ALIGN - 1);
 	data->sizeof_header = sizeof_header;
 	data->ref_count = 1;
 	data->filename = xstrdup(filename);
@@ -197,46 +708,96 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 		goto out;
 	}
 
+	/* see compact_buckets() */
+	if (rw == ODB_RDONLY && flock(data->fd, LOCK_SH)) {
+		err = errno;
+		goto fail;
+	}
+
 	if (fstat(data->fd, &stat_buf)) {
 		err = errno;
 		goto fail;
 	}
 
-	if (stat_buf.st_size == 0) {
-		size_t file_size;
+remap:
 
+	if (stat_buf.st_size == 0) {
 		if (rw == ODB_RDONLY) {
 			err = EIO;
 			goto fail;
 		}
 
-		nr_node = DEFAULT_NODE_NR(data->offset_node);
+		layout = create_layout;
+		if (layout == ODB_LAYOUT_BUCKET)
+			nr_node = DEFAULT_BUCKET_NR;
+		else
+			nr_node = DEFAULT_NODE_NR(data->offset_node);
 
-		file_size = tables_size(data, nr_node);
-		if (ftruncate(data->fd, file_size)) {
+		map_size = layout_size(data, layout, nr_node);
+		if (ftruncate(data->fd, map_size)) {
 			err = errno;
 			goto fail;
 		}
 	} else {
-		/* Calculate nr node allowing a sanity check later */
-		nr_node = (stat_buf.st_size - data->offset_node) /
-			((sizeof(odb_index_t) * BUCKET_FACTOR) + sizeof(odb_node_t));
+		odb_descr_t descr;
+
+		/* we need the layout before mapping the file */
+		if (pread(data->fd, &descr, sizeof(descr), sizeof_header) !=
+		    sizeof(descr)) {
+			err = EINVAL;
+			goto fail;
+		}
+
+		if (descr.hash != ODB_HASH_XOR && descr.hash != ODB_HASH_MIX) {
+			err = EINVAL;
+			goto fail;
+		}
+
+		layout = descr.layout;
+		if (layout == ODB_LAYOUT_BUCKET) {
+			/* checked by open_buckets() once mapped */
+			nr_node = 0;
+			map_size = stat_buf.st_size;
+		} else if (layout == ODB_LAYOUT_CHAINED) {
+			/* Calculate nr node allowing a sanity check later */
+			nr_node = (stat_buf.st_size - data->offset_node) /
+				((sizeof(odb_index_t) * BUCKET_FACTOR) +
+				 sizeof(odb_node_t));
+			map_size = layout_size(data, layout, nr_node);
+		} else {
+			err = EINVAL;
+			goto fail;
+		}
 	}
 
-	data->base_memory = mmap(0, tables_size(data, nr_node), mmflags,
-				MAP_SHARED, data->fd, 0);
+	data->base_memory = mmap(0, map_size, mmflags, MAP_SHARED, data->fd, 0);
 
 	if (data->base_memory == MAP_FAILED) {
 		err = errno;
 		goto fail;
 	}
 
+	data->map_size = map_size;
 	data->descr = odb_to_descr(data);
 
 	if (stat_buf.st_size == 0) {
 		data->descr->size = nr_node;
 		/* page zero is not used */
 		data->descr->current_size = 1;
+		data->descr->layout = layout;
+		data->descr->hash = create_hash;
+	} else if (layout == ODB_LAYOUT_BUCKET) {
+		err = open_buckets(data, rw);
+		if (err) {
+			munmap(data->base_memory, map_size);
+			/* a read only file can be grown after fstat() */
+			if (rw == ODB_RDONLY && !fstat(data->fd, &stat_buf) &&
+			    (size_t)stat_buf.st_size > map_size) {
+				err = 0;
+				goto remap;
+			}
+			goto fail;
+		}
 	} else {
 		/* file already exist, sanity check nr node */
 		if (nr_node != data->descr->size) {
@@ -245,16 +806,39 @@ int odb_open(odb_t * odb, char const * filename, enum odb_rw rw,
 		}
 	}
 
-	data->hash_base = odb_to_hash_base(data);
-	data->node_base = odb_to_node_base(data);
-	data->hash_mask = (data->descr->size * BUCKET_FACTOR) - 1;
+	if (layout == ODB_LAYOUT_BUCKET) {
+		setup_buckets(data);
+	} else {
+		data->hash_base = odb_to_hash_base(data);
+		data->node_base = odb_to_node_base(data);
+		data->hash_mask = (data->descr->size * BUCKET_FACTOR) - 1;
+	}
+
+	if (rw == ODB_RDWR) {
+		data->page_shift = page_shift();
+		resize_dirty(data, map_size);
+		/* a new file is written by this process up to now */
+		if (stat_buf.st_size == 0)
+			mark_all_dirty(data);
+	}
+
+	if (rw == ODB_RDWR && layout == ODB_LAYOUT_BUCKET) {
+		/* a crash can have stopped the move of this bucket */
+		if (data->descr->old_left)
+			move_bucket(data, 1);
+		compact_buckets(data);
+	}
+
+	++usage.nr_file;
+	account_mapped(0, map_size);
 
 	list_add(&data->list, &files_hash[hash]);
 	odb->data = data;
 out:
+	pthread_mutex_unlock(&files_lock);
 	return err;
 fail_unmap:
-	munmap(data->base_memory, tables_size(data, nr_node));
+	munmap(data->base_memory, map_size);
 fail:
 	close(data->fd);
 	free(data->filename);
@@ -267,15 +851,26 @@ fail:
 void odb_close(odb_t * odb)
 {
 	odb_data_t * data = odb->data;
+	int last;
 
 	if (data) {
-		data->ref_count--;
-		if (data->ref_count == 0) {
-			size_t size = tables_size(data, data->descr->size);
+		pthread_mutex_lock(&files_lock);
+		last = --data->ref_count == 0;
+		if (last) {
 			list_del(&data->list);
-			munmap(data->base_memory, size);
+			--usage.nr_file;
+		}
+		pthread_mutex_unlock(&files_lock);
+
+		if (last) {
+			/* the last chance to give back the unused space */
+			if (data->dirty && odb_is_bucketed(data))
+				compact_buckets(data);
+			munmap(data->base_memory, data->map_size);
+			account_mapped(data->map_size, 0);
 			if (data->fd >= 0)
 				close(data->fd);
+			free(data->dirty);
 			free(data->filename);
 			free(data);
 			odb->data = NULL;
@@ -294,18 +889,82 @@ int odb_open_count(odb_t const * odb)
 
 void * odb_get_data(odb_t * odb)
 {
+	/* the caller is likely to update its header */
+	odb_mark_dirty(odb->data, odb->data->base_memory,
+		       odb->data->offset_node);
 	return odb->data->base_memory;
 }
 
 
-void odb_sync(odb_t const * odb)
+int odb_is_dirty(odb_t const * odb)
+{
+	return odb->data && odb->data->nr_dirty;
+}
+
+
+/** msync the pages [first, last) of a file, return the nr of bytes synced */
+static size_t sync_pages(odb_data_t * data, size_t first, size_t last,
+			 size_t map_size)
+{
+	size_t start = first << data->page_shift;
+	size_t end = last << data->page_shift;
+
+	if (end > map_size)
+		end = map_size;
+	msync((char *)data->base_memory + start, end - start, MS_ASYNC);
+
+	return end - start;
+}
+
+
+size_t odb_sync(odb_t const * odb)
 {
 	odb_data_t * data = odb->data;
-	size_t size;
+	size_t map_size;
+	size_t synced = 0;
+	size_t first = 0;
+	size_t page;
 
 	if (!data)
-		return;
+		return 0;
+
+	/* a reader could prevent it when the last growing ended */
+	if (data->dirty && odb_is_bucketed(data))
+		compact_buckets(data);
+
+	if (!data->nr_dirty)
+		return 0;
+
+	map_size = data->map_size;
+
+	/* one msync per run of dirty pages */
+	for (page = 0; page < data->nr_page; ++page) {
+		unsigned long * word = &data->dirty[page / ODB_DIRTY_BITS];
+		unsigned long bit = 1UL << (page % ODB_DIRTY_BITS);
+
+		if (!*word && !(page % ODB_DIRTY_BITS)) {
+			if (first != page)
+				synced += sync_pages(data, first, page,
+						     map_size);
+			page += ODB_DIRTY_BITS - 1;
+			first = page + 1;
+			continue;
+		}
+
+		if (*word & bit)
+			continue;
+
+		if (first != page)
+			synced += sync_pages(data, first, page, map_size);
+		first = page + 1;
+	}
+
+	if (first < data->nr_page)
+		synced += sync_pages(data, first, data->nr_page, map_size);
+
+	memset(data->dirty, '\0', ((data->nr_page + ODB_DIRTY_BITS - 1) /
+				   ODB_DIRTY_BITS) * sizeof(unsigned long));
+	data->nr_dirty = 0;
 
-	size = tables_size(data, data->descr->size);
-	msync(data->base_memory, size, MS_ASYNC);
+	return synced;
 }
@@ -23,8 +23,21 @@ struct odb_hash_stat_t {
 	odb_node_nr_t max_list_length;		/**< worst case   */
 	double       average_list_length;	/**< average case */
 	/* do we need variance ? */
+	/** nr of list of each length, the last entry gather longer list.
+	 * For a bucketed file nr of key found after probing n buckets */
+	odb_node_nr_t histogram[ODB_HISTOGRAM_SIZE];
+	int layout;				/**< enum odb_layout */
+	int hash;				/**< enum odb_hash */
 };
 
+
+static void add_to_histogram(odb_hash_stat_t * result, size_t length)
+{
+	if (length >= ODB_HISTOGRAM_SIZE)
+		length = ODB_HISTOGRAM_SIZE - 1;
+	result->histogram[length]++;
+}
+
 odb_hash_stat_t * odb_hash_stat(odb_t const * odb)
 {
 	size_t max_length = 0;
@@ -42,10 +55,48 @@ odb_hash_stat_t * odb_hash_stat(odb_t const * odb)
 	result->node_nr = data->descr->size;
 	result->used_node_nr = data->descr->current_size;
 	result->hash_table_size = data->descr->size * BUCKET_FACTOR;
+	result->layout = data->descr->layout;
+	result->hash = data->descr->hash;
 
 	/* FIXME: I'm dubious if this do right statistics for hash table
 	 * efficiency check */
 
+	if (odb_is_bucketed(data)) {
+		/* for a bucketed file a list is the probe sequence of a key:
+		 * the nr of bucket visited to find it */
+		odb_node_nr_t size = data->descr->size;
+
+		result->hash_table_size = size;
+		/* then the not yet migrated part of the previous array */
+		for (pos = 0 ; pos < size + data->descr->old_left ; ++pos) {
+			odb_bucket_t const * bucket;
+			odb_hash_mask_t mask = data->hash_mask;
+			size_t slot = pos;
+			unsigned int i;
+
+			if (pos < size) {
+				bucket = &data->bucket_base[pos];
+			} else {
+				slot = pos - size;
+				bucket = &data->old_bucket_base[slot];
+				mask = size / 2 - 1;
+			}
+
+			for (i = 0 ; i < bucket->nr_used ; ++i) {
+				size_t index =
+					odb_hash_key(data, bucket->key[i]) & mask;
+				size_t cur_length = ((slot - index) & mask) + 1;
+				result->total_count += bucket->value[i];
+				if (cur_length > max_length)
+					max_length = cur_length;
+				total_length += cur_length;
+				++nr_non_empty_list;
+				add_to_histogram(result, cur_length);
+			}
+		}
+		goto out;
+	}
+
 	for (pos = 0 ; pos < result->hash_table_size ; ++pos) {
 		size_t cur_length = 0;
 		size_t index = data->hash_base[pos];
@@ -58,12 +109,15 @@ odb_hash_stat_t * odb_hash_stat(odb_t const * odb)
 		if (cur_length > max_length)
 			max_length = cur_length;
 
+		add_to_histogram(result, cur_length);
+
 		if (cur_length) {
 			total_length += cur_length;
 			++nr_non_empty_list;
 		}
 	}
 
+out:
 	result->max_list_length = max_length;
 	result->average_list_length = total_length / nr_non_empty_list;
 
@@ -71,6 +125,32 @@ odb_hash_stat_t * odb_hash_stat(odb_t const * odb)
 }
 
 
+static void display_histogram(odb_hash_stat_t const * stat)
+{
+	size_t i;
+	odb_node_nr_t total = 0;
+	int bucketed = stat->layout == ODB_LAYOUT_BUCKET;
+
+	for (i = 0; i < ODB_HISTOGRAM_SIZE; ++i)
+		total += stat->histogram[i];
+
+	printf("layout:              %s\n", bucketed ? "bucket" : "chained");
+	printf("hash function:       %s\n",
+	       stat->hash == ODB_HASH_MIX ? "mix" : "xor");
+	printf("%s histogram:\n",
+	       bucketed ? "probe length (bucket nr)" : "list length");
+
+	for (i = 0; i < ODB_HISTOGRAM_SIZE; ++i) {
+		if (!stat->histogram[i])
+			continue;
+		printf("%6lu%s %10u %6.2f%%\n", (unsigned long)i,
+		       i == ODB_HISTOGRAM_SIZE - 1 ? "+" : " ",
+		       stat->histogram[i],
+		       (100.0 * stat->histogram[i]) / total);
+	}
+}
+
+
 void odb_hash_display_stat(odb_hash_stat_t const * stat)
 {
 	printf("total node number:   %d\n", stat->node_nr);
@@ -79,6 +159,7 @@ void odb_hash_display_stat(odb_hash_stat_t const * stat)
 	printf("hash table size:     %d\n", stat->hash_table_size);
 	printf("greater list length: %d\n", stat->max_list_length);
 	printf("average non empty list length: %2.4f\n", stat->average_list_length);
+	display_histogram(stat);
 }
 
 
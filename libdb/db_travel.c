@@ -12,7 +12,99 @@
 
 odb_node_t * odb_get_iterator(odb_t const * odb, odb_node_nr_t * nr)
 {
+	if (odb_is_bucketed(odb->data)) {
+		*nr = 0;
+		return NULL;
+	}
+
 	/* node zero is unused */
 	*nr = odb->data->descr->current_size - 1;
 	return odb->data->node_base + 1;
 }
+
+
+odb_node_nr_t odb_get_node_nr(odb_t const * odb)
+{
+	/* node zero is unused */
+	return odb->data->descr->current_size - 1;
+}
+
+
+void odb_iterator_init(odb_iterator_t * it, odb_t const * odb)
+{
+	it->data = odb->data;
+	/* node zero is unused */
+	it->pos = odb_is_bucketed(odb->data) ? 0 : 1;
+	it->slot = 0;
+}
+
+
+int odb_iterator_next(odb_iterator_t * it, odb_key_t * key,
+                      odb_value_t * value)
+{
+	odb_data_t const * data = it->data;
+
+	if (!odb_is_bucketed(data)) {
+		if (it->pos >= data->descr->current_size)
+			return 0;
+		*key = data->node_base[it->pos].key;
+		*value = data->node_base[it->pos].value;
+		++it->pos;
+		return 1;
+	}
+
+	/* the current array then the not yet migrated part of the previous
+	 * one */
+	for (; it->pos < data->descr->size + data->descr->old_left;
+	     ++it->pos, it->slot = 0) {
+		odb_bucket_t const * bucket;
+		int is_old = it->pos >= data->descr->size;
+		unsigned int slot;
+
+		if (!is_old)
+			bucket = &data->bucket_base[it->pos];
+		else
+			bucket = &data->old_bucket_base[it->pos -
+							data->descr->size];
+		while (it->slot < bucket->nr_used) {
+			*key = bucket->key[it->slot];
+			*value = bucket->value[it->slot];
+			++it->slot;
+			/* a pair is copied to the current array before its
+			 * bucket is left out of the previous one */
+			if (!is_old && data->descr->old_left &&
+			    odb_find_old_key(data, *key, &slot) <
+			    data->descr->old_left)
+				continue;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+odb_index_t odb_find_old_key(odb_data_t const * data, odb_key_t key,
+                             unsigned int * slot)
+{
+	odb_hash_mask_t mask = data->descr->size / 2 - 1;
+	odb_index_t index = odb_hash_key(data, key) & mask;
+	odb_node_nr_t nr;
+
+	/* no pair is added to the previous array but its probe sequences
+	 * go through migrated buckets, so search them too */
+	for (nr = 0; nr <= mask; ++nr) {
+		odb_bucket_t const * bucket = &data->old_bucket_base[index];
+		for (*slot = 0; *slot < bucket->nr_used; ++*slot) {
+			if (bucket->key[*slot] == key)
+				return index;
+		}
+
+		if (bucket->nr_used < ODB_BUCKET_SLOTS)
+			break;
+
+		index = (index + 1) & mask;
+	}
+
+	return ODB_NODE_NR_INVALID;
+}
@@ -45,14 +45,62 @@ typedef struct {
 	odb_index_t next;		/**< next entry for this bucket */
 } odb_node_t;
 
+/** the different way a DB file can be laid out on disk */
+enum odb_layout {
+	/** node array followed by a chained hash table of node index, this
+	 * was the only layout before odb_descr_t.layout existed so it must
+	 * stay zero */
+	ODB_LAYOUT_CHAINED = 0,
+	/** open addressing, key/value pairs are stored inline in cache line
+	 * sized buckets */
+	ODB_LAYOUT_BUCKET = 1
+};
+
+/** the hash function used to index the hash table or the bucket array */
+enum odb_hash {
+	/** xor of the low order bits, the only hash function before
+	 * odb_descr_t.hash existed so it must stay zero */
+	ODB_HASH_XOR = 0,
+	/** murmur3 finalizer, all the key bits are mixed */
+	ODB_HASH_MIX = 1
+};
+
+/** nr of key/value pairs stored in a bucket */
+#define ODB_BUCKET_SLOTS 5
+/** alignment of the bucket array, the usual cache line size */
+#define ODB_BUCKET_ALIGN 64
+
+/**
+ * a bucket of an ODB_LAYOUT_BUCKET file. Slots are filled in order so
+ * nr_used is also the index of the first free slot, a bucket is searched
+ * then the next one is probed only if this one is full.
+ */
+typedef struct {
+	odb_key_t key[ODB_BUCKET_SLOTS];	/**< eip */
+	odb_value_t value[ODB_BUCKET_SLOTS];	/**< samples count */
+	uint32_t nr_used;			/**< nr used slot */
+} odb_bucket_t;
+
 /** the minimal information which must be stored in the file to reload
  * properly the data base, following this header is the node array then
- * the hash table (when growing we avoid to copy node array)
+ * the hash table (when growing we avoid to copy node array) for a chained
+ * file or the bucket array for a bucketed file.
  */
 typedef struct {
-	odb_node_nr_t size;		/**< in node nr (power of two) */
+	odb_node_nr_t size;		/**< in node nr (power of two), in
+					 * bucket nr for a bucketed file */
 	odb_node_nr_t current_size;	/**< nr used node + 1, node 0 unused */
-	int padding[6];			/**< for padding and future use */
+	int layout;			/**< enum odb_layout */
+	int hash;			/**< enum odb_hash */
+	odb_node_nr_t base;		/**< bucketed file only, index of the
+					 * first bucket of the bucket array */
+	odb_node_nr_t old_left;		/**< bucketed file only, nr of bucket
+					 * of the previous array not yet
+					 * migrated, zero if not growing */
+	odb_node_nr_t old_base;		/**< bucketed file only, index of the
+					 * first bucket of the previous array,
+					 * meaningfull if old_left */
+	int padding[1];			/**< for padding and future use */
 } odb_descr_t;
 
 /** a "database". this is an in memory only description.
@@ -71,16 +119,55 @@ typedef struct {
  *  the node array: (descr->size * sizeof(odb_node_t) entries
  *  the hash table: array of odb_index_t indexing the node array 
  *    (descr->size * BUCKET_FACTOR) entries
+ *
+ * for an ODB_LAYOUT_BUCKET file the node array and the hash table are
+ * replaced by:
+ *  some padding up to the next ODB_BUCKET_ALIGN boundary
+ *  descr->base unused buckets, see below
+ *  the bucket array: descr->size odb_bucket_t entries
+ *
+ * A bucketed file is grown by putting a new bucket array, twice as big, at
+ * bucket descr->size * 2 and moving the pairs to it a few buckets at a
+ * time or at once, see odb_set_grow_mode(). Until descr->old_left drops to
+ * zero, the buckets [0, descr->old_left) of the previous array, the
+ * descr->size / 2 buckets from descr->old_base, hold pairs not yet moved.
+ * The bucket array is then copied to the start, which it can't overlap,
+ * and base is reset to zero. So base is zero or descr->size, and always
+ * descr->size while growing.
+ *
+ * A crash or a reader never sees a half updated file: a new bucket array
+ * is filled before being published through descr and an unpublished one
+ * is not overwritten while a reader can walk it. The exceptions are: a
+ * growing publishes old_left, size then base, a file opened while it is
+ * partly published sees it fully published; a moved bucket is in both
+ * arrays until old_left is decremented, readers skip its copy in the new
+ * array and odb_open() for writing moves it again. A file opened read
+ * only is locked shared until odb_close(), the bucket array is copied to
+ * the start and the file truncated only when no reader holds the lock.
  */
 typedef struct odb_data {
 	odb_node_t * node_base;		/**< base memory area of the page */
 	odb_index_t * hash_base;	/**< base memory of hash table */
+	odb_bucket_t * bucket_base;	/**< base memory of bucket array */
+	odb_bucket_t * old_bucket_base;	/**< previous bucket array, only
+					 * meaningfull if descr->old_left */
 	odb_descr_t * descr;		/**< the current state of database */
+	odb_descr_t descr_copy;		/**< the state of a bucketed file
+					 * opened read only, descr points here
+					 * as the file can be grown meanwhile */
 	odb_hash_mask_t hash_mask;	/**< == descr->size - 1 */
 	unsigned int sizeof_header;	/**< from base_memory to odb header */
 	unsigned int offset_node;	/**< from base_memory to node array */
+	unsigned int offset_bucket;	/**< from base_memory to bucket array */
 	void * base_memory;		/**< base memory of the maped memory */
+	size_t map_size;		/**< nr of bytes mapped */
 	int fd;				/**< mmaped memory file descriptor */
+	unsigned long * dirty;		/**< bitmap of the pages written since
+					 * the last odb_sync(), NULL for a
+					 * read only file */
+	size_t nr_page;			/**< nr of pages covered by dirty */
+	size_t nr_dirty;		/**< nr of bits set in dirty */
+	unsigned int page_shift;	/**< log2 of the page size */
 	char * filename;                /**< full path name of sample file */
 	int ref_count;                  /**< reference count */
 	struct list_head list;          /**< hash bucket list */
@@ -117,12 +204,91 @@ void odb_init(odb_t * odb);
  *
  * The sizeof_header parameter allows the data file to have a header
  * at the start of the file which is skipped.
- * odb_open() always preallocate a few number of pages.
+ * odb_open() always preallocate a few number of pages. odb_open() and
+ * odb_close() can be called from several threads, the other functions
+ * can be used concurrently on distinct files only. Opening for read only
+ * waits while the writer of the file copies its bucket array.
  * returns 0 on success, errno on failure
  */
 int odb_open(odb_t * odb, char const * filename,
              enum odb_rw rw, size_t sizeof_header);
 
+/**
+ * odb_set_layout - choose the layout of files created by odb_open()
+ * @param layout \enum ODB_LAYOUT_CHAINED or \enum ODB_LAYOUT_BUCKET
+ *
+ * Existing files are always opened with the layout they were created
+ * with, this only affects new files. Default is ODB_LAYOUT_BUCKET.
+ */
+void odb_set_layout(enum odb_layout layout);
+
+/**
+ * odb_set_hash - choose the hash function of files created by odb_open()
+ * @param hash \enum ODB_HASH_XOR or \enum ODB_HASH_MIX
+ *
+ * As for odb_set_layout() existing files keep the hash function they were
+ * created with. Default is ODB_HASH_MIX.
+ */
+void odb_set_hash(enum odb_hash hash);
+
+/** how a bucketed file is grown */
+enum odb_grow_mode {
+	/** move all the pairs to the new bucket array when the file is
+	 * grown */
+	ODB_GROW_SYNC = 0,
+	/** the new bucket array is filled a few buckets at a time by the
+	 * next updates, avoiding a long stall on a big file */
+	ODB_GROW_INCREMENTAL = 1
+};
+
+/**
+ * odb_set_grow_mode - choose how bucketed files are grown by this process
+ * @param mode \enum ODB_GROW_SYNC or \enum ODB_GROW_INCREMENTAL
+ *
+ * A file needs room for both bucket arrays until all pairs are moved, at
+ * once or incrementally. Chained files are always grown synchronously.
+ * Default is ODB_GROW_SYNC.
+ */
+void odb_set_grow_mode(enum odb_grow_mode mode);
+
+/**
+ * statistics about file growing, cumulated over all files of a process.
+ * They are updated atomically, files can be grown by several threads.
+ */
+struct odb_grow_stat {
+	unsigned long nr_grow;		/**< nr of odb_grow_hashtable() */
+	unsigned long nr_migrated;	/**< nr of bucket migrated */
+	unsigned long usec;		/**< time spent growing, in usec */
+};
+
+/** return the growing statistics since the start of the process */
+void odb_get_grow_stat(struct odb_grow_stat * stat);
+
+/** resources used by the DB files opened by a process */
+struct odb_usage {
+	unsigned long nr_file;		/**< nr of DB files opened */
+	size_t mapped;			/**< nr of bytes mapped */
+};
+
+/**
+ * return the resources used by the DB files currently opened. Files can
+ * be grown by several threads, the mapped size is updated atomically.
+ */
+void odb_get_usage(struct odb_usage * usage);
+
+/**
+ * odb_presize - size an empty DB file to hold nr_node keys
+ * @param odb the DB file, opened with ODB_RDWR
+ * @param nr_node the expected nr of key
+ *
+ * Growing a file step by step from its initial size is costly, when the
+ * final size can be guessed it can be reached at once with this call.
+ * Nothing is done if the file is not empty or already big enough.
+ * returns 0 on success, non zero on failure, the file is unchanged in
+ * this case.
+ */
+int odb_presize(odb_t * odb, odb_node_nr_t nr_node);
+
 /** Close the given ODB file */
 void odb_close(odb_t * odb);
 
@@ -132,8 +298,14 @@ int odb_open_count(odb_t const * odb);
 /** return the start of the mapped data */
 void * odb_get_data(odb_t * odb);
 
-/** issue a msync on the used size of the mmaped file */
-void odb_sync(odb_t const * odb);
+/**
+ * issue a msync on the pages of the mmaped file written since the last
+ * call, return the nr of bytes synced
+ */
+size_t odb_sync(odb_t const * odb);
+
+/** return non zero if the file has been written since the last odb_sync() */
+int odb_is_dirty(odb_t const * odb);
 
 /**
  * grow the hashtable in such way current_size is the index of the first free
@@ -150,12 +322,65 @@ void odb_sync(odb_t const * odb);
  * after cleanup some program resource.
  */
 int odb_grow_hashtable(odb_data_t * data);
+
+/** nr of bucket migrated by a call to odb_update_node() when growing */
+#define ODB_MIGRATE_STEP 2
+
+/**
+ * move at most nr bucket from the previous bucket array to the current one
+ * while a bucketed file is incrementally grown. Bucket pointers are
+ * invalidated when the last bucket is moved. This can't fail.
+ */
+void odb_migrate_buckets(odb_data_t * data, odb_node_nr_t nr);
+
+/** nr of pages tracked by an entry of odb_data_t.dirty */
+#define ODB_DIRTY_BITS (sizeof(unsigned long) * 8)
+
+/**
+ * record that len bytes at addr, inside the mapped file, have been written
+ * so the next odb_sync() msyncs their pages. len must not be zero. Nothing
+ * is recorded for a read only file.
+ */
+static __inline void
+odb_mark_dirty(odb_data_t * data, void const * addr, size_t len)
+{
+	size_t offset;
+	size_t page;
+	size_t last;
+
+	if (!data->dirty)
+		return;
+
+	offset = (char const *)addr - (char const *)data->base_memory;
+	last = (offset + len - 1) >> data->page_shift;
+	for (page = offset >> data->page_shift; page <= last; ++page) {
+		unsigned long * word = &data->dirty[page / ODB_DIRTY_BITS];
+		unsigned long bit = 1UL << (page % ODB_DIRTY_BITS);
+		if (!(*word & bit)) {
+			*word |= bit;
+			++data->nr_dirty;
+		}
+	}
+}
+
 /**
  * commit a previously successfull node reservation. This can't fail.
+ * Only meaningfull for an ODB_LAYOUT_CHAINED file.
  */
 static __inline void odb_commit_reservation(odb_data_t * data)
 {
 	++data->descr->current_size;
+	odb_mark_dirty(data, data->descr, sizeof(odb_descr_t));
+}
+
+/**
+ * nr of key/value pairs a bucketed file of nr_bucket buckets can hold before
+ * it must be grown. Linear probing degrades quickly near a full table,
+ * growing at 3/4 keeps the probe sequence short.
+ */
+static __inline odb_node_nr_t odb_bucket_capacity(odb_node_nr_t nr_bucket)
+{
+	return (nr_bucket * ODB_BUCKET_SLOTS / 4) * 3;
 }
 
 /** "immpossible" node number to indicate an error from odb_hash_add_node() */
@@ -166,6 +391,9 @@ static __inline void odb_commit_reservation(odb_data_t * data)
 int odb_check_hash(odb_t const * odb);
 
 /* db_stat.c */
+/** nr of entries in the list length histogram of odb_hash_stat_t */
+#define ODB_HISTOGRAM_SIZE 16
+
 typedef struct odb_hash_stat_t odb_hash_stat_t;
 odb_hash_stat_t * odb_hash_stat(odb_t const * odb);
 void odb_hash_display_stat(odb_hash_stat_t const * stats);
@@ -214,22 +442,105 @@ int odb_add_node(odb_t * odb, odb_key_t key, odb_value_t value);
  *
  *  note than caller does not need to filter nil key as it's a valid key,
  * The returned range is all valid (i.e. should never contain zero value).
+ * A bucketed file has no node array, NULL is returned and *nr is zero.
  */
 odb_node_t * odb_get_iterator(odb_t const * odb, odb_node_nr_t * nr);
 
+/** return the nr of key stored in this DB */
+odb_node_nr_t odb_get_node_nr(odb_t const * odb);
+
+/** iteration state used by odb_iterator_next() */
+typedef struct {
+	odb_data_t const * data;	/**< the DB we iterate over */
+	odb_index_t pos;		/**< current node or bucket */
+	unsigned int slot;		/**< current slot in bucket */
+} odb_iterator_t;
+
+/**
+ * odb_get_iterator() works only for a chained file, the following
+ * iterate through all key/value pairs whatever is the file layout:
+ *
+ * odb_iterator_t it;
+ * odb_key_t key;
+ * odb_value_t value;
+ * odb_iterator_init(&it, odb);
+ * while (odb_iterator_next(&it, &key, &value))
+ *	// do something
+ *
+ * The same remark as for odb_get_iterator() about nil key and zero value
+ * apply. Pairs are returned in no particular order.
+ */
+void odb_iterator_init(odb_iterator_t * it, odb_t const * odb);
+
+/** return non zero and fill key and value if a pair remains */
+int odb_iterator_next(odb_iterator_t * it, odb_key_t * key,
+                      odb_value_t * value);
+
+/**
+ * search key in the previous bucket array of a bucketed file being grown,
+ * return the index of its bucket and set *slot, ODB_NODE_NR_INVALID if not
+ * found. A key found in a migrated bucket, at or after descr->old_left, is
+ * stale.
+ */
+odb_index_t odb_find_old_key(odb_data_t const * data, odb_key_t key,
+                             unsigned int * slot);
+
+/** return non zero if this DB use the ODB_LAYOUT_BUCKET layout */
+static __inline int odb_is_bucketed(odb_data_t const * data)
+{
+	return data->descr->layout == ODB_LAYOUT_BUCKET;
+}
+
+/** return the hash of a key, not yet masked by a table size */
 static __inline unsigned int
-odb_do_hash(odb_data_t const * data, odb_key_t value)
+odb_hash_key(odb_data_t const * data, odb_key_t value)
 {
-	/* FIXME: better hash for eip value, needs to instrument code
-	 * and do a lot of tests ... */
+	uint32_t temp;
+
+	/* the hash function is recorded in the file, hash table are stored
+	 * in files avoiding to rebuilding them at profiling re-start so on
+	 * adding a new hash function add a new enum odb_hash value.
+	 */
+	if (data->descr->hash == ODB_HASH_MIX) {
+		/* all bits of the key affect the low order bits, cg keys are
+		 * from << 32 | to and must hash on both halves */
+		value ^= value >> 33;
+		value *= 0xff51afd7ed558ccdULL;
+		value ^= value >> 33;
+		value *= 0xc4ceb9fe1a85ec53ULL;
+		value ^= value >> 33;
+		return value;
+	}
+
 	/* trying to combine high order bits his a no-op: inside a binary image
 	 * high order bits don't vary a lot, hash table start with 7 bits mask
-	 * so this hash coding use bits 0-7, 8-15. Hash table is stored in
-	 * files avoiding to rebuilding them at profiling re-start so
-	 * on changing do_hash() change the file format!
+	 * so this hash coding use bits 0-7, 8-15.
 	 */
-	uint32_t temp = value & 0xffffffff;
-	return ((temp << 0) ^ (temp >> 8)) & data->hash_mask;
+	temp = value & 0xffffffff;
+	return (temp << 0) ^ (temp >> 8);
+}
+
+
+static __inline unsigned int
+odb_do_hash(odb_data_t const * data, odb_key_t value)
+{
+	return odb_hash_key(data, value) & data->hash_mask;
+}
+
+/**
+ * return the first bucket with a free slot in the probe sequence of key,
+ * caller must ensure the key is not already in the table and the table is
+ * not full.
+ */
+static __inline odb_bucket_t *
+odb_free_bucket(odb_data_t const * data, odb_key_t key)
+{
+	odb_index_t index = odb_do_hash(data, key);
+
+	while (data->bucket_base[index].nr_used == ODB_BUCKET_SLOTS)
+		index = (index + 1) & data->hash_mask;
+
+	return &data->bucket_base[index];
 }
 
 #ifdef __cplusplus
@@ -9,12 +9,14 @@
  */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include "op_sample_file.h"
 #include "odb.h"
@@ -78,9 +80,19 @@ static void do_speed_test(void)
 
 	for (i = 100000; i <= 10000000; i *= 10) {
 		// first test count insertion, second fetch and incr count
-		speed_test(i, "insert");
-		speed_test(i, "update");
+		odb_set_layout(ODB_LAYOUT_CHAINED);
+		speed_test(i, "chained insert");
+		speed_test(i, "chained update");
 		remove(TEST_FILENAME);
+		odb_set_layout(ODB_LAYOUT_BUCKET);
+		speed_test(i, "bucket insert");
+		speed_test(i, "bucket update");
+		remove(TEST_FILENAME);
+		odb_set_grow_mode(ODB_GROW_INCREMENTAL);
+		speed_test(i, "bucket incremental insert");
+		speed_test(i, "bucket incremental update");
+		remove(TEST_FILENAME);
+		odb_set_grow_mode(ODB_GROW_SYNC);
 	}
 }
 
@@ -136,6 +148,307 @@ static void do_test(void)
 }
 
 
+/* sum of all values through the layout independant iterator */
+static odb_value_t total_count(odb_t const * hash)
+{
+	odb_iterator_t it;
+	odb_key_t key;
+	odb_value_t value;
+	odb_value_t total = 0;
+
+	odb_iterator_init(&it, hash);
+	while (odb_iterator_next(&it, &key, &value))
+		total += value;
+
+	return total;
+}
+
+
+/* a file keeps the layout and hash function it was created with */
+static int test_layout_compat(enum odb_layout create, enum odb_layout reopen,
+                              enum odb_hash hash_type)
+{
+	int i;
+	odb_t hash;
+	int ret = 0;
+	int rc;
+
+	odb_set_layout(create);
+	odb_set_hash(hash_type);
+	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s", strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0 ; i < 5000 ; ++i)
+		odb_update_node(&hash, i % 1000);
+	odb_close(&hash);
+
+	odb_set_layout(reopen);
+	odb_set_hash(hash_type == ODB_HASH_MIX ? ODB_HASH_XOR : ODB_HASH_MIX);
+	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s", strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0 ; i < 5000 ; ++i)
+		odb_update_node(&hash, i % 2000);
+
+	if (hash.data->descr->layout != (int)create ||
+	    hash.data->descr->hash != (int)hash_type ||
+	    hash.data->descr->current_size != 2001 ||
+	    total_count(&hash) != 10000 || odb_check_hash(&hash))
+		ret = 1;
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+
+	return ret;
+}
+
+
+/* a file incrementally grown must be usable at any step of the migration,
+ * including after a close/reopen in the middle of it */
+static int test_incremental_grow(void)
+{
+	odb_t hash;
+	int ret = 0;
+	int seen_migration = 0;
+	struct stat st;
+	int i;
+	int rc;
+
+	odb_set_layout(ODB_LAYOUT_BUCKET);
+	odb_set_grow_mode(ODB_GROW_INCREMENTAL);
+
+	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s", strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0 ; i < 20000 ; ++i) {
+		odb_update_node(&hash, (i * 7) % 5000);
+		if (!hash.data->descr->old_left)
+			continue;
+		seen_migration = 1;
+		if (total_count(&hash) != (odb_value_t)i + 1 ||
+		    odb_check_hash(&hash))
+			ret = 1;
+		if (i % 64)
+			continue;
+		odb_close(&hash);
+		rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR,
+		              sizeof(struct opd_header));
+		if (rc) {
+			fprintf(stderr, "%s", strerror(rc));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (!seen_migration || hash.data->descr->old_left ||
+	    hash.data->descr->current_size != 5001 ||
+	    total_count(&hash) != 20000 || odb_check_hash(&hash))
+		ret = 1;
+
+	/* the space of the previous arrays is given back */
+	if (stat(TEST_FILENAME, &st) || hash.data->descr->base ||
+	    (size_t)st.st_size != hash.data->offset_bucket +
+	    hash.data->descr->size * sizeof(odb_bucket_t))
+		ret = 1;
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+
+	odb_set_grow_mode(ODB_GROW_SYNC);
+
+	return ret;
+}
+
+
+/* a presized file must not grow until it holds the expected nr of key */
+static int test_presize(enum odb_layout layout)
+{
+	odb_t hash;
+	odb_node_nr_t size;
+	int ret = 0;
+	int i;
+	int rc;
+
+	odb_set_layout(layout);
+	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s", strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+
+	if (odb_presize(&hash, 50000))
+		ret = 1;
+	size = hash.data->descr->size;
+
+	for (i = 0 ; i < 50000 ; ++i)
+		odb_update_node(&hash, i);
+
+	/* no-op on a non empty file */
+	if (odb_presize(&hash, 1000000))
+		ret = 1;
+
+	if (hash.data->descr->size != size ||
+	    odb_get_node_nr(&hash) != 50000 ||
+	    total_count(&hash) != 50000 || odb_check_hash(&hash))
+		ret = 1;
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+
+	return ret;
+}
+
+
+/* odb_sync() must sync only the pages written since the previous call */
+static int test_dirty(enum odb_layout layout)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	odb_t hash;
+	int ret = 0;
+	int i;
+	int rc;
+
+	odb_set_layout(layout);
+	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s", strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+
+	/* a new file is dirty */
+	if (!odb_is_dirty(&hash) || !odb_sync(&hash))
+		ret = 1;
+	if (odb_is_dirty(&hash) || odb_sync(&hash))
+		ret = 1;
+
+	/* grows the file a few times */
+	for (i = 0 ; i < 10000 ; ++i)
+		odb_update_node(&hash, i);
+	odb_sync(&hash);
+
+	/* updating an existing key dirties only the page of its value */
+	odb_update_node(&hash, 5000);
+	if (odb_sync(&hash) != page_size)
+		ret = 1;
+
+	odb_update_node(&hash, 5000);
+	odb_close(&hash);
+
+	/* an existing file is clean when opened */
+	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s", strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+	if (odb_is_dirty(&hash) || total_count(&hash) != 10002)
+		ret = 1;
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+
+	return ret;
+}
+
+
+/* odb_get_usage() must follow the files opened, grown and closed */
+static int test_usage(void)
+{
+	struct odb_usage before, opened, grown, after;
+	odb_t hash;
+	int ret = 0;
+	int i;
+	int rc;
+
+	odb_get_usage(&before);
+	rc = odb_open(&hash, TEST_FILENAME, ODB_RDWR, sizeof(struct opd_header));
+	if (rc) {
+		fprintf(stderr, "%s", strerror(rc));
+		exit(EXIT_FAILURE);
+	}
+	odb_get_usage(&opened);
+
+	for (i = 0 ; i < 10000 ; ++i)
+		odb_update_node(&hash, i);
+	odb_get_usage(&grown);
+
+	odb_close(&hash);
+	remove(TEST_FILENAME);
+	odb_get_usage(&after);
+
+	if (opened.nr_file != before.nr_file + 1 ||
+	    opened.mapped <= before.mapped || grown.mapped <= opened.mapped ||
+	    after.nr_file != before.nr_file || after.mapped != before.mapped)
+		ret = 1;
+
+	return ret;
+}
+
+
+static void do_layout_test(void)
+{
+	enum odb_layout const layouts[] = {
+		ODB_LAYOUT_CHAINED, ODB_LAYOUT_BUCKET
+	};
+	enum odb_hash const hashes[] = { ODB_HASH_XOR, ODB_HASH_MIX };
+	size_t i, j, k;
+
+	for (i = 0 ; i < 2 ; ++i) {
+		for (k = 0 ; k < 2 ; ++k) {
+			odb_set_layout(layouts[i]);
+			odb_set_hash(hashes[k]);
+			do_test();
+			if (test_dirty(layouts[i])) {
+				fprintf(stderr, "%s:%d failure for dirty "
+				        "layout %d\n", __FILE__, __LINE__,
+				        layouts[i]);
+				nr_error++;
+			}
+			if (test_presize(layouts[i])) {
+				fprintf(stderr, "%s:%d failure for presize "
+				        "layout %d\n", __FILE__, __LINE__,
+				        layouts[i]);
+				nr_error++;
+			}
+			for (j = 0 ; j < 2 ; ++j) {
+				if (test_layout_compat(layouts[i], layouts[j],
+				                       hashes[k])) {
+					fprintf(stderr, "%s:%d failure for "
+					        "layout %d %d hash %d\n",
+					        __FILE__, __LINE__, layouts[i],
+					        layouts[j], hashes[k]);
+					nr_error++;
+				}
+			}
+		}
+	}
+
+	odb_set_layout(ODB_LAYOUT_BUCKET);
+	odb_set_hash(ODB_HASH_MIX);
+
+	odb_set_grow_mode(ODB_GROW_INCREMENTAL);
+	do_test();
+	odb_set_grow_mode(ODB_GROW_SYNC);
+
+	if (test_usage()) {
+		fprintf(stderr, "%s:%d failure for usage\n",
+		        __FILE__, __LINE__);
+		nr_error++;
+	}
+
+	if (test_incremental_grow()) {
+		fprintf(stderr, "%s:%d failure for incremental grow\n",
+		        __FILE__, __LINE__);
+		nr_error++;
+	}
+}
+
+
 static void sanity_check(char const * filename)
 {
 	odb_t hash;
@@ -176,7 +489,7 @@ int main(int argc, char * argv[1])
 speed_test:
 	remove(TEST_FILENAME);
 
-	do_test();
+	do_layout_test();
 
 	do_speed_test();
 
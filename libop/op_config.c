@@ -26,6 +26,9 @@ char op_lock_file[PATH_MAX];
 char op_log_file[PATH_MAX];
 char op_pipe_file[PATH_MAX];
 char op_dump_status[PATH_MAX];
+char op_size_hint_file[PATH_MAX];
+char op_stats_file[PATH_MAX];
+char op_symbol_cache_dir[PATH_MAX];
 
 /* paths in op_config_24.h */
 char op_device[PATH_MAX];
@@ -66,6 +69,15 @@ init_op_config_dirs(char const * session_dir)
 	strcpy(op_dump_status, op_session_dir);
 	strcat(op_dump_status, "/complete_dump");
 
+	strcpy(op_size_hint_file, op_session_dir);
+	strcat(op_size_hint_file, "/sample_sizes");
+
+	strcpy(op_stats_file, op_session_dir);
+	strcat(op_stats_file, "/oprofiled.stats");
+
+	strcpy(op_symbol_cache_dir, op_session_dir);
+	strcat(op_symbol_cache_dir, "/symcache");
+
 	strcpy(op_device, op_session_dir);
 	strcat(op_device, "/opdev");
 
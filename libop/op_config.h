@@ -40,6 +40,9 @@ extern char op_lock_file[];
 extern char op_log_file[];
 extern char op_pipe_file[];
 extern char op_dump_status[];
+extern char op_size_hint_file[];
+extern char op_stats_file[];
+extern char op_symbol_cache_dir[];
 
 #if ANDROID
 #define OP_DRIVER_BASE  "/dev/oprofile"
@@ -52,7 +55,10 @@ extern char op_dump_status[];
 #endif
 
 #define OPD_MAGIC "DAE\n"
-#define OPD_VERSION 0x11
+/* 0x12: the DB file can be bucketed, see odb_descr_t.layout */
+#define OPD_VERSION 0x12
+/* the previous version, its DB files are all chained and still readable */
+#define OPD_VERSION_CHAINED 0x11
 
 #define OP_MIN_CPU_BUF_SIZE 2048
 #define OP_MAX_CPU_BUF_SIZE 131072
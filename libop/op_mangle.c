@@ -19,86 +19,113 @@
 #include "op_sample_file.h"
 #include "op_config.h"
 
-static void append_image(char * dest, int flags, int anon, char const * name, char const * anon_name)
+/**
+ * append str to buf of size bytes holding a string of len chars, return
+ * the new length. Nothing is written once the string doesn't fit.
+ */
+static size_t append(char * buf, size_t size, size_t len, char const * str)
+{
+	size_t n = strlen(str);
+
+	if (len + n < size)
+		memcpy(buf + len, str, n + 1);
+
+	return len + n;
+}
+
+
+static size_t append_image(char * buf, size_t size, size_t len, int flags,
+                           int anon, char const * name, char const * anon_name)
 {
 	if ((flags & MANGLE_KERNEL) && !strchr(name, '/')) {
-		strcat(dest, "{kern}/");
+		len = append(buf, size, len, "{kern}/");
 	} else if (anon) {
-		strcat(dest, "{anon:");
-		strcat(dest, anon_name);
-		strcat(dest,"}/");
+		len = append(buf, size, len, "{anon:");
+		len = append(buf, size, len, anon_name);
+		len = append(buf, size, len, "}/");
 	} else {
-		strcat(dest, "{root}/");
+		len = append(buf, size, len, "{root}/");
 	}
 
-	strcat(dest, name);
-	strcat(dest, "/");
+	len = append(buf, size, len, name);
+	return append(buf, size, len, "/");
 }
 
-char * op_mangle_filename(struct mangle_values const * values)
+
+size_t op_mangle_dir(char * buf, size_t size,
+                     struct mangle_values const * values)
 {
-	char * mangled;
-	size_t len;
-	int anon = values->flags & MANGLE_ANON;
-	int cg_anon = values->flags & MANGLE_CG_ANON;
 	/* if dep_name != image_name we need to invert them (and so revert them
 	 * unconditionally because if they are equal it doesn't hurt to invert
 	 * them), see P:3, FIXME: this is a bit weirds, we prolly need to
 	 * reword pp_interface */
-	char const * image_name = values->dep_name;
-	char const * anon_name = values->anon_name;
-	char const * dep_name = values->image_name;
-	char const * cg_image_name = values->cg_image_name;
-
-	len = strlen(op_samples_current_dir) + strlen(dep_name) + 1
-		+ strlen(values->event_name) + 1 + strlen(image_name) + 1;
-
-	if (values->flags & MANGLE_CALLGRAPH)
-		len += strlen(cg_image_name) + 1;
-
-	if (anon || cg_anon)
-		len += strlen(anon_name);
+	size_t len = 0;
+
+	if (size)
+		buf[0] = '\0';
+
+	len = append(buf, size, len, op_samples_current_dir);
+	len = append_image(buf, size, len, values->flags, 0,
+	                   values->dep_name, values->anon_name);
+	len = append(buf, size, len, "{dep}" "/");
+	return append_image(buf, size, len, values->flags,
+	                    values->flags & MANGLE_ANON, values->image_name,
+	                    values->anon_name);
+}
 
-	/* provision for tgid, tid, unit_mask, cpu and some {root}, {dep},
-	 * {kern}, {anon} and {cg} marker */
-	/* FIXME: too ugly */
-	len += 256;
 
-	mangled = xmalloc(len);
+size_t op_mangle_cg_dir(char * buf, size_t size,
+                        struct mangle_values const * values)
+{
+	size_t len = 0;
 
-	strcpy(mangled, op_samples_current_dir);
-	append_image(mangled, values->flags, 0, image_name, anon_name);
+	if (size)
+		buf[0] = '\0';
 
-	strcat(mangled, "{dep}" "/");
-	append_image(mangled, values->flags, anon, dep_name, anon_name);
+	if (!(values->flags & MANGLE_CALLGRAPH))
+		return 0;
 
-	if (values->flags & MANGLE_CALLGRAPH) {
-		strcat(mangled, "{cg}" "/");
-		append_image(mangled, values->flags, cg_anon,
-		             cg_image_name, anon_name);
-	}
+	len = append(buf, size, len, "{cg}" "/");
+	return append_image(buf, size, len, values->flags,
+	                    values->flags & MANGLE_CG_ANON,
+	                    values->cg_image_name, values->anon_name);
+}
 
-	strcat(mangled, values->event_name);
-	sprintf(mangled + strlen(mangled), ".%d.%d.",
-	        values->count, values->unit_mask);
 
-	if (values->flags & MANGLE_TGID) {
-		sprintf(mangled + strlen(mangled), "%d.", values->tgid);
-	} else {
-		sprintf(mangled + strlen(mangled), "%s.", "all");
-	}
+size_t op_mangle_name(char * buf, size_t size,
+                      struct mangle_values const * values)
+{
+	char tgid[16] = "all";
+	char tid[16] = "all";
+	char cpu[16] = "all";
+	int len;
+
+	if (values->flags & MANGLE_TGID)
+		sprintf(tgid, "%d", values->tgid);
+	if (values->flags & MANGLE_TID)
+		sprintf(tid, "%d", values->tid);
+	if (values->flags & MANGLE_CPU)
+		sprintf(cpu, "%d", values->cpu);
+
+	len = snprintf(buf, size, "%s.%d.%d.%s.%s.%s", values->event_name,
+	               values->count, values->unit_mask, tgid, tid, cpu);
+
+	return len < 0 ? 0 : len;
+}
 
-	if (values->flags & MANGLE_TID) {
-		sprintf(mangled + strlen(mangled), "%d.", values->tid);
-	} else {
-		sprintf(mangled + strlen(mangled), "%s.", "all");
-	}
 
-	if (values->flags & MANGLE_CPU) {
-		sprintf(mangled + strlen(mangled), "%d", values->cpu);
-	} else {
-		sprintf(mangled + strlen(mangled), "%s", "all");
-	}
+char * op_mangle_filename(struct mangle_values const * values)
+{
+	size_t dir_len = op_mangle_dir(NULL, 0, values);
+	size_t cg_len = op_mangle_cg_dir(NULL, 0, values);
+	size_t name_len = op_mangle_name(NULL, 0, values);
+	size_t len = dir_len + cg_len + name_len + 1;
+	char * mangled = xmalloc(len);
+
+	op_mangle_dir(mangled, len, values);
+	op_mangle_cg_dir(mangled + dir_len, len - dir_len, values);
+	op_mangle_name(mangled + dir_len + cg_len, len - dir_len - cg_len,
+	               values);
 
 	return mangled;
 }
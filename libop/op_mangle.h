@@ -59,6 +59,47 @@ struct mangle_values {
  */
 char * op_mangle_filename(struct mangle_values const * values);
 
+/*
+ * A mangled sample filename is made of three parts, each written without
+ * allocating by the functions below: the directory of the profiled
+ * image, the call-graph directory, and the file name. Each function
+ * writes at most size bytes in buf, the string is nul terminated if
+ * size is not zero, and returns the length of the full part as
+ * snprintf() does: if it is size or more, buf holds a truncated part.
+ */
+
+/**
+ * op_mangle_dir - write the image directory of a sample filename
+ * @param buf  where to write, may be NULL if size is 0
+ * @param size  size of buf
+ * @param values  parameters to use as mangling input
+ *
+ * The directory starts with op_samples_current_dir and ends with a '/',
+ * it doesn't depend on the event, the thread or the cpu.
+ */
+size_t op_mangle_dir(char * buf, size_t size,
+                     struct mangle_values const * values);
+
+/**
+ * op_mangle_cg_dir - write the call-graph directory of a sample filename
+ * @param buf  where to write, may be NULL if size is 0
+ * @param size  size of buf
+ * @param values  parameters to use as mangling input
+ *
+ * The directory ends with a '/', it is empty without MANGLE_CALLGRAPH.
+ */
+size_t op_mangle_cg_dir(char * buf, size_t size,
+                        struct mangle_values const * values);
+
+/**
+ * op_mangle_name - write the file name of a sample filename
+ * @param buf  where to write, may be NULL if size is 0
+ * @param size  size of buf
+ * @param values  parameters to use as mangling input
+ */
+size_t op_mangle_name(char * buf, size_t size,
+                      struct mangle_values const * values);
+
 #ifdef __cplusplus
 }
 #endif
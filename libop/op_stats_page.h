@@ -0,0 +1,69 @@
+/**
+ * @file op_stats_page.h
+ * Layout of the daemon statistics page
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef OP_STATS_PAGE_H
+#define OP_STATS_PAGE_H
+
+#include <stdint.h>
+
+/*
+ * oprofiled keeps its statistics in op_stats_file, a file it maps shared
+ * and updates after each buffer, so they can be read at any rate without
+ * talking to the daemon. There is a single writer and the readers don't
+ * write anything: the daemon makes seq odd while it updates the page and
+ * even again once done, a reader copies the page and retries if seq was
+ * odd or changed during the copy.
+ *
+ * Most values are counts since the daemon started, the rates are computed
+ * by the readers from two copies and their time.
+ */
+
+#define OP_STATS_PAGE_MAGIC 0x4f505354
+#define OP_STATS_PAGE_VERSION 1
+
+#define OP_STATS_NAME_LEN 48
+#define OP_STATS_MAX_COUNTERS 96
+#define OP_STATS_MAX_CPUS 256
+/** latency bucket i counts the buffers processed in [2^(i-1), 2^i) usec */
+#define OP_STATS_NR_BUCKETS 32
+
+enum op_stats_type {
+	/** a count since the daemon started, readers show its rate */
+	OP_STATS_COUNTER,
+	/** a current value or a maximum */
+	OP_STATS_GAUGE
+};
+
+struct op_stats_counter {
+	/** nul terminated, set once when the page is created */
+	char name[OP_STATS_NAME_LEN];
+	/** an op_stats_type, set once when the page is created */
+	uint32_t type;
+	uint32_t padding;
+	uint64_t value;
+};
+
+struct op_stats_page {
+	uint32_t magic;
+	uint32_t version;
+	/** odd while the daemon updates the page */
+	uint32_t seq;
+	uint32_t pid;
+	/** time of the last update in usec since the epoch */
+	uint64_t time;
+	uint32_t nr_counter;
+	/** nr of entries used in cpu_samples */
+	uint32_t nr_cpu;
+	/** buffer processing time histogram */
+	uint64_t latency[OP_STATS_NR_BUCKETS];
+	/** samples received from each cpu */
+	uint64_t cpu_samples[OP_STATS_MAX_CPUS];
+	struct op_stats_counter counter[OP_STATS_MAX_COUNTERS];
+};
+
+#endif /* OP_STATS_PAGE_H */
@@ -8,6 +8,7 @@
  * @author Philippe Elie
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -45,6 +46,33 @@ static struct test_input const tests[] = {
 };
 
 
+/** build the filename from its parts in a fixed buffer */
+static void check_parts(struct test_input const * test, char const * expect)
+{
+	char buf[PATH_MAX];
+	char small[8];
+	size_t len;
+
+	len = op_mangle_dir(buf, sizeof(buf), &test->values);
+	len += op_mangle_cg_dir(buf + len, sizeof(buf) - len, &test->values);
+	len += op_mangle_name(buf + len, sizeof(buf) - len, &test->values);
+	if (strcmp(buf, expect) || len != strlen(expect)) {
+		fprintf(stderr, "test %d parts:\nfound: %s\nexpect: %s\n",
+			(int)(test - tests), buf, expect);
+		exit(EXIT_FAILURE);
+	}
+
+	/* a too small buffer gives the full length and a string */
+	len = op_mangle_dir(small, sizeof(small), &test->values);
+	if (len != op_mangle_dir(NULL, 0, &test->values) ||
+	    strlen(small) >= sizeof(small)) {
+		fprintf(stderr, "test %d: bad truncation\n",
+			(int)(test - tests));
+		exit(EXIT_FAILURE);
+	}
+}
+
+
 int main(void)
 {
 	struct test_input const * test;
@@ -59,6 +87,7 @@ int main(void)
 				(int)(test - tests), result, expect);
 			exit(EXIT_FAILURE);
 		}
+		check_parts(test, expect);
 		free(expect);
 		free(result);
 	}
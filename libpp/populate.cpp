@@ -17,12 +17,16 @@
 #include "arrange_profiles.h"
 #include "op_bfd.h"
 #include "op_header.h"
+#include "op_exception.h"
 #include "populate.h"
 #include "populate_for_spu.h"
 
 #include "image_errors.h"
 
 #include <iostream>
+#include <vector>
+
+#include <pthread.h>
 
 using namespace std;
 
@@ -30,8 +34,7 @@ namespace {
 
 /// load merged files for one set of sample files
 bool
-populate_from_files(profile_t & profile, op_bfd const & abfd,
-                    list<profile_sample_files> const & files)
+populate_from_files(profile_t & profile, list<profile_sample_files> const & files)
 {
 	list<profile_sample_files>::const_iterator it = files.begin();
 	list<profile_sample_files>::const_iterator const end = files.end();
@@ -44,7 +47,6 @@ populate_from_files(profile_t & profile, op_bfd const & abfd,
 		// (i.e no sample to the binary)
 		if (!it->sample_filename.empty()) {
 			profile.add_sample_file(it->sample_filename);
-			profile.set_offset(abfd);
 			found = true;
 		}
 	}
@@ -52,12 +54,210 @@ populate_from_files(profile_t & profile, op_bfd const & abfd,
 	return found;
 }
 
-}  // anon namespace
 
+/// the sample files of an image, loaded by an image_loader thread
+struct image_profiles : noncopyable {
+	~image_profiles() {
+		for (size_t i = 0; i < profiles.size(); ++i)
+			delete profiles[i];
+	}
+
+	/**
+	 * return the profile of the image_set nr in populate_image() order,
+	 * NULL if it has no sample file. Throw the error met when loading
+	 * it if any.
+	 */
+	profile_t * get(size_t nr) const {
+		if (nr == profiles.size())
+			throw op_fatal_error(error);
+		return profiles[nr];
+	}
+
+	/// profiles up to the first image_set which failed to load
+	vector<profile_t *> profiles;
+	/// the message of the exception thrown by the failed image_set
+	string error;
+};
+
+
+/// load the sample files of ip, the errors are kept in loaded.error
+void load_image(image_profiles & loaded, inverted_profile const & ip)
+{
+	size_t nr_loaded = 0;
+
+	try {
+		// the SPU images are done in the main thread
+		if (is_spu_profile(ip))
+			return;
+
+		for (size_t i = 0; i < ip.groups.size(); ++i) {
+			list<image_set>::const_iterator it
+				= ip.groups[i].begin();
+			list<image_set>::const_iterator const end
+				= ip.groups[i].end();
+
+			for (; it != end; ++it) {
+				// owned by loaded as soon as allocated
+				loaded.profiles.push_back(0);
+				profile_t * profile = new profile_t;
+				loaded.profiles.back() = profile;
+				if (populate_from_files(*profile, it->files)) {
+					// sort the samples now rather than in
+					// the main thread
+					profile->samples_range();
+				} else {
+					loaded.profiles.back() = 0;
+					delete profile;
+				}
+				++nr_loaded;
+			}
+		}
+	} catch (exception const & e) {
+		// drop the image_set which failed to load
+		if (loaded.profiles.size() > nr_loaded) {
+			delete loaded.profiles.back();
+			loaded.profiles.pop_back();
+		}
+		loaded.error = e.what();
+	}
+}
+
+
+/**
+ * Load the sample files of a list of images from several threads, in
+ * order and up to a few images ahead of the caller. Only the sample files
+ * are read, libbfd and the global name storage are not thread safe.
+ */
+class image_loader : noncopyable {
+public:
+	image_loader(list<inverted_profile> const & iprofiles, size_t nr_jobs);
+
+	/// stop and wait for the threads
+	~image_loader();
+
+	/// return the next image profiles, the caller owns them
+	image_profiles * get();
+
+private:
+	static void * thread_main(void * loader);
+
+	/// load images until stopped or done
+	void run();
+
+	vector<inverted_profile const *> images;
+	vector<pthread_t> threads;
+
+	/// protect all the fields below
+	pthread_mutex_t lock;
+	/// signaled when an image is loaded or taken by get()
+	pthread_cond_t cond;
+	/// loaded images not yet taken by get(), NULL until loaded
+	vector<image_profiles *> loaded;
+	/// next image to load
+	size_t next_load;
+	/// next image returned by get()
+	size_t next_get;
+	/// nr of images loaded ahead of get() at most
+	size_t max_ahead;
+	bool stop;
+};
+
+
+image_loader::image_loader(list<inverted_profile> const & iprofiles,
+                           size_t nr_jobs)
+	:
+	loaded(iprofiles.size()),
+	next_load(0),
+	next_get(0),
+	max_ahead(nr_jobs * 2),
+	stop(false)
+{
+	list<inverted_profile>::const_iterator it = iprofiles.begin();
+	for (; it != iprofiles.end(); ++it)
+		images.push_back(&*it);
+
+	pthread_mutex_init(&lock, 0);
+	pthread_cond_init(&cond, 0);
+
+	for (size_t i = 0; i < nr_jobs; ++i) {
+		pthread_t thread;
+		if (pthread_create(&thread, 0, thread_main, this))
+			break;
+		threads.push_back(thread);
+	}
+
+	if (threads.empty())
+		throw op_fatal_error("couldn't create a populate thread");
+}
+
+
+image_loader::~image_loader()
+{
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	for (size_t i = 0; i < threads.size(); ++i)
+		pthread_join(threads[i], 0);
+
+	for (size_t i = next_get; i < loaded.size(); ++i)
+		delete loaded[i];
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&lock);
+}
 
+
+image_profiles * image_loader::get()
+{
+	pthread_mutex_lock(&lock);
+	while (!loaded[next_get])
+		pthread_cond_wait(&cond, &lock);
+	image_profiles * result = loaded[next_get];
+	loaded[next_get++] = 0;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+
+	return result;
+}
+
+
+void * image_loader::thread_main(void * loader)
+{
+	static_cast<image_loader *>(loader)->run();
+	return 0;
+}
+
+
+void image_loader::run()
+{
+	pthread_mutex_lock(&lock);
+	while (!stop && next_load < images.size()) {
+		if (next_load >= next_get + max_ahead) {
+			pthread_cond_wait(&cond, &lock);
+			continue;
+		}
+
+		size_t const nr = next_load++;
+		pthread_mutex_unlock(&lock);
+
+		image_profiles * image = new image_profiles;
+		load_image(*image, *images[nr]);
+
+		pthread_mutex_lock(&lock);
+		loaded[nr] = image;
+		pthread_cond_broadcast(&cond);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+
+/// populate_for_image(), with the profiles of ip in loaded if non NULL
 void
-populate_for_image(profile_container & samples, inverted_profile const & ip,
-	string_filter const & symbol_filter, bool * has_debug_info)
+populate_image(profile_container & samples, inverted_profile const & ip,
+	string_filter const & symbol_filter, bool * has_debug_info,
+	image_profiles const * loaded)
 {
 	if (is_spu_profile(ip)) {
 		populate_for_spu_image(samples, ip, symbol_filter,
@@ -77,6 +277,7 @@ populate_for_image(profile_container & samples, inverted_profile const & ip,
 	opd_header header;
 
 	bool found = false;
+	size_t nr_set = 0;
 	for (size_t i = 0; i < ip.groups.size(); ++i) {
 		list<image_set>::const_iterator it
 			= ip.groups[i].begin();
@@ -88,10 +289,17 @@ populate_for_image(profile_container & samples, inverted_profile const & ip,
 		// changes, and the .add() would mis-attribute
 		// to the wrong app_image otherwise
 		for (; it != end; ++it) {
-			profile_t profile;
-			if (populate_from_files(profile, abfd, it->files)) {
-				header = profile.get_header();
-				samples.add(profile, abfd, it->app_image, i);
+			profile_t local_profile;
+			profile_t * profile = &local_profile;
+			if (loaded)
+				profile = loaded->get(nr_set++);
+			else if (!populate_from_files(local_profile, it->files))
+				profile = 0;
+
+			if (profile) {
+				profile->set_offset(abfd);
+				header = profile->get_header();
+				samples.add(*profile, abfd, it->app_image, i);
 				found = true;
 			}
 		}
@@ -108,3 +316,42 @@ populate_for_image(profile_container & samples, inverted_profile const & ip,
 	if (has_debug_info)
 		*has_debug_info = abfd.has_debug_info();
 }
+
+}  // anon namespace
+
+
+void
+populate_for_image(profile_container & samples, inverted_profile const & ip,
+	string_filter const & symbol_filter, bool * has_debug_info)
+{
+	populate_image(samples, ip, symbol_filter, has_debug_info, 0);
+}
+
+
+void
+populate_for_images(profile_container & samples,
+	list<inverted_profile> const & iprofiles,
+	string_filter const & symbol_filter, size_t nr_jobs,
+	bool * has_debug_info)
+{
+	list<inverted_profile>::const_iterator it = iprofiles.begin();
+	list<inverted_profile>::const_iterator const end = iprofiles.end();
+
+	scoped_ptr<image_loader> loader;
+	if (nr_jobs > 1 && iprofiles.size() > 1)
+		loader.reset(new image_loader(iprofiles, nr_jobs));
+
+	// the images are added in order from this thread whatever nr_jobs,
+	// so the name ids and the output are the same as a serial run
+	for (; it != end; ++it) {
+		scoped_ptr<image_profiles> loaded;
+		if (loader.get())
+			loaded.reset(loader->get());
+
+		bool debug_info = false;
+		populate_image(samples, *it, symbol_filter,
+		               has_debug_info ? &debug_info : 0, loaded.get());
+		if (has_debug_info && debug_info)
+			*has_debug_info = true;
+	}
+}
@@ -12,6 +12,9 @@
 #ifndef POPULATE_H
 #define POPULATE_H
 
+#include <cstddef>
+#include <list>
+
 class profile_container;
 class inverted_profile;
 class string_filter;
@@ -22,4 +25,17 @@ void
 populate_for_image(profile_container & samples, inverted_profile const & ip,
    string_filter const & symbol_filter, bool * has_debug_info);
 
+/**
+ * Load all sample file information for a list of binary images, as
+ * populate_for_image() on each image in turn. If nr_jobs is more than
+ * one, the sample files are read ahead by nr_jobs threads, the images
+ * are still added in order so the result is the same. has_debug_info,
+ * if non NULL, is set to true if any image has debug information.
+ */
+void
+populate_for_images(profile_container & samples,
+   std::list<inverted_profile> const & iprofiles,
+   string_filter const & symbol_filter, size_t nr_jobs,
+   bool * has_debug_info);
+
 #endif /* POPULATE_H */
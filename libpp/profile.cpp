@@ -17,6 +17,8 @@
 #include <string>
 #include <sstream>
 #include <cstring>
+#include <algorithm>
+#include <vector>
 
 #include <cerrno>
 
@@ -31,8 +33,98 @@
 
 using namespace std;
 
+namespace {
+
+typedef pair<odb_key_t, count_type> sample_entry;
+
+/// bits of the key sorted by each radix_sort() pass
+unsigned int const radix_bits = 11;
+size_t const radix_size = 1 << radix_bits;
+
+
+/**
+ * LSD radix sort of [first, last) by key, stable. The passes over digits
+ * which are the same for all the keys are skipped, sample file keys are
+ * offsets in a binary so only the low digits usually need sorting.
+ */
+void radix_sort(sample_entry * first, sample_entry * last)
+{
+	size_t const nr = last - first;
+	odb_key_t all_or = 0;
+	odb_key_t all_and = ~odb_key_t(0);
+
+	for (sample_entry const * it = first; it != last; ++it) {
+		all_or |= it->first;
+		all_and &= it->first;
+	}
+
+	vector<sample_entry> buffer(nr);
+	sample_entry * from = first;
+	sample_entry * to = &buffer[0];
+	vector<size_t> offset(radix_size);
+
+	for (unsigned int shift = 0; shift < 64; shift += radix_bits) {
+		if ((((all_or ^ all_and) >> shift) & (radix_size - 1)) == 0)
+			continue;
+
+		fill(offset.begin(), offset.end(), 0);
+		for (size_t i = 0; i < nr; ++i)
+			++offset[(from[i].first >> shift) & (radix_size - 1)];
+
+		size_t pos = 0;
+		for (size_t i = 0; i < radix_size; ++i) {
+			size_t count = offset[i];
+			offset[i] = pos;
+			pos += count;
+		}
+
+		for (size_t i = 0; i < nr; ++i) {
+			size_t digit = (from[i].first >> shift) & (radix_size - 1);
+			to[offset[digit]++] = from[i];
+		}
+
+		swap(from, to);
+	}
+
+	if (from != first)
+		copy(from, from + nr, first);
+}
+
+
+/// sum the counts of the consecutive entries with the same key
+vector<sample_entry>::iterator
+merge_same_key(vector<sample_entry>::iterator first,
+               vector<sample_entry>::iterator last)
+{
+	if (first == last)
+		return last;
+
+	vector<sample_entry>::iterator out = first;
+	for (++first; first != last; ++first) {
+		if (first->first == out->first)
+			out->second += first->second;
+		else
+			*++out = *first;
+	}
+
+	return ++out;
+}
+
+
+struct less_key {
+	bool operator()(sample_entry const & lhs, sample_entry const & rhs) const {
+		return lhs.first < rhs.first;
+	}
+	bool operator()(sample_entry const & lhs, odb_key_t rhs) const {
+		return lhs.first < rhs;
+	}
+};
+
+}  // anon namespace
+
+
 profile_t::profile_t()
-	: start_offset(0)
+	: nr_frozen(0), start_offset(0)
 {
 }
 
@@ -46,10 +138,12 @@ count_type profile_t::sample_count(string const & filename)
 
 	count_type count = 0;
 
-	odb_node_nr_t node_nr, pos;
-	odb_node_t * node = odb_get_iterator(&samples_db, &node_nr);
-	for (pos = 0; pos < node_nr; ++pos)
-		count += node[pos].value;
+	odb_iterator_t it;
+	odb_key_t key;
+	odb_value_t value;
+	odb_iterator_init(&it, &samples_db);
+	while (odb_iterator_next(&it, &key, &value))
+		count += value;
 
 	odb_close(&samples_db);
 
@@ -76,7 +170,8 @@ void profile_t::open_sample_file(string const & filename, odb_t & db)
 	// fail and the error message will be obscure.
 	opd_header head = read_header(filename);
 
-	if (head.version != OPD_VERSION) {
+	if (head.version != OPD_VERSION &&
+	    head.version != OPD_VERSION_CHAINED) {
 		ostringstream os;
 		os << "oprofpp: samples files version mismatch, are you "
 		   << "running a daemon and post-profile tools with version "
@@ -106,22 +201,47 @@ void profile_t::add_sample_file(string const & filename)
 	else
 		file_header.reset(new opd_header(head));
 
-	odb_node_nr_t node_nr, pos;
-	odb_node_t * node = odb_get_iterator(&samples_db, &node_nr);
-
-	for (pos = 0; pos < node_nr; ++pos) {
-		ordered_samples_t::iterator it = 
-		    ordered_samples.find(node[pos].key);
-		if (it != ordered_samples.end()) {
-			it->second += node[pos].value;
-		} else {
-			ordered_samples_t::value_type
-				val(node[pos].key, node[pos].value);
-			ordered_samples.insert(val);
-		}
-	}
+	odb_iterator_t node_it;
+	odb_key_t key;
+	odb_value_t value;
+	odb_iterator_init(&node_it, &samples_db);
+
+	if (ordered_samples.empty())
+		ordered_samples.reserve(odb_get_node_nr(&samples_db));
+
+	// sorted and merged by freeze()
+	while (odb_iterator_next(&node_it, &key, &value))
+		ordered_samples.push_back(make_pair(key, count_type(value)));
 
 	odb_close(&samples_db);
+
+	// the same eip is often sampled in each file, merge before the
+	// duplicates outgrow the merged samples
+	if (ordered_samples.size() - nr_frozen >= nr_frozen)
+		freeze();
+}
+
+
+void profile_t::freeze() const
+{
+	if (nr_frozen == ordered_samples.size())
+		return;
+
+	ordered_samples_t::iterator const first = ordered_samples.begin();
+	ordered_samples_t::iterator const middle = first + nr_frozen;
+
+	radix_sort(&*middle, &*middle + (ordered_samples.end() - middle));
+
+	ordered_samples_t::iterator last =
+		merge_same_key(middle, ordered_samples.end());
+
+	if (nr_frozen) {
+		inplace_merge(first, middle, last, less_key());
+		last = merge_same_key(first, last);
+	}
+
+	ordered_samples.erase(last, ordered_samples.end());
+	nr_frozen = ordered_samples.size();
 }
 
 
@@ -151,6 +271,8 @@ profile_t::samples_range(odb_key_t start, odb_key_t end) const
 	// This can happen on e.g. ARM kernels, where .init is
 	// mapped before .text - we just have to skip any such
 	// .init symbols.
+	freeze();
+
 	if (start < start_offset) {
 		return make_pair(const_iterator(ordered_samples.end(), 0), 
 			const_iterator(ordered_samples.end(), 0));
@@ -167,18 +289,36 @@ profile_t::samples_range(odb_key_t start, odb_key_t end) const
 			"oprofile-list@lists.sourceforge.net");
 	}
 
-	ordered_samples_t::const_iterator first = 
-		ordered_samples.lower_bound(start);
+	ordered_samples_t const & samples = ordered_samples;
+	ordered_samples_t::const_iterator first =
+		lower_bound(samples.begin(), samples.end(), start, less_key());
 	ordered_samples_t::const_iterator last =
-		ordered_samples.lower_bound(end);
+		lower_bound(first, samples.end(), end, less_key());
 
 	return make_pair(const_iterator(first, start_offset),
 		const_iterator(last, start_offset));
 }
 
 
+profile_t::const_iterator profile_t::next_sample(odb_key_t offset) const
+{
+	freeze();
+
+	ordered_samples_t const & samples = ordered_samples;
+	ordered_samples_t::const_iterator it = samples.begin();
+	if (offset > start_offset) {
+		it = lower_bound(it, samples.end(),
+		                 offset - start_offset, less_key());
+	}
+
+	return const_iterator(it, start_offset);
+}
+
+
 profile_t::iterator_pair profile_t::samples_range() const
 {
+	freeze();
+
 	ordered_samples_t::const_iterator first = ordered_samples.begin();
 	ordered_samples_t::const_iterator last = ordered_samples.end();
 
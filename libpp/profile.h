@@ -14,7 +14,8 @@
 #define PROFILE_H
 
 #include <string>
-#include <map>
+#include <vector>
+#include <utility>
 #include <iterator>
 
 #include "odb.h"
@@ -70,6 +71,7 @@ public:
 	 * @param filename  sample file name
 	 *
 	 * store samples for one sample file, sample file header is sanitized.
+	 * The iterators returned by samples_range() before are invalidated.
 	 *
 	 * all error are fatal
 	 */
@@ -93,6 +95,9 @@ public:
 	/// return a pair of iterator for all samples
 	iterator_pair samples_range() const;
 
+	/// return an iterator to the first sample at or after offset
+	const_iterator next_sample(odb_key_t offset) const;
+
 private:
 	/// helper for sample_count() and add_sample_file(). All error launch
 	/// an exception.
@@ -103,15 +108,24 @@ private:
 	scoped_ptr<opd_header> file_header;
 
 	/// storage type for samples sorted by eip
-	typedef std::map<odb_key_t, count_type> ordered_samples_t;
+	typedef std::vector<std::pair<odb_key_t, count_type> >
+		ordered_samples_t;
+
+	/// sort by eip and merge the samples added since the last call
+	void freeze() const;
 
 	/**
 	 * Samples are stored in hash table, iterating over hash table don't
 	 * provide any ordering, the above count() interface rely on samples
-	 * ordered by eip. This map is only a temporary storage where samples
-	 * are ordered by eip.
+	 * ordered by eip. add_sample_file() only appends the nodes of a
+	 * file here, they are sorted and the samples at the same eip are
+	 * merged on the next samples_range() call, so ranges are searched
+	 * in contiguous memory.
 	 */
-	ordered_samples_t ordered_samples;
+	mutable ordered_samples_t ordered_samples;
+
+	/// nr of leading ordered_samples entries sorted and merged
+	mutable size_t nr_frozen;
 
 	/**
 	 * For certain profiles, such as kernel/modules, and anon
@@ -77,7 +77,17 @@ void profile_container::add(profile_t const & profile,
 	string const image_name = abfd.get_filename();
 	opd_header header = profile.get_header();
 
-	for (symbol_index_t i = 0; i < abfd.syms.size(); ++i) {
+	// Walk the symbols and the samples together: from each symbol, go
+	// straight to the one holding the next sample, so the symbols with no
+	// samples are not looked at. next_symbol() doesn't skip anything when
+	// the symbol ranges are not disjoint and sorted.
+	profile_t::const_iterator const samples_end =
+		profile.samples_range().second;
+	profile_t::const_iterator it = profile.next_sample(0);
+	symbol_index_t next = abfd.next_symbol(0,
+		it == samples_end ? ~0ULL : it.vma());
+
+	for (symbol_index_t i = next; i < abfd.syms.size(); i = next) {
 
 		unsigned long long start = 0, end = 0;
 		symbol_entry symb_entry;
@@ -88,6 +98,10 @@ void profile_container::add(profile_t const & profile,
 			profile.samples_range(start, end);
 		count_type count = accumulate(p_it.first, p_it.second, 0ull);
 
+		it = profile.next_sample(end);
+		next = abfd.next_symbol(i + 1,
+			it == samples_end ? ~0ULL : it.vma());
+
 		// skip entries with no samples
 		if (count == 0)
 			continue;
@@ -139,19 +153,27 @@ profile_container::add_samples(op_bfd const & abfd, symbol_index_t sym_index,
 	bfd_vma base_vma = abfd.syms[sym_index].vma();
 
 	profile_t::const_iterator it;
-	for (it = p_it.first; it != p_it.second ; ++it) {
+
+	// the samples are in increasing vma order, resolve them in one go
+	vector<linenr_info> lines;
+	if (debug_info) {
+		vector<bfd_vma> vmas;
+		for (it = p_it.first; it != p_it.second ; ++it)
+			vmas.push_back(it.vma());
+		abfd.get_linenrs(sym_index, vmas, lines);
+	}
+
+	size_t i = 0;
+	for (it = p_it.first; it != p_it.second ; ++it, ++i) {
 		sample_entry sample;
 
 		sample.counts[pclass] = it.count();
 
 		sample.file_loc.linenr = 0;
-		if (debug_info) {
-			string filename;
-			if (abfd.get_linenr(sym_index, it.vma(), filename,
-					sample.file_loc.linenr)) {
-				sample.file_loc.filename =
-					debug_names.create(filename);
-			}
+		if (debug_info && lines[i].found) {
+			sample.file_loc.filename =
+				debug_names.create(lines[i].filename);
+			sample.file_loc.linenr = lines[i].line;
 		}
 
 		sample.vma = (it.vma() - start) + base_vma;
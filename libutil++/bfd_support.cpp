@@ -11,6 +11,7 @@
 #include "bfd_support.h"
 
 #include "op_bfd.h"
+#include "debug_line.h"
 #include "op_fileio.h"
 #include "op_config.h"
 #include "string_manip.h"
@@ -34,6 +35,24 @@ extern verbose vbfd;
 
 namespace {
 
+/// read the contents of section name, false if abfd has no such section
+bool read_section(bfd * abfd, char const * name, string & contents)
+{
+	asection * sect = bfd_get_section_by_name(abfd, name);
+	if (!sect)
+		return false;
+
+	bfd_size_type const size = bfd_section_size(abfd, sect);
+	contents.resize(size);
+	if (size && !bfd_get_section_contents(abfd, sect, &contents[0], 0,
+	                                      size)) {
+		contents.erase();
+		return false;
+	}
+
+	return true;
+}
+
 
 void check_format(string const & file, bfd ** ibfd)
 {
@@ -635,3 +654,59 @@ fail:
 	info.line = 0;
 	return info;
 }
+
+
+bool read_debug_sections(bfd_info const & b, debug_sections & sections)
+{
+	if (!b.valid() || (bfd_get_file_flags(b.abfd) & HAS_RELOC))
+		return false;
+
+	sections.big_endian = bfd_big_endian(b.abfd);
+
+	if (!read_section(b.abfd, ".debug_line", sections.line))
+		return false;
+
+	// the compilation units are needed for relative file names only
+	read_section(b.abfd, ".debug_info", sections.info);
+	read_section(b.abfd, ".debug_abbrev", sections.abbrev);
+	read_section(b.abfd, ".debug_str", sections.str);
+	read_section(b.abfd, ".debug_line_str", sections.line_str);
+
+	return true;
+}
+
+
+void find_nearest_lines(bfd_info const & b, debug_line_table const & table,
+                        op_bfd_symbol const & sym,
+                        vector<bfd_vma> const & offsets, bool anon_obj,
+                        vector<linenr_info> & infos)
+{
+	infos.resize(offsets.size());
+
+	asection const * section = sym.symbol() ? sym.symbol()->section : 0;
+	bool const use_table = b.valid() && section && table.valid() &&
+		(bfd_get_section_flags(b.abfd, section) & SEC_ALLOC);
+
+	debug_line_table::cursor pos;
+	for (size_t i = 0; i < offsets.size(); ++i) {
+		linenr_info & info = infos[i];
+
+		// as in find_nearest_line()
+		if (use_table) {
+			bfd_vma pc;
+			if (anon_obj)
+				pc = offsets[i] - section->vma;
+			else
+				pc = (sym.value() + offsets[i]) - sym.filepos();
+
+			if (pc < bfd_section_size(b.abfd, section) &&
+			    table.find(section->vma + pc, info.filename,
+			               info.line, pos)) {
+				info.found = true;
+				continue;
+			}
+		}
+
+		info = find_nearest_line(b, sym, offsets[i], anon_obj);
+	}
+}
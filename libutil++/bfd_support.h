@@ -19,8 +19,11 @@
 #include <stdint.h>
 
 #include <string>
+#include <vector>
 
 class op_bfd_symbol;
+struct debug_sections;
+class debug_line_table;
 
 /// holder for BFD state we must keep
 struct bfd_info {
@@ -153,4 +156,21 @@ linenr_info const
 find_nearest_line(bfd_info const & ibfd, op_bfd_symbol const & sym,
                   bfd_vma offset, bool anon_obj);
 
+/**
+ * Read the DWARF sections of b a debug_line_table is built from. Return
+ * false if the table can't be used for b: the addresses in the line
+ * programs of a relocatable file are not relocated.
+ */
+bool read_debug_sections(bfd_info const & b, debug_sections & sections);
+
+/**
+ * find_nearest_line() for several offsets of sym, in increasing order for
+ * the lookups to be a single walk over the rows of table. The offsets the
+ * table can't answer go through find_nearest_line().
+ */
+void find_nearest_lines(bfd_info const & b, debug_line_table const & table,
+                        op_bfd_symbol const & sym,
+                        std::vector<bfd_vma> const & offsets, bool anon_obj,
+                        std::vector<linenr_info> & infos);
+
 #endif /* !BFD_SUPPORT_H */
@@ -0,0 +1,883 @@
+/**
+ * @file debug_line.cpp
+ * Address to source line table decoded from the DWARF line programs
+ *
+ * The line programs of .debug_line (DWARF 2 to 5) are run once and their
+ * rows kept by sequence. The compilation unit DIEs of .debug_info are read
+ * only for their DW_AT_comp_dir, used to build the file names as bfd does.
+ * Everything read is bounds checked: a unit which can't be decoded is
+ * skipped, and bfd answers for the addresses it covers.
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#include "debug_line.h"
+
+using namespace std;
+
+namespace {
+
+enum {
+	DW_TAG_compile_unit = 0x11,
+	DW_TAG_partial_unit = 0x3c,
+
+	DW_AT_stmt_list = 0x10,
+	DW_AT_comp_dir = 0x1b,
+
+	DW_FORM_addr = 0x01,
+	DW_FORM_block2 = 0x03,
+	DW_FORM_block4 = 0x04,
+	DW_FORM_data2 = 0x05,
+	DW_FORM_data4 = 0x06,
+	DW_FORM_data8 = 0x07,
+	DW_FORM_string = 0x08,
+	DW_FORM_block = 0x09,
+	DW_FORM_block1 = 0x0a,
+	DW_FORM_data1 = 0x0b,
+	DW_FORM_flag = 0x0c,
+	DW_FORM_sdata = 0x0d,
+	DW_FORM_strp = 0x0e,
+	DW_FORM_udata = 0x0f,
+	DW_FORM_ref_addr = 0x10,
+	DW_FORM_ref1 = 0x11,
+	DW_FORM_ref2 = 0x12,
+	DW_FORM_ref4 = 0x13,
+	DW_FORM_ref8 = 0x14,
+	DW_FORM_ref_udata = 0x15,
+	DW_FORM_indirect = 0x16,
+	DW_FORM_sec_offset = 0x17,
+	DW_FORM_exprloc = 0x18,
+	DW_FORM_flag_present = 0x19,
+	DW_FORM_strx = 0x1a,
+	DW_FORM_addrx = 0x1b,
+	DW_FORM_ref_sup4 = 0x1c,
+	DW_FORM_strp_sup = 0x1d,
+	DW_FORM_data16 = 0x1e,
+	DW_FORM_line_strp = 0x1f,
+	DW_FORM_ref_sig8 = 0x20,
+	DW_FORM_implicit_const = 0x21,
+	DW_FORM_loclistx = 0x22,
+	DW_FORM_rnglistx = 0x23,
+	DW_FORM_ref_sup8 = 0x24,
+	DW_FORM_strx1 = 0x25,
+	DW_FORM_strx2 = 0x26,
+	DW_FORM_strx3 = 0x27,
+	DW_FORM_strx4 = 0x28,
+	DW_FORM_addrx1 = 0x29,
+	DW_FORM_addrx2 = 0x2a,
+	DW_FORM_addrx3 = 0x2b,
+	DW_FORM_addrx4 = 0x2c,
+	DW_FORM_GNU_addr_index = 0x1f01,
+	DW_FORM_GNU_str_index = 0x1f02,
+	DW_FORM_GNU_ref_alt = 0x1f20,
+	DW_FORM_GNU_strp_alt = 0x1f21,
+
+	DW_UT_skeleton = 0x04,
+	DW_UT_split_compile = 0x05,
+	DW_UT_type = 0x02,
+	DW_UT_split_type = 0x06,
+
+	DW_LNS_copy = 1,
+	DW_LNS_advance_pc = 2,
+	DW_LNS_advance_line = 3,
+	DW_LNS_set_file = 4,
+	DW_LNS_const_add_pc = 8,
+	DW_LNS_fixed_advance_pc = 9,
+
+	DW_LNE_end_sequence = 1,
+	DW_LNE_set_address = 2,
+	DW_LNE_define_file = 3,
+
+	DW_LNCT_path = 1,
+	DW_LNCT_directory_index = 2
+};
+
+
+/**
+ * Bounds checked reader of DWARF data. A read past the end returns 0 and
+ * sets failed, so the callers check it once after a group of reads.
+ */
+class dwarf_reader {
+public:
+	dwarf_reader(string const & data, size_t start, bool big_endian)
+		: data(data), pos(start), end(data.size()),
+		  big_endian(big_endian), failed(false) {}
+
+	bool ok() const { return !failed; }
+
+	bool at_end() const { return failed || pos >= end; }
+
+	/// read an unsigned value of size bytes
+	u64 u(size_t size) {
+		if (!check(size))
+			return 0;
+		u64 value = 0;
+		for (size_t i = 0; i < size; ++i) {
+			unsigned char byte = data[pos + i];
+			if (big_endian)
+				value = (value << 8) | byte;
+			else
+				value |= u64(byte) << (8 * i);
+		}
+		pos += size;
+		return value;
+	}
+
+	u64 uleb() {
+		u64 value = 0;
+		unsigned int shift = 0;
+		unsigned char byte;
+		do {
+			if (!check(1))
+				return 0;
+			byte = data[pos++];
+			if (shift < 64)
+				value |= u64(byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+		return value;
+	}
+
+	long long sleb() {
+		u64 value = 0;
+		unsigned int shift = 0;
+		unsigned char byte;
+		do {
+			if (!check(1))
+				return 0;
+			byte = data[pos++];
+			if (shift < 64)
+				value |= u64(byte & 0x7f) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+		if (shift < 64 && (byte & 0x40))
+			value |= ~u64(0) << shift;
+		return value;
+	}
+
+	/// a nul terminated string, NULL at the end of the data
+	char const * str() {
+		if (!check(1))
+			return 0;
+		void const * nul = memchr(&data[pos], 0, end - pos);
+		if (!nul) {
+			failed = true;
+			return 0;
+		}
+		char const * result = &data[pos];
+		pos = static_cast<char const *>(nul) - &data[0] + 1;
+		return result;
+	}
+
+	void skip(u64 size) {
+		if (check(size))
+			pos += size;
+	}
+
+	/**
+	 * Read a unit initial length, set offset_size and limit the reads
+	 * to the unit. Return the offset of the next unit, 0 on failure.
+	 */
+	size_t unit_length(size_t & offset_size) {
+		u64 length = u(4);
+		offset_size = 4;
+		if (length == 0xffffffff) {
+			length = u(8);
+			offset_size = 8;
+		} else if (length >= 0xfffffff0) {
+			failed = true;
+		}
+		if (failed || length > end - pos) {
+			failed = true;
+			return 0;
+		}
+		end = pos + length;
+		return end;
+	}
+
+	string const & data;
+	size_t pos;
+	size_t end;
+
+private:
+	bool check(u64 size) {
+		if (failed || size > end - pos) {
+			failed = true;
+			return false;
+		}
+		return true;
+	}
+
+	bool big_endian;
+	bool failed;
+};
+
+
+/// the string at offset in a string section, NULL if there is none
+char const * section_string(string const & section, u64 offset)
+{
+	if (offset >= section.size() ||
+	    !memchr(&section[offset], 0, section.size() - offset))
+		return 0;
+	return &section[offset];
+}
+
+
+/// skip an attribute value, false if the form is not known
+bool skip_form(dwarf_reader & r, u64 form, size_t offset_size,
+               size_t address_size, unsigned int version)
+{
+	switch (form) {
+	case DW_FORM_flag_present:
+	case DW_FORM_implicit_const:
+		return true;
+	case DW_FORM_data1:
+	case DW_FORM_ref1:
+	case DW_FORM_flag:
+	case DW_FORM_strx1:
+	case DW_FORM_addrx1:
+		r.skip(1);
+		break;
+	case DW_FORM_data2:
+	case DW_FORM_ref2:
+	case DW_FORM_strx2:
+	case DW_FORM_addrx2:
+		r.skip(2);
+		break;
+	case DW_FORM_strx3:
+	case DW_FORM_addrx3:
+		r.skip(3);
+		break;
+	case DW_FORM_data4:
+	case DW_FORM_ref4:
+	case DW_FORM_ref_sup4:
+	case DW_FORM_strx4:
+	case DW_FORM_addrx4:
+		r.skip(4);
+		break;
+	case DW_FORM_data8:
+	case DW_FORM_ref8:
+	case DW_FORM_ref_sig8:
+	case DW_FORM_ref_sup8:
+		r.skip(8);
+		break;
+	case DW_FORM_data16:
+		r.skip(16);
+		break;
+	case DW_FORM_addr:
+		r.skip(address_size);
+		break;
+	case DW_FORM_ref_addr:
+		r.skip(version == 2 ? address_size : offset_size);
+		break;
+	case DW_FORM_strp:
+	case DW_FORM_line_strp:
+	case DW_FORM_sec_offset:
+	case DW_FORM_strp_sup:
+	case DW_FORM_GNU_ref_alt:
+	case DW_FORM_GNU_strp_alt:
+		r.skip(offset_size);
+		break;
+	case DW_FORM_sdata:
+		r.sleb();
+		break;
+	case DW_FORM_udata:
+	case DW_FORM_ref_udata:
+	case DW_FORM_strx:
+	case DW_FORM_addrx:
+	case DW_FORM_loclistx:
+	case DW_FORM_rnglistx:
+	case DW_FORM_GNU_addr_index:
+	case DW_FORM_GNU_str_index:
+		r.uleb();
+		break;
+	case DW_FORM_string:
+		r.str();
+		break;
+	case DW_FORM_block1:
+		r.skip(r.u(1));
+		break;
+	case DW_FORM_block2:
+		r.skip(r.u(2));
+		break;
+	case DW_FORM_block4:
+		r.skip(r.u(4));
+		break;
+	case DW_FORM_block:
+	case DW_FORM_exprloc:
+		r.skip(r.uleb());
+		break;
+	case DW_FORM_indirect:
+		return skip_form(r, r.uleb(), offset_size, address_size,
+		                 version);
+	default:
+		return false;
+	}
+
+	return r.ok();
+}
+
+
+/**
+ * Read a string or an unsigned attribute value of a DWARF 5 line program
+ * header entry in str or value. Return false for a form which can't be
+ * read without other sections.
+ */
+bool read_entry_form(dwarf_reader & r, u64 form, size_t offset_size,
+                     debug_sections const & sections, char const * & str,
+                     u64 & value)
+{
+	str = 0;
+	value = 0;
+
+	switch (form) {
+	case DW_FORM_string:
+		str = r.str();
+		break;
+	case DW_FORM_line_strp:
+		str = section_string(sections.line_str, r.u(offset_size));
+		break;
+	case DW_FORM_strp:
+		str = section_string(sections.str, r.u(offset_size));
+		break;
+	case DW_FORM_data1:
+		value = r.u(1);
+		break;
+	case DW_FORM_data2:
+		value = r.u(2);
+		break;
+	case DW_FORM_data4:
+		value = r.u(4);
+		break;
+	case DW_FORM_data8:
+		value = r.u(8);
+		break;
+	case DW_FORM_udata:
+		value = r.uleb();
+		break;
+	default:
+		return skip_form(r, form, offset_size, 0, 5);
+	}
+
+	return r.ok();
+}
+
+
+/// the DWARF 5 directory or file name entries, as (content type, form)
+typedef vector<pair<u64, u64> > entry_format_t;
+
+bool read_entry_format(dwarf_reader & r, entry_format_t & format)
+{
+	size_t const count = r.u(1);
+	for (size_t i = 0; i < count && r.ok(); ++i) {
+		u64 const type = r.uleb();
+		format.push_back(make_pair(type, r.uleb()));
+	}
+	return r.ok();
+}
+
+
+bool is_absolute(string const & path)
+{
+	return !path.empty() && path[0] == '/';
+}
+
+} // anonymous namespace
+
+
+debug_line_table::debug_line_table(debug_sections const & sections)
+{
+	comp_dirs_t comp_dirs;
+	read_comp_dirs(sections, comp_dirs);
+
+	size_t offset = 0;
+	while (offset < sections.line.size()) {
+		offset = read_line_program(sections, comp_dirs, offset);
+		if (!offset)
+			break;
+	}
+
+	vector<sequence> sorted;
+	sorted.swap(sequences);
+	// stable so overlapping sequences keep the .debug_line order
+	stable_sort(sorted.begin(), sorted.end(), less_low());
+	sequences.swap(sorted);
+
+	max_high.resize(sequences.size());
+	u64 high = 0;
+	for (size_t i = 0; i < sequences.size(); ++i) {
+		high = max(high, sequences[i].high);
+		max_high[i] = high;
+	}
+}
+
+
+void debug_line_table::read_comp_dirs(debug_sections const & sections,
+                                      comp_dirs_t & comp_dirs) const
+{
+	size_t offset = 0;
+	while (offset < sections.info.size()) {
+		dwarf_reader r(sections.info, offset, sections.big_endian);
+		size_t offset_size;
+		offset = r.unit_length(offset_size);
+		if (!offset)
+			return;
+
+		unsigned int const version = r.u(2);
+		u64 abbrev_offset;
+		size_t address_size;
+		if (version >= 2 && version <= 4) {
+			abbrev_offset = r.u(offset_size);
+			address_size = r.u(1);
+		} else if (version == 5) {
+			unsigned int const unit_type = r.u(1);
+			address_size = r.u(1);
+			abbrev_offset = r.u(offset_size);
+			if (unit_type == DW_UT_skeleton ||
+			    unit_type == DW_UT_split_compile)
+				r.skip(8);
+			else if (unit_type == DW_UT_type ||
+			         unit_type == DW_UT_split_type)
+				r.skip(8 + offset_size);
+		} else {
+			continue;
+		}
+
+		u64 const code = r.uleb();
+		if (!r.ok() || abbrev_offset >= sections.abbrev.size())
+			continue;
+
+		// find the abbreviation of the unit DIE
+		dwarf_reader a(sections.abbrev, abbrev_offset,
+		               sections.big_endian);
+		u64 tag = 0;
+		while (!a.at_end()) {
+			u64 const entry_code = a.uleb();
+			if (!entry_code) {
+				tag = 0;
+				break;
+			}
+			tag = a.uleb();
+			a.skip(1);
+			if (entry_code == code)
+				break;
+			u64 name;
+			do {
+				name = a.uleb();
+				u64 const form = a.uleb();
+				if (form == DW_FORM_implicit_const)
+					a.sleb();
+				if (!name && !form)
+					break;
+			} while (a.ok());
+		}
+
+		if (!a.ok() ||
+		    (tag != DW_TAG_compile_unit && tag != DW_TAG_partial_unit))
+			continue;
+
+		bool has_stmt_list = false;
+		u64 stmt_list = 0;
+		comp_dir_info info;
+		info.status = comp_dir_none;
+
+		while (a.ok()) {
+			u64 const name = a.uleb();
+			u64 const form = a.uleb();
+			if (form == DW_FORM_implicit_const)
+				a.sleb();
+			if (!name && !form)
+				break;
+
+			if (name == DW_AT_stmt_list &&
+			    (form == DW_FORM_data4 || form == DW_FORM_data8 ||
+			     form == DW_FORM_sec_offset)) {
+				size_t const size = form == DW_FORM_data4 ? 4 :
+					form == DW_FORM_data8 ? 8 : offset_size;
+				stmt_list = r.u(size);
+				has_stmt_list = r.ok();
+				continue;
+			}
+
+			if (name == DW_AT_comp_dir) {
+				char const * dir = 0;
+				if (form == DW_FORM_string)
+					dir = r.str();
+				else if (form == DW_FORM_strp)
+					dir = section_string(sections.str,
+						r.u(offset_size));
+				else if (form == DW_FORM_line_strp)
+					dir = section_string(sections.line_str,
+						r.u(offset_size));
+				else if (!skip_form(r, form, offset_size,
+				                    address_size, version))
+					break;
+				if (dir) {
+					info.status = comp_dir_known;
+					info.dir = dir;
+				} else {
+					// in a section we don't read
+					info.status = comp_dir_unknown;
+				}
+				continue;
+			}
+
+			if (!skip_form(r, form, offset_size, address_size,
+			               version)) {
+				// the other attributes can't be read
+				if (info.status == comp_dir_none)
+					info.status = comp_dir_unknown;
+				break;
+			}
+		}
+
+		if (!a.ok() || !r.ok()) {
+			if (info.status == comp_dir_none)
+				info.status = comp_dir_unknown;
+		}
+
+		if (has_stmt_list)
+			comp_dirs[stmt_list] = info;
+	}
+}
+
+
+size_t debug_line_table::read_line_program(debug_sections const & sections,
+	comp_dirs_t const & comp_dirs, size_t offset)
+{
+	dwarf_reader r(sections.line, offset, sections.big_endian);
+	size_t offset_size;
+	size_t const next = r.unit_length(offset_size);
+	if (!next)
+		return 0;
+
+	unit u;
+	u.version = r.u(2);
+	if (u.version < 2 || u.version > 5)
+		return next;
+
+	if (u.version >= 5) {
+		r.u(1);			// address_size
+		if (r.u(1))		// segment_selector_size
+			return next;
+	}
+
+	u64 const header_length = r.u(offset_size);
+	if (!r.ok() || header_length > r.end - r.pos)
+		return next;
+	size_t const program = r.pos + header_length;
+
+	unsigned int const min_inst_length = r.u(1);
+	if (u.version >= 4 && r.u(1) != 1) {
+		// VLIW op_index isn't handled
+		return next;
+	}
+	r.u(1);				// default_is_stmt
+	int const line_base = static_cast<signed char>(r.u(1));
+	unsigned int const line_range = r.u(1);
+	unsigned int const opcode_base = r.u(1);
+	if (!r.ok() || !line_range || !opcode_base)
+		return next;
+
+	vector<unsigned int> opcode_lengths(opcode_base, 0);
+	for (size_t i = 1; i < opcode_base; ++i)
+		opcode_lengths[i] = r.u(1);
+
+	if (u.version < 5) {
+		char const * name;
+		while ((name = r.str()) && *name)
+			u.dirs.push_back(name);
+		while ((name = r.str()) && *name) {
+			file_entry file;
+			file.name = name;
+			file.dir = r.uleb();
+			r.uleb();	// mtime
+			r.uleb();	// length
+			u.files.push_back(file);
+		}
+	} else {
+		entry_format_t format;
+		read_entry_format(r, format);
+		u64 count = r.uleb();
+		for (u64 i = 0; i < count && r.ok(); ++i) {
+			string dir;
+			for (size_t j = 0; j < format.size(); ++j) {
+				char const * str;
+				u64 value;
+				if (!read_entry_form(r, format[j].second,
+				                     offset_size, sections,
+				                     str, value))
+					return next;
+				if (format[j].first == DW_LNCT_path) {
+					if (!str)
+						return next;
+					dir = str;
+				}
+			}
+			u.dirs.push_back(dir);
+		}
+
+		format.clear();
+		read_entry_format(r, format);
+		count = r.uleb();
+		for (u64 i = 0; i < count && r.ok(); ++i) {
+			file_entry file;
+			file.dir = 0;
+			for (size_t j = 0; j < format.size(); ++j) {
+				char const * str;
+				u64 value;
+				if (!read_entry_form(r, format[j].second,
+				                     offset_size, sections,
+				                     str, value))
+					return next;
+				if (format[j].first == DW_LNCT_path) {
+					if (!str)
+						return next;
+					file.name = str;
+				} else if (format[j].first ==
+				           DW_LNCT_directory_index) {
+					file.dir = value;
+				}
+			}
+			u.files.push_back(file);
+		}
+	}
+
+	if (!r.ok())
+		return next;
+
+	comp_dirs_t::const_iterator it = comp_dirs.find(offset);
+	if (it != comp_dirs.end()) {
+		u.comp_dir_status = it->second.status;
+		u.comp_dir = it->second.dir;
+	} else {
+		// bfd reaches a line program only through its unit
+		u.comp_dir_status = comp_dir_unknown;
+	}
+
+	size_t const unit_index = units.size();
+	units.push_back(u);
+
+	// bfd starts a DWARF 5 sequence in the primary source file 0, not in
+	// the file 1 of the standard
+	u32 const first_file = u.version >= 5 ? 0 : 1;
+
+	// the state machine registers
+	u64 address = 0;
+	u32 file = first_file;
+	long long line = 1;
+	vector<row> seq_rows;
+
+	r.pos = program;
+	while (!r.at_end()) {
+		unsigned int const opcode = r.u(1);
+
+		if (opcode >= opcode_base) {
+			unsigned int const adjusted = opcode - opcode_base;
+			address += (adjusted / line_range) * min_inst_length;
+			line += line_base + int(adjusted % line_range);
+		} else if (opcode == 0) {
+			u64 const length = r.uleb();
+			if (!length || length > r.end - r.pos)
+				break;
+			size_t const end = r.pos + length;
+			unsigned int const sub_opcode = r.u(1);
+			if (sub_opcode == DW_LNE_end_sequence) {
+				add_sequence(seq_rows, address, unit_index);
+				address = 0;
+				file = first_file;
+				line = 1;
+			} else if (sub_opcode == DW_LNE_set_address) {
+				size_t const size = length - 1;
+				if (size == 1 || size == 2 || size == 4 ||
+				    size == 8)
+					address = r.u(size);
+			} else if (sub_opcode == DW_LNE_define_file) {
+				file_entry entry;
+				char const * name = r.str();
+				entry.name = name ? name : "";
+				entry.dir = r.uleb();
+				units[unit_index].files.push_back(entry);
+			}
+			r.pos = end;
+			continue;
+		} else {
+			switch (opcode) {
+			case DW_LNS_advance_pc:
+				address += r.uleb() * min_inst_length;
+				break;
+			case DW_LNS_advance_line:
+				line += r.sleb();
+				break;
+			case DW_LNS_set_file:
+				file = r.uleb();
+				break;
+			case DW_LNS_const_add_pc:
+				address += ((255 - opcode_base) / line_range) *
+					min_inst_length;
+				break;
+			case DW_LNS_fixed_advance_pc:
+				address += r.u(2);
+				break;
+			default:
+				for (size_t i = 0; i < opcode_lengths[opcode];
+				     ++i)
+					r.uleb();
+				break;
+			}
+			if (opcode != DW_LNS_copy)
+				continue;
+		}
+
+		if (!r.ok())
+			break;
+
+		// DW_LNS_copy or a special opcode append a row
+		row new_row;
+		new_row.address = address;
+		new_row.file = file;
+		new_row.line = line < 0 ? 0 : u32(line);
+		// as bfd, keep only the last row at a given address
+		if (!seq_rows.empty() && seq_rows.back().address == address)
+			seq_rows.back() = new_row;
+		else
+			seq_rows.push_back(new_row);
+	}
+
+	// the rows of a sequence not ended are dropped
+	return next;
+}
+
+
+void debug_line_table::add_sequence(vector<row> & seq_rows, u64 end_address,
+                                    size_t unit_index)
+{
+	// a row at the end address covers nothing
+	if (!seq_rows.empty() && seq_rows.back().address == end_address)
+		seq_rows.pop_back();
+
+	if (seq_rows.empty())
+		return;
+
+	// a sequence must cover increasing addresses
+	bool sorted = seq_rows.back().address < end_address;
+	for (size_t i = 1; sorted && i < seq_rows.size(); ++i) {
+		if (seq_rows[i].address < seq_rows[i - 1].address)
+			sorted = false;
+	}
+
+	if (sorted) {
+		sequence seq;
+		seq.low = seq_rows.front().address;
+		seq.high = end_address;
+		seq.first = rows.size();
+		seq.last = rows.size() + seq_rows.size();
+		seq.unit = unit_index;
+		rows.insert(rows.end(), seq_rows.begin(), seq_rows.end());
+		sequences.push_back(seq);
+	}
+
+	seq_rows.clear();
+}
+
+
+size_t debug_line_table::find_sequence(u64 address) const
+{
+	size_t i = upper_bound(sequences.begin(), sequences.end(), address,
+	                       less_low()) - sequences.begin();
+
+	// the sequences starting before address, walk back while one of
+	// them may still cover it
+	while (i > 0 && max_high[i - 1] > address) {
+		--i;
+		if (address < sequences[i].high)
+			return i;
+	}
+
+	return ~size_t(0);
+}
+
+
+bool debug_line_table::get_filename(unit const & u, u32 file,
+                                    string & name) const
+{
+	// see concat_filename() in bfd/dwarf2.c
+	size_t index = file;
+	if (u.version < 5) {
+		if (!index)
+			return false;
+		--index;
+	}
+	if (index >= u.files.size())
+		return false;
+
+	file_entry const & entry = u.files[index];
+	if (is_absolute(entry.name)) {
+		name = entry.name;
+		return true;
+	}
+
+	size_t dir = entry.dir;
+	if (u.version < 5)
+		--dir;
+
+	string const * subdir = dir < u.dirs.size() ? &u.dirs[dir] : 0;
+	string const * dir_name = 0;
+	if (!subdir || !is_absolute(*subdir)) {
+		if (u.comp_dir_status == comp_dir_unknown)
+			return false;
+		if (u.comp_dir_status == comp_dir_known)
+			dir_name = &u.comp_dir;
+	}
+	if (!dir_name) {
+		dir_name = subdir;
+		subdir = 0;
+	}
+
+	if (!dir_name)
+		name = entry.name;
+	else if (subdir)
+		name = *dir_name + '/' + *subdir + '/' + entry.name;
+	else
+		name = *dir_name + '/' + entry.name;
+
+	return true;
+}
+
+
+bool debug_line_table::find(u64 address, string & filename,
+                            unsigned int & linenr, cursor & pos) const
+{
+	sequence const * seq = pos.seq < sequences.size()
+		? &sequences[pos.seq] : 0;
+
+	if (seq && seq->low <= address && address < seq->high &&
+	    rows[pos.row].address <= address) {
+		// walk from the previous row
+		while (pos.row + 1 < seq->last &&
+		       rows[pos.row + 1].address <= address)
+			++pos.row;
+	} else {
+		pos.seq = find_sequence(address);
+		if (pos.seq == ~size_t(0))
+			return false;
+		seq = &sequences[pos.seq];
+		pos.row = upper_bound(rows.begin() + seq->first,
+		                      rows.begin() + seq->last, address,
+		                      less_address()) - rows.begin() - 1;
+	}
+
+	row const & r = rows[pos.row];
+	if (!r.line)
+		return false;
+
+	if (!get_filename(units[seq->unit], r.file, filename))
+		return false;
+
+	linenr = r.line;
+	return true;
+}
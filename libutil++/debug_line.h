@@ -0,0 +1,156 @@
+/**
+ * @file debug_line.h
+ * Address to source line table decoded from the DWARF line programs
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef DEBUG_LINE_H
+#define DEBUG_LINE_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "op_types.h"
+
+/// the contents of the DWARF sections of a binary, empty if missing
+struct debug_sections {
+	debug_sections() : big_endian(false) {}
+
+	std::string line;
+	std::string info;
+	std::string abbrev;
+	std::string str;
+	std::string line_str;
+	/// byte order of the binary
+	bool big_endian;
+};
+
+
+/**
+ * The rows of all the line programs of a binary, decoded once and sorted
+ * by address. A lookup gives the same file name and line number as
+ * bfd_find_nearest_line() for an address a line program covers; find()
+ * returns false for the addresses this table can't answer the same way,
+ * bfd must be asked for them.
+ */
+class debug_line_table {
+public:
+	/// decode the line programs in sections
+	debug_line_table(debug_sections const & sections);
+
+	/// true if at least one address is covered
+	bool valid() const { return !rows.empty(); }
+
+	/// the rows last used by find(), to walk from them to the next address
+	class cursor {
+	public:
+		cursor() : seq(~size_t(0)), row(0) {}
+	private:
+		friend class debug_line_table;
+		size_t seq;
+		size_t row;
+	};
+
+	/**
+	 * Return in filename and linenr the source line of the instruction
+	 * at address, false if there is no such line or if it is line 0.
+	 * The row found is kept in pos: for addresses in increasing order
+	 * the lookups are a single walk over the rows.
+	 */
+	bool find(u64 address, std::string & filename, unsigned int & linenr,
+	          cursor & pos) const;
+
+private:
+	struct row {
+		u64 address;
+		u32 file;
+		u32 line;
+	};
+
+	/// the rows [first, last) of a sequence, covering [low, high)
+	struct sequence {
+		u64 low;
+		u64 high;
+		size_t first;
+		size_t last;
+		size_t unit;
+	};
+
+	struct less_low {
+		bool operator()(sequence const & lhs,
+		                sequence const & rhs) const {
+			return lhs.low < rhs.low;
+		}
+		bool operator()(u64 address, sequence const & seq) const {
+			return address < seq.low;
+		}
+	};
+
+	struct less_address {
+		bool operator()(u64 address, row const & r) const {
+			return address < r.address;
+		}
+	};
+
+	struct file_entry {
+		std::string name;
+		u32 dir;
+	};
+
+	enum comp_dir_state {
+		/// the unit has no DW_AT_comp_dir
+		comp_dir_none,
+		comp_dir_known,
+		/// the compilation unit DIE couldn't be read
+		comp_dir_unknown
+	};
+
+	/// a line program and the compilation unit it belongs to
+	struct unit {
+		unsigned int version;
+		comp_dir_state comp_dir_status;
+		std::string comp_dir;
+		std::vector<std::string> dirs;
+		std::vector<file_entry> files;
+	};
+
+	struct comp_dir_info {
+		comp_dir_info() : status(comp_dir_unknown) {}
+		comp_dir_state status;
+		std::string dir;
+	};
+
+	/// comp_dir of the units in .debug_info, by their line program offset
+	typedef std::map<u64, comp_dir_info> comp_dirs_t;
+
+	/// read the compilation unit DIEs in .debug_info
+	void read_comp_dirs(debug_sections const & sections,
+	                    comp_dirs_t & comp_dirs) const;
+
+	/// decode the line program at offset, return the offset of the next
+	/// one or 0 if the following data can't be trusted
+	size_t read_line_program(debug_sections const & sections,
+	                         comp_dirs_t const & comp_dirs, size_t offset);
+
+	/// append a sequence built from rows ended at end_address
+	void add_sequence(std::vector<row> & seq_rows, u64 end_address,
+	                  size_t unit_index);
+
+	/// index of the sequence covering address, or ~0
+	size_t find_sequence(u64 address) const;
+
+	/// build the file name as bfd does, false if it can't
+	bool get_filename(unit const & u, u32 file, std::string & name) const;
+
+	std::vector<row> rows;
+	/// sorted by low
+	std::vector<sequence> sequences;
+	/// max_high[i] is the highest end of sequences [0, i]
+	std::vector<u64> max_high;
+	std::vector<unit> units;
+};
+
+#endif /* !DEBUG_LINE_H */
@@ -14,6 +14,7 @@
 #include "config.h"
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <cstring>
 
 #include <sys/stat.h>
@@ -28,6 +29,7 @@
 #include "op_bfd.h"
 #include "locate_images.h"
 #include "string_filter.h"
+#include "symbol_cache.h"
 #include "stream_util.h"
 #include "cverb.h"
 
@@ -86,6 +88,17 @@ op_bfd_symbol::op_bfd_symbol(bfd_vma vma, size_t size, string const & name)
 }
 
 
+op_bfd_symbol::op_bfd_symbol(cached_symbol const & sym)
+	: bfd_symbol(0), symb_value(sym.value),
+	  section_filepos(sym.section_filepos),
+	  section_vma(sym.section_vma),
+	  symb_size(sym.size), symb_name(sym.name),
+	  symb_hidden(sym.hidden), symb_weak(sym.weak),
+	  symb_artificial(false)
+{
+}
+
+
 bool op_bfd_symbol::operator<(op_bfd_symbol const & rhs) const
 {
 	return filepos() < rhs.filepos();
@@ -104,20 +117,18 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 	archive_path(extra_images.get_archive_path()),
 	extra_found_images(extra_images),
 	file_size(-1),
-	anon_obj(false)
+	anon_obj(false),
+	symbol_filter(symbol_filter),
+	from_cache(false)
 {
-	int fd;
-	struct stat st;
 	// after creating all symbol it's convenient for user code to access
 	// symbols through a vector. We use an intermediate list to avoid a
 	// O(N) behavior when we will filter vector element below
 	symbols_found_t symbols;
-	asection const * sect;
 	string suf = ".jo";
 
 	image_error img_ok;
-	string const image_path =
-		extra_images.find_image_path(filename, img_ok, true);
+	image_path = extra_images.find_image_path(filename, img_ok, true);
 
 	cverb << vbfd << "op_bfd ctor for " << image_path << endl;
 
@@ -127,17 +138,47 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 		goto out_fail;
 	}
 
-	fd = open(image_path.c_str(), O_RDONLY);
-	if (fd == -1) {
-		cverb << vbfd << "open failed for " << image_path << endl;
+	if (load_cached_symbols(symbols)) {
+		from_cache = true;
+	} else if (open_image(symbols)) {
+		save_cached_symbols(symbols);
+	} else {
 		ok = false;
 		goto out_fail;
 	}
 
+	string::size_type pos;
+	pos = filename.rfind(suf);
+	if (pos != string::npos && pos == filename.size() - suf.size())
+		anon_obj = true;
+
+out:
+	add_symbols(symbols, symbol_filter);
+	return;
+out_fail:
+	ibfd.close();
+	dbfd.close();
+	// make the fake symbol fit within the fake file
+	file_size = -1;
+	goto out;
+}
+
+
+bool op_bfd::open_image(symbols_found_t & symbols)
+{
+	struct stat st;
+	asection const * sect;
+
+	int fd = open(image_path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		cverb << vbfd << "open failed for " << image_path << endl;
+		return false;
+	}
+
 	if (fstat(fd, &st)) {
 		cverb << vbfd << "stat failed for " << image_path << endl;
-		ok = false;
-		goto out_fail;
+		close(fd);
+		return false;
 	}
 
 	file_size = st.st_size;
@@ -146,16 +187,9 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 
 	if (!ibfd.valid()) {
 		cverb << vbfd << "fdopen_bfd failed for " << image_path << endl;
-		ok = false;
-		goto out_fail;
+		return false;
 	}
 
-	string::size_type pos;
-	pos = filename.rfind(suf);
-	if (pos != string::npos && pos == filename.size() - suf.size())
-		anon_obj = true;
-
-
 	// find .text and use it
 	for (sect = ibfd.abfd->sections; sect; sect = sect->next) {
 		if (sect->flags & SEC_CODE) {
@@ -175,15 +209,105 @@ op_bfd::op_bfd(string const & fname, string_filter const & symbol_filter,
 
 	get_symbols(symbols);
 
-out:
-	add_symbols(symbols, symbol_filter);
-	return;
-out_fail:
-	ibfd.close();
-	dbfd.close();
-	// make the fake symbol fit within the fake file
-	file_size = -1;
-	goto out;
+	return true;
+}
+
+
+bool op_bfd::load_cached_symbols(symbols_found_t & symbols)
+{
+	symbol_cache_entry entry;
+
+	if (!load_symbol_cache(image_path, entry))
+		return false;
+
+	cverb << vbfd << "symbols of " << image_path << " read from the cache"
+	      << endl;
+
+	file_size = entry.file_size;
+	debug_filename = entry.debug_filename;
+	debug_info.reset(entry.has_debug_info);
+
+	for (size_t i = 0; i < entry.sections.size(); ++i)
+		filepos_map[entry.sections[i].first] = entry.sections[i].second;
+
+	for (size_t i = 0; i < entry.symbols.size(); ++i)
+		symbols.push_back(op_bfd_symbol(entry.symbols[i]));
+
+	return true;
+}
+
+
+void op_bfd::save_cached_symbols(symbols_found_t const & symbols) const
+{
+	if (!symbol_cache_enabled())
+		return;
+
+	// a debug file installed later must be used, so an image which
+	// names one we didn't find is not cached
+	if (debug_filename.empty() && !ibfd.has_debug_info() &&
+	    bfd_get_section_by_name(ibfd.abfd, ".gnu_debuglink")) {
+		cverb << vbfd << "debug file of " << image_path
+		      << " not found, symbols not cached" << endl;
+		return;
+	}
+
+	symbol_cache_entry entry;
+	entry.image_path = image_path;
+	entry.file_size = file_size;
+	entry.debug_filename = debug_filename;
+	entry.has_debug_info = has_debug_info();
+	entry.sections.assign(filepos_map.begin(), filepos_map.end());
+
+	symbols_found_t::const_iterator it = symbols.begin();
+	for (; it != symbols.end(); ++it) {
+		cached_symbol sym;
+		sym.name = it->name();
+		sym.value = it->value();
+		sym.section_filepos = it->filepos() - it->value();
+		sym.section_vma = it->vma() - it->value();
+		sym.size = it->size();
+		sym.hidden = it->hidden();
+		sym.weak = it->weak();
+		entry.symbols.push_back(sym);
+	}
+
+	cverb << vbfd << "saving the symbols of " << image_path
+	      << " in the cache" << endl;
+
+	save_symbol_cache(entry);
+}
+
+
+void op_bfd::load_bfd() const
+{
+	if (!from_cache)
+		return;
+
+	cverb << vbfd << "opening " << image_path
+	      << " for its symbols cached bfd" << endl;
+
+	op_bfd & self = const_cast<op_bfd &>(*this);
+	size_t const nr_syms = syms.size();
+	symbols_found_t symbols;
+
+	self.from_cache = false;
+	self.filepos_map.clear();
+	self.debug_info = cached_value<bool>();
+	ordered_ranges = cached_value<bool>();
+	debug_filename.erase();
+
+	if (!self.open_image(symbols)) {
+		throw op_fatal_error("op_bfd: can't open " + image_path +
+		                     " whose symbols were cached");
+	}
+
+	self.syms.clear();
+	self.add_symbols(symbols, symbol_filter);
+
+	if (syms.size() != nr_syms) {
+		throw op_fatal_error("op_bfd: " + image_path +
+		                     " changed since its symbols were read");
+	}
 }
 
 
@@ -300,6 +424,8 @@ void op_bfd::add_symbols(op_bfd::symbols_found_t & symbols,
 
 bfd_vma op_bfd::offset_to_pc(bfd_vma offset) const
 {
+	load_bfd();
+
 	asection const * sect = ibfd.abfd->sections;
 
 	for (; sect; sect = sect->next) {
@@ -315,6 +441,11 @@ bfd_vma op_bfd::offset_to_pc(bfd_vma offset) const
 bool op_bfd::
 symbol_has_contents(symbol_index_t sym_idx)
 {
+	if (syms[sym_idx].artificial())
+		return false;
+
+	load_bfd();
+
 	op_bfd_symbol const & bfd_sym = syms[sym_idx];
 	string const name = bfd_sym.name();
 	if (name.size() == 0 || bfd_sym.artificial() || !ibfd.valid())
@@ -326,6 +457,8 @@ symbol_has_contents(symbol_index_t sym_idx)
 bool op_bfd::
 get_symbol_contents(symbol_index_t sym_index, unsigned char * contents) const
 {
+	load_bfd();
+
 	op_bfd_symbol const & bfd_sym = syms[sym_index];
 	size_t size = bfd_sym.size();
 
@@ -368,6 +501,12 @@ bool op_bfd::has_debug_info() const
 bool op_bfd::get_linenr(symbol_index_t sym_idx, bfd_vma offset,
 			string & source_filename, unsigned int & linenr) const
 {
+	// the cached value avoids opening an image without debug info
+	if (!has_debug_info())
+		return false;
+
+	load_bfd();
+
 	if (!has_debug_info())
 		return false;
 
@@ -385,6 +524,39 @@ bool op_bfd::get_linenr(symbol_index_t sym_idx, bfd_vma offset,
 }
 
 
+void op_bfd::get_linenrs(symbol_index_t sym_idx,
+                         vector<bfd_vma> const & offsets,
+                         vector<linenr_info> & infos) const
+{
+	linenr_info none;
+	none.found = false;
+	none.line = 0;
+	infos.assign(offsets.size(), none);
+
+	// the cached value avoids opening an image without debug info
+	if (!has_debug_info())
+		return;
+
+	load_bfd();
+
+	if (!has_debug_info())
+		return;
+
+	bfd_info const & b = dbfd.valid() ? dbfd : ibfd;
+
+	if (!line_table.get()) {
+		debug_sections sections;
+		if (read_debug_sections(b, sections))
+			cverb << vbfd << "decoding the line programs of "
+			      << bfd_get_filename(b.abfd) << endl;
+		line_table.reset(new debug_line_table(sections));
+	}
+
+	find_nearest_lines(b, *line_table, syms[sym_idx], offsets, anon_obj,
+	                   infos);
+}
+
+
 size_t op_bfd::symbol_size(op_bfd_symbol const & sym,
 			   op_bfd_symbol const * next) const
 {
@@ -407,11 +579,7 @@ void op_bfd::get_symbol_range(symbol_index_t sym_idx,
 
 	bool const verbose = cverb << (vbfd & vlevel1);
 
-	if (anon_obj)
-		start = sym.vma();
-	else
-		start = sym.filepos();
-	end = start + sym.size();
+	symbol_range(sym_idx, start, end);
 
 	if (!verbose)
 		return;
@@ -431,6 +599,55 @@ void op_bfd::get_symbol_range(symbol_index_t sym_idx,
 }
 
 
+void op_bfd::symbol_range(symbol_index_t sym_idx,
+                          unsigned long long & start,
+                          unsigned long long & end) const
+{
+	op_bfd_symbol const & sym = syms[sym_idx];
+
+	if (anon_obj)
+		start = sym.vma();
+	else
+		start = sym.filepos();
+	end = start + sym.size();
+}
+
+
+symbol_index_t op_bfd::next_symbol(symbol_index_t first,
+                                   unsigned long long offset) const
+{
+	unsigned long long start, end;
+
+	if (!ordered_ranges.cached()) {
+		bool ordered = true;
+		unsigned long long prev_end = 0;
+		for (symbol_index_t i = 0; ordered && i < syms.size(); ++i) {
+			symbol_range(i, start, end);
+			ordered = start >= prev_end && end >= start;
+			prev_end = end;
+		}
+		ordered_ranges.reset(ordered);
+	}
+
+	if (!ordered_ranges.get())
+		return first;
+
+	// the ranges ends are increasing, binary search the first one
+	// after offset
+	symbol_index_t last = syms.size();
+	while (first < last) {
+		symbol_index_t const mid = first + (last - first) / 2;
+		symbol_range(mid, start, end);
+		if (end <= offset)
+			first = mid + 1;
+		else
+			last = mid;
+	}
+
+	return first;
+}
+
+
 void op_bfd::get_vma_range(bfd_vma & start, bfd_vma & end) const
 {
 	if (!syms.empty()) {
@@ -464,6 +681,8 @@ string op_bfd::get_filename() const
 
 size_t op_bfd::bfd_arch_bits_per_address() const
 {
+	load_bfd();
+
 	if (ibfd.valid())
 		return ::bfd_arch_bits_per_address(ibfd.abfd);
 	// FIXME: this function should be called only if the underlined ibfd
@@ -21,14 +21,16 @@
 #include <set>
 
 #include "bfd_support.h"
+#include "debug_line.h"
 #include "locate_images.h"
 #include "utility.h"
 #include "cached_value.h"
+#include "string_filter.h"
 #include "op_types.h"
 
 class op_bfd;
-class string_filter;
 class extra_images;
+struct cached_symbol;
 
 /// all symbol vector indexing uses this type
 typedef size_t symbol_index_t;
@@ -47,6 +49,10 @@ public:
 	/// ctor for artificial symbols
 	op_bfd_symbol(bfd_vma vma, size_t size, std::string const & name);
 
+	/// ctor for real symbols read from the symbol cache, they have no
+	/// bfd symbol until op_bfd reopens the image
+	op_bfd_symbol(cached_symbol const & sym);
+
 	bfd_vma vma() const { return symb_value + section_vma; }
 	unsigned long value() const { return symb_value; }
 	unsigned long filepos() const { return symb_value + section_filepos; }
@@ -139,6 +145,20 @@ public:
 	bool get_linenr(symbol_index_t sym_idx, bfd_vma offset,
 			std::string & filename, unsigned int & linenr) const;
 
+	/**
+	 * @param sym_idx index of the symbol
+	 * @param offsets fentry numbers, in increasing order
+	 * @param infos output parameter, the filename:linenr of each offset
+	 *
+	 * get_linenr() for all the samples of a symbol at once. The DWARF
+	 * line programs of the binary are decoded on the first call, the
+	 * offsets are then resolved by a walk over their rows instead of
+	 * a bfd lookup each.
+	 */
+	void get_linenrs(symbol_index_t sym_idx,
+	                 std::vector<bfd_vma> const & offsets,
+	                 std::vector<linenr_info> & infos) const;
+
 	/**
 	 * @param sym_idx symbol index
 	 * @param start reference to start var
@@ -154,6 +174,18 @@ public:
 	void get_symbol_range(symbol_index_t sym_idx,
 			      unsigned long long & start, unsigned long long & end) const;
 
+	/**
+	 * @param first index of the first symbol to consider
+	 * @param offset a sample offset, as the ones of get_symbol_range()
+	 *
+	 * Return the index of the first symbol from first whose range ends
+	 * after offset, so the symbols skipped can't hold a sample at or
+	 * after offset. Return first if the symbol ranges overlap or are not
+	 * in increasing order, nothing can be skipped then.
+	 */
+	symbol_index_t next_symbol(symbol_index_t first,
+	                           unsigned long long offset) const;
+
 	/**
 	 * @param start reference to the start vma
 	 * @param end reference to the end vma
@@ -210,12 +242,32 @@ public:
 	bool get_symbol_contents(symbol_index_t sym_index,
 		unsigned char * contents) const;
 
-	bool valid() const { return ibfd.valid(); }
+	bool valid() const { return ibfd.valid() || from_cache; }
 
 private:
 	/// temporary container type for getting symbols
 	typedef std::list<op_bfd_symbol> symbols_found_t;
 
+	/**
+	 * Open image_path and read its sections and symbols, return false
+	 * if it can't be read as a bfd.
+	 */
+	bool open_image(symbols_found_t & symbols);
+
+	/// read the sections and symbols from the symbol cache if possible
+	bool load_cached_symbols(symbols_found_t & symbols);
+
+	/// save the sections and symbols just read from the image in the
+	/// symbol cache if it is enabled
+	void save_cached_symbols(symbols_found_t const & symbols) const;
+
+	/**
+	 * If the symbols came from the symbol cache, open the image now:
+	 * the operations which need the bfd call this first. The symbols
+	 * are read again so they refer to the bfd symbols.
+	 */
+	void load_bfd() const;
+
 	/**
 	 * Parse and sort in ascending order all symbols
 	 * in the file pointed to by abfd that reside in
@@ -261,6 +313,9 @@ private:
 	/// filename we open (not including archive path)
 	std::string filename;
 
+	/// the image file we open
+	std::string image_path;
+
 	/// path to archive
 	std::string archive_path;
 
@@ -282,6 +337,9 @@ private:
 	// corresponding debug bfd object, if one is found
 	mutable bfd_info dbfd;
 
+	/// the line programs of dbfd or ibfd, built by get_linenrs()
+	mutable scoped_ptr<debug_line_table> line_table;
+
 	/// sections we will avoid to use symbol from, this is needed
 	/// because elf file allows sections with identical vma and we can't
 	/// allow overlapping symbols. Such elf layout is used actually by
@@ -299,6 +357,20 @@ private:
 	std::string embedding_filename;
 
 	bool anon_obj;
+
+	/// range of a symbol as get_symbol_range() computes it
+	void symbol_range(symbol_index_t sym_idx, unsigned long long & start,
+	                  unsigned long long & end) const;
+
+	/// true if the symbol ranges are disjoint and sorted, see next_symbol()
+	mutable cached_value<bool> ordered_ranges;
+
+	/// filter applied to the symbols, kept to apply it again in load_bfd()
+	string_filter symbol_filter;
+
+	/// true if the symbols came from the symbol cache and the image is
+	/// not opened yet
+	bool from_cache;
 };
 
 
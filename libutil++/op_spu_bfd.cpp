@@ -46,7 +46,8 @@ op_bfd::op_bfd(uint64_t spu_offset, string const & fname,
 	extra_found_images(extra_images),
 	file_size(-1),
 	embedding_filename(fname),
-	anon_obj(false)
+	anon_obj(false),
+	from_cache(false)
 {
 	int fd;
 	struct stat st;
@@ -0,0 +1,485 @@
+/**
+ * @file symbol_cache.cpp
+ * On disk cache of the symbols read from binary images
+ *
+ * A cache file holds a file_header, the code sections, the symbols and a
+ * table of nul terminated strings the other parts refer to by offset. It
+ * is written in host byte order by a single write() to a temporary file
+ * renamed over the previous entry, so concurrent tools never see a
+ * partial entry. Readers map it and check every offset before use.
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+
+#include "symbol_cache.h"
+#include "file_manip.h"
+#include "op_file.h"
+#include "op_string.h"
+
+using namespace std;
+
+namespace {
+
+char const cache_magic[8] = "OPSYMC";
+u32 const cache_version = 1;
+
+struct file_header {
+	char magic[8];
+	u32 version;
+	/// 1 if the image has debug information
+	u32 has_debug_info;
+	u64 image_size;
+	u64 image_mtime;
+	u64 debug_size;
+	u64 debug_mtime;
+	/// offsets of the strings in the string table
+	u32 image_path;
+	u32 debug_filename;
+	u32 build_id;
+	u32 build_id_size;
+	u32 nr_section;
+	u32 nr_symbol;
+	u32 strings_size;
+	u32 padding;
+};
+
+struct file_section {
+	u32 name;
+	u32 filepos;
+};
+
+enum symbol_flags {
+	symbol_hidden = 1,
+	symbol_weak = 2
+};
+
+struct file_symbol {
+	u64 value;
+	u64 section_filepos;
+	u64 section_vma;
+	u64 size;
+	u32 name;
+	u32 flags;
+};
+
+string cache_dir;
+
+
+/// the cache file of an image
+string cache_filename(string const & image_path)
+{
+	ostringstream os;
+	os << cache_dir << '/' << op_basename(image_path) << '.'
+	   << hex << setfill('0') << setw(sizeof(size_t) * 2)
+	   << op_hash_string(image_path.c_str());
+	return os.str();
+}
+
+
+/// the string at offset in the string table, NULL if it is not valid
+char const * get_string(char const * strings, u32 size, u32 offset)
+{
+	if (offset >= size)
+		return 0;
+	return strings + offset;
+}
+
+
+/// append a string to the string table and return its offset
+u32 add_string(string & strings, char const * data, size_t size)
+{
+	u32 const offset = strings.size();
+	strings.append(data, size);
+	strings += '\0';
+	return offset;
+}
+
+
+/// the byte order of the ELF file being read
+bool swap_bytes;
+
+/// an ELF field in the host byte order, chosen by the size of the field
+uint16_t elf_value(uint16_t v)
+{
+	return swap_bytes ? (v >> 8) | (v << 8) : v;
+}
+
+
+uint32_t elf_value(uint32_t v)
+{
+	if (!swap_bytes)
+		return v;
+	return (v >> 24) | ((v >> 8) & 0xff00) |
+		((v << 8) & 0xff0000) | (v << 24);
+}
+
+
+uint64_t elf_value(uint64_t v)
+{
+	if (!swap_bytes)
+		return v;
+	return (uint64_t(elf_value(uint32_t(v))) << 32) |
+		elf_value(uint32_t(v >> 32));
+}
+
+
+bool read_at(int fd, void * buf, size_t size, u64 offset)
+{
+	return pread(fd, buf, size, offset) == ssize_t(size);
+}
+
+
+/// search the build-id in the notes at [offset, offset + size) of fd
+bool find_build_id(int fd, u64 offset, u64 size, string & build_id)
+{
+	// a build-id note is small, the other notes aren't interesting
+	if (size > 4096)
+		size = 4096;
+
+	string notes(size, '\0');
+	if (!read_at(fd, &notes[0], size, offset))
+		return false;
+
+	size_t pos = 0;
+	while (pos + sizeof(Elf32_Nhdr) <= notes.size()) {
+		Elf32_Nhdr nhdr;
+		memcpy(&nhdr, &notes[pos], sizeof(nhdr));
+		size_t const namesz = elf_value(nhdr.n_namesz);
+		size_t const descsz = elf_value(nhdr.n_descsz);
+		size_t const name = pos + sizeof(nhdr);
+		size_t const desc = name + ((namesz + 3) & ~3);
+		size_t const next = desc + ((descsz + 3) & ~3);
+		if (next > notes.size() || next <= pos)
+			return false;
+
+		if (elf_value(nhdr.n_type) == NT_GNU_BUILD_ID && namesz == 4 &&
+		    !memcmp(&notes[name], "GNU", 4)) {
+			build_id.assign(notes, desc, descsz);
+			return true;
+		}
+
+		pos = next;
+	}
+
+	return false;
+}
+
+
+/**
+ * Elf_Ehdr, Elf_Phdr and Elf_Shdr are Elf32_xxx or Elf64_xxx. The notes
+ * are searched in the PT_NOTE segments, or in the SHT_NOTE sections if
+ * there is no segment, as in a kernel module.
+ */
+template <typename Elf_Ehdr, typename Elf_Phdr, typename Elf_Shdr>
+string elf_build_id(int fd)
+{
+	Elf_Ehdr ehdr;
+	string build_id;
+
+	if (!read_at(fd, &ehdr, sizeof(ehdr), 0))
+		return build_id;
+
+	size_t const phnum = elf_value(ehdr.e_phnum);
+	for (size_t i = 0; i < phnum; ++i) {
+		Elf_Phdr phdr;
+		u64 const offset = elf_value(ehdr.e_phoff) +
+			i * elf_value(ehdr.e_phentsize);
+		if (!read_at(fd, &phdr, sizeof(phdr), offset))
+			return build_id;
+		if (elf_value(phdr.p_type) == PT_NOTE &&
+		    find_build_id(fd, elf_value(phdr.p_offset),
+		                  elf_value(phdr.p_filesz), build_id))
+			return build_id;
+	}
+
+	if (phnum)
+		return build_id;
+
+	size_t const shnum = elf_value(ehdr.e_shnum);
+	for (size_t i = 0; i < shnum; ++i) {
+		Elf_Shdr shdr;
+		u64 const offset = elf_value(ehdr.e_shoff) +
+			i * elf_value(ehdr.e_shentsize);
+		if (!read_at(fd, &shdr, sizeof(shdr), offset))
+			return build_id;
+		if (elf_value(shdr.sh_type) == SHT_NOTE &&
+		    find_build_id(fd, elf_value(shdr.sh_offset),
+		                  elf_value(shdr.sh_size), build_id))
+			return build_id;
+	}
+
+	return build_id;
+}
+
+
+/// the bytes of the entry file, with the image state it was built from
+string build_entry(symbol_cache_entry const & entry,
+                   struct stat const & image_st, string const & build_id,
+                   struct stat const * debug_st)
+{
+	file_header header;
+	string strings;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, cache_magic, sizeof(header.magic));
+	header.version = cache_version;
+	header.has_debug_info = entry.has_debug_info;
+	header.image_size = image_st.st_size;
+	header.image_mtime = image_st.st_mtime;
+	if (debug_st) {
+		header.debug_size = debug_st->st_size;
+		header.debug_mtime = debug_st->st_mtime;
+	}
+	header.image_path = add_string(strings, entry.image_path.data(),
+	                               entry.image_path.size());
+	header.debug_filename = add_string(strings,
+		entry.debug_filename.data(), entry.debug_filename.size());
+	header.build_id = add_string(strings, build_id.data(),
+	                             build_id.size());
+	header.build_id_size = build_id.size();
+	header.nr_section = entry.sections.size();
+	header.nr_symbol = entry.symbols.size();
+
+	vector<file_section> sections(entry.sections.size());
+	for (size_t i = 0; i < sections.size(); ++i) {
+		string const & name = entry.sections[i].first;
+		sections[i].name = add_string(strings, name.data(),
+		                              name.size());
+		sections[i].filepos = entry.sections[i].second;
+	}
+
+	vector<file_symbol> symbols(entry.symbols.size());
+	for (size_t i = 0; i < symbols.size(); ++i) {
+		cached_symbol const & sym = entry.symbols[i];
+		symbols[i].value = sym.value;
+		symbols[i].section_filepos = sym.section_filepos;
+		symbols[i].section_vma = sym.section_vma;
+		symbols[i].size = sym.size;
+		symbols[i].name = add_string(strings, sym.name.data(),
+		                             sym.name.size());
+		symbols[i].flags = (sym.hidden ? symbol_hidden : 0) |
+			(sym.weak ? symbol_weak : 0);
+	}
+
+	header.strings_size = strings.size();
+
+	string result(reinterpret_cast<char const *>(&header), sizeof(header));
+	if (!sections.empty())
+		result.append(reinterpret_cast<char const *>(&sections[0]),
+		              sections.size() * sizeof(file_section));
+	if (!symbols.empty())
+		result.append(reinterpret_cast<char const *>(&symbols[0]),
+		              symbols.size() * sizeof(file_symbol));
+	result += strings;
+
+	return result;
+}
+
+
+/**
+ * Fill entry from the mapped cache file data of size bytes. Return false
+ * if it is not valid or if the files it was built from changed.
+ */
+bool read_entry(char const * data, size_t size, string const & image_path,
+                symbol_cache_entry & entry)
+{
+	file_header header;
+
+	if (size < sizeof(header))
+		return false;
+	memcpy(&header, data, sizeof(header));
+
+	if (memcmp(header.magic, cache_magic, sizeof(header.magic)) ||
+	    header.version != cache_version)
+		return false;
+
+	u64 const strings_offset = sizeof(header) +
+		u64(header.nr_section) * sizeof(file_section) +
+		u64(header.nr_symbol) * sizeof(file_symbol);
+	if (strings_offset + header.strings_size != size ||
+	    !header.strings_size || data[size - 1] != '\0')
+		return false;
+
+	char const * strings = data + strings_offset;
+	u32 const strings_size = header.strings_size;
+
+	char const * path = get_string(strings, strings_size,
+	                               header.image_path);
+	char const * debug_filename = get_string(strings, strings_size,
+	                                         header.debug_filename);
+	char const * build_id = get_string(strings, strings_size,
+	                                   header.build_id);
+	if (!path || !debug_filename || !build_id ||
+	    header.build_id_size > strings_size - header.build_id ||
+	    image_path != path)
+		return false;
+
+	struct stat st;
+	if (stat(path, &st) || u64(st.st_size) != header.image_size ||
+	    u64(st.st_mtime) != header.image_mtime)
+		return false;
+
+	if (get_build_id(path) != string(build_id, header.build_id_size))
+		return false;
+
+	if (*debug_filename &&
+	    (stat(debug_filename, &st) ||
+	     u64(st.st_size) != header.debug_size ||
+	     u64(st.st_mtime) != header.debug_mtime))
+		return false;
+
+	entry.image_path = path;
+	entry.file_size = header.image_size;
+	entry.debug_filename = debug_filename;
+	entry.has_debug_info = header.has_debug_info;
+
+	file_section const * sections =
+		reinterpret_cast<file_section const *>(data + sizeof(header));
+	entry.sections.clear();
+	for (size_t i = 0; i < header.nr_section; ++i) {
+		char const * name = get_string(strings, strings_size,
+		                               sections[i].name);
+		if (!name)
+			return false;
+		entry.sections.push_back(make_pair(string(name),
+		                                   sections[i].filepos));
+	}
+
+	file_symbol const * symbols = reinterpret_cast<file_symbol const *>
+		(sections + header.nr_section);
+	entry.symbols.resize(header.nr_symbol);
+	for (size_t i = 0; i < header.nr_symbol; ++i) {
+		char const * name = get_string(strings, strings_size,
+		                               symbols[i].name);
+		if (!name)
+			return false;
+		cached_symbol & sym = entry.symbols[i];
+		sym.name = name;
+		sym.value = symbols[i].value;
+		sym.section_filepos = symbols[i].section_filepos;
+		sym.section_vma = symbols[i].section_vma;
+		sym.size = symbols[i].size;
+		sym.hidden = symbols[i].flags & symbol_hidden;
+		sym.weak = symbols[i].flags & symbol_weak;
+	}
+
+	return true;
+}
+
+}  // anonymous namespace
+
+
+void set_symbol_cache_dir(string const & dir)
+{
+	cache_dir = dir;
+}
+
+
+bool symbol_cache_enabled()
+{
+	return !cache_dir.empty();
+}
+
+
+bool load_symbol_cache(string const & image_path, symbol_cache_entry & entry)
+{
+	if (!symbol_cache_enabled())
+		return false;
+
+	string const filename = cache_filename(image_path);
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	void * data = MAP_FAILED;
+	if (!fstat(fd, &st) && st.st_size > 0) {
+		data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	bool const ok = read_entry(static_cast<char const *>(data),
+	                           st.st_size, image_path, entry);
+	munmap(data, st.st_size);
+
+	return ok;
+}
+
+
+void save_symbol_cache(symbol_cache_entry const & entry)
+{
+	if (!symbol_cache_enabled())
+		return;
+
+	struct stat image_st;
+	struct stat debug_st;
+	if (stat(entry.image_path.c_str(), &image_st) ||
+	    image_st.st_size != entry.file_size)
+		return;
+	if (!entry.debug_filename.empty() &&
+	    stat(entry.debug_filename.c_str(), &debug_st))
+		return;
+
+	string const data = build_entry(entry, image_st,
+		get_build_id(entry.image_path),
+		entry.debug_filename.empty() ? 0 : &debug_st);
+
+	create_dir(cache_dir.c_str());
+
+	string const filename = cache_filename(entry.image_path);
+	ostringstream os;
+	os << filename << ".tmp" << getpid();
+	string const tmp = os.str();
+
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return;
+
+	bool ok = write(fd, data.data(), data.size()) == ssize_t(data.size());
+	ok = !close(fd) && ok;
+	if (!ok || rename(tmp.c_str(), filename.c_str()))
+		unlink(tmp.c_str());
+}
+
+
+string get_build_id(string const & filename)
+{
+	unsigned char ident[EI_NIDENT];
+	string build_id;
+
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		return build_id;
+
+	if (read_at(fd, ident, sizeof(ident), 0) &&
+	    !memcmp(ident, ELFMAG, SELFMAG)) {
+		unsigned short const one = 1;
+		bool const little = *reinterpret_cast<char const *>(&one);
+		swap_bytes = (ident[EI_DATA] == ELFDATA2LSB) != little;
+
+		if (ident[EI_CLASS] == ELFCLASS32)
+			build_id = elf_build_id<Elf32_Ehdr, Elf32_Phdr,
+			                        Elf32_Shdr>(fd);
+		else if (ident[EI_CLASS] == ELFCLASS64)
+			build_id = elf_build_id<Elf64_Ehdr, Elf64_Phdr,
+			                        Elf64_Shdr>(fd);
+	}
+
+	close(fd);
+	return build_id;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file symbol_cache.h
+ * On disk cache of the symbols read from binary images
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#ifndef SYMBOL_CACHE_H
+#define SYMBOL_CACHE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <sys/types.h>
+
+#include "op_types.h"
+
+/// a symbol as op_bfd keeps it once sorted and sized
+struct cached_symbol {
+	cached_symbol()
+		: value(0), section_filepos(0), section_vma(0), size(0),
+		  hidden(false), weak(false) {}
+
+	std::string name;
+	unsigned long long value;
+	unsigned long long section_filepos;
+	unsigned long long section_vma;
+	unsigned long long size;
+	bool hidden;
+	bool weak;
+};
+
+
+/**
+ * Everything op_bfd reads from an image through libbfd before it applies
+ * the symbol filter, so it can be rebuilt without opening the image.
+ */
+struct symbol_cache_entry {
+	symbol_cache_entry() : file_size(0), has_debug_info(false) {}
+
+	/// the image file
+	std::string image_path;
+	/// image size in bytes
+	off_t file_size;
+	/// the separate debug file the symbols were read from too, if any
+	std::string debug_filename;
+	/// result of op_bfd::has_debug_info()
+	bool has_debug_info;
+	/// the code sections name and file position
+	std::vector<std::pair<std::string, u32> > sections;
+	/// sorted by file position
+	std::vector<cached_symbol> symbols;
+};
+
+
+/**
+ * Enable the symbol cache, storing one file per image in dir. It is
+ * disabled until this is called: a tool which needs the bfd of each image
+ * anyway, e.g. for line numbers, gains nothing from it.
+ */
+void set_symbol_cache_dir(std::string const & dir);
+
+/// return true if the symbol cache is enabled
+bool symbol_cache_enabled();
+
+/**
+ * Read the cache entry for image_path in entry. Return false if there is
+ * none, or if the image or its debug file changed since it was saved:
+ * the entry is checked against the size, mtime and build-id of the image
+ * and the size and mtime of the debug file.
+ */
+bool load_symbol_cache(std::string const & image_path,
+                       symbol_cache_entry & entry);
+
+/**
+ * Save entry in the cache, replacing any previous entry for the same
+ * image. Failures are silently ignored, the entry is just not saved.
+ */
+void save_symbol_cache(symbol_cache_entry const & entry);
+
+/// return the GNU build-id note of an ELF file, empty if it has none
+std::string get_build_id(std::string const & filename);
+
+#endif /* !SYMBOL_CACHE_H */
@@ -0,0 +1,199 @@
+/**
+ * @file debug_line_tests.cpp
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <stdlib.h>
+
+#include <string>
+#include <iostream>
+#include <sstream>
+
+#include "debug_line.h"
+
+using namespace std;
+
+/// little endian DWARF data
+struct bytes {
+	bytes & u8(unsigned int v) { data += char(v); return *this; }
+	bytes & u16(unsigned int v) { return u8(v & 0xff).u8(v >> 8); }
+	bytes & u32(u32 v) { return u16(v & 0xffff).u16(v >> 16); }
+	bytes & u64(u64 v) { return u32(v & 0xffffffff).u32(v >> 32); }
+	bytes & str(char const * s) { data += s; return u8(0); }
+	bytes & append(bytes const & b) { data += b.data; return *this; }
+	string data;
+};
+
+
+enum {
+	op_copy = 1,
+	op_advance_pc = 2,
+	op_advance_line = 3,
+	op_set_file = 4
+};
+
+
+static bytes set_address(u64 address)
+{
+	return bytes().u8(0).u8(9).u8(2).u64(address);
+}
+
+
+static bytes end_sequence()
+{
+	return bytes().u8(0).u8(1).u8(1);
+}
+
+
+/// a DWARF 4 line program with two sequences
+static string line_program()
+{
+	bytes header;
+	header.u8(1)			// minimum_instruction_length
+		.u8(1)			// maximum_operations_per_instruction
+		.u8(1)			// default_is_stmt
+		.u8(-5 & 0xff)		// line_base
+		.u8(14)			// line_range
+		.u8(13);		// opcode_base
+	unsigned int const lengths[] = { 0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1 };
+	for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i)
+		header.u8(lengths[i]);
+	header.str("src").str("/usr/include").u8(0);
+	header.str("a.c").u8(1).u8(0).u8(0);
+	header.str("b.h").u8(2).u8(0).u8(0);
+	header.str("c.c").u8(0).u8(0).u8(0);
+	header.u8(0);
+
+	bytes program;
+	program.append(set_address(0x1000)).u8(op_copy)
+		.u8(op_advance_line).u8(9)
+		.u8(op_advance_pc).u8(0x10).u8(op_copy)
+		.u8(op_set_file).u8(2)
+		.u8(op_advance_pc).u8(0x10).u8(op_copy)
+		// line 0
+		.u8(op_advance_line).u8(0x76)
+		.u8(op_advance_pc).u8(0x10).u8(op_copy)
+		.u8(op_set_file).u8(3).u8(op_advance_line).u8(5)
+		.u8(op_advance_pc).u8(0x10).u8(op_copy)
+		.u8(op_advance_pc).u8(0x10).append(end_sequence());
+	// a special opcode: address + 4, line + 2
+	program.append(set_address(0x2000)).u8(op_copy).u8(76)
+		.u8(op_advance_pc).u8(4).append(end_sequence());
+
+	bytes unit;
+	unit.u16(4).u32(header.data.size()).append(header).append(program);
+
+	return bytes().u32(unit.data.size()).append(unit).data;
+}
+
+
+static void set_comp_dir(debug_sections & sections)
+{
+	// DW_TAG_compile_unit with DW_AT_comp_dir string, DW_AT_stmt_list
+	sections.abbrev = bytes().u8(1).u8(0x11).u8(0)
+		.u8(0x1b).u8(0x08).u8(0x10).u8(0x17).u8(0).u8(0).u8(0).data;
+
+	bytes unit;
+	unit.u16(4).u32(0).u8(8).u8(1).str("/build").u32(0);
+	sections.info = bytes().u32(unit.data.size()).append(unit).data;
+}
+
+
+static void check(debug_line_table const & table, u64 address,
+                  char const * filename, unsigned int linenr,
+                  debug_line_table::cursor & pos)
+{
+	string name;
+	unsigned int line = 0;
+	bool const found = table.find(address, name, line, pos);
+
+	if (found != (filename != 0) ||
+	    (found && (name != filename || line != linenr))) {
+		cerr << "debug_line_table::find(" << hex << address << ")\n"
+		     << "expect: " << (filename ? filename : "not found")
+		     << ":" << dec << linenr << "\n"
+		     << "found: " << (found ? name : "not found")
+		     << ":" << line << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void lookup_tests()
+{
+	debug_sections sections;
+	sections.line = line_program();
+	set_comp_dir(sections);
+
+	debug_line_table table(sections);
+	if (!table.valid()) {
+		cerr << "line program not decoded" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	debug_line_table::cursor pos;
+	check(table, 0xfff, 0, 0, pos);
+	check(table, 0x1000, "/build/src/a.c", 1, pos);
+	check(table, 0x1008, "/build/src/a.c", 1, pos);
+	check(table, 0x1010, "/build/src/a.c", 10, pos);
+	check(table, 0x1020, "/usr/include/b.h", 10, pos);
+	check(table, 0x1030, 0, 0, pos);
+	check(table, 0x1040, "/build/c.c", 5, pos);
+	check(table, 0x104f, "/build/c.c", 5, pos);
+	check(table, 0x1050, 0, 0, pos);
+	check(table, 0x2003, "/build/src/a.c", 1, pos);
+	check(table, 0x2004, "/build/src/a.c", 3, pos);
+	check(table, 0x2008, 0, 0, pos);
+
+	// decreasing addresses
+	check(table, 0x1040, "/build/c.c", 5, pos);
+	check(table, 0x1010, "/build/src/a.c", 10, pos);
+	debug_line_table::cursor other;
+	check(table, 0x2004, "/build/src/a.c", 3, other);
+}
+
+
+static void missing_unit_tests()
+{
+	debug_sections sections;
+	sections.line = line_program();
+
+	// the relative names need DW_AT_comp_dir, bfd must be used
+	debug_line_table table(sections);
+	debug_line_table::cursor pos;
+	check(table, 0x1000, 0, 0, pos);
+	check(table, 0x1020, "/usr/include/b.h", 10, pos);
+	check(table, 0x1040, 0, 0, pos);
+}
+
+
+static void bad_data_tests()
+{
+	debug_sections sections;
+	debug_line_table empty(sections);
+	if (empty.valid()) {
+		cerr << "empty .debug_line decoded" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	string const program = line_program();
+	for (size_t size = 0; size < program.size(); ++size) {
+		sections.line = program.substr(0, size);
+		debug_line_table table(sections);
+		if (table.valid()) {
+			cerr << "truncated .debug_line decoded" << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+
+int main()
+{
+	lookup_tests();
+	missing_unit_tests();
+	bad_data_tests();
+	return EXIT_SUCCESS;
+}
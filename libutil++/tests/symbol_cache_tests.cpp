@@ -0,0 +1,247 @@
+/**
+ * @file symbol_cache_tests.cpp
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <fstream>
+#include <iostream>
+
+#include "symbol_cache.h"
+
+using namespace std;
+
+static string image;
+
+
+static void write_image(char const * content)
+{
+	ofstream out(image.c_str());
+	out << content;
+	if (!out) {
+		cerr << "can't write " << image << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+static void check(bool cond, char const * what)
+{
+	if (!cond) {
+		cerr << "symbol_cache_tests: " << what << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/// the bytes of an ELF file, in its byte order
+struct elf_bytes {
+	elf_bytes(bool big_) : big(big_) {}
+	elf_bytes & u8(unsigned int v) { data += char(v); return *this; }
+	elf_bytes & u16(unsigned int v) {
+		return big ? u8(v >> 8).u8(v & 0xff) : u8(v & 0xff).u8(v >> 8);
+	}
+	elf_bytes & u32(unsigned int v) {
+		return big ? u16(v >> 16).u16(v & 0xffff)
+			: u16(v & 0xffff).u16(v >> 16);
+	}
+	elf_bytes & u64(unsigned int v) {
+		return big ? u32(0).u32(v) : u32(v).u32(0);
+	}
+	/// an address or an offset
+	elf_bytes & addr(bool is64, unsigned int v) {
+		return is64 ? u64(v) : u32(v);
+	}
+	bool big;
+	string data;
+};
+
+
+/**
+ * An ELF file with a build-id 0xdeadbeef in a PT_NOTE segment or, as in a
+ * kernel module, in a SHT_NOTE section.
+ */
+static string make_elf(bool is64, bool big, bool in_section)
+{
+	size_t const ehsize = is64 ? 64 : 52;
+	size_t const entsize = in_section ? (is64 ? 64 : 40) : (is64 ? 56 : 32);
+	// the null section comes first
+	size_t const nr_headers = in_section ? 2 : 1;
+	size_t const note_offset = ehsize + nr_headers * entsize;
+	size_t const note_size = 20;
+
+	elf_bytes elf(big);
+	elf.u8(0x7f).u8('E').u8('L').u8('F').u8(is64 ? 2 : 1).u8(big ? 2 : 1)
+		.u8(1);
+	while (elf.data.size() < 16)
+		elf.u8(0);
+	elf.u16(2).u16(8).u32(1).addr(is64, 0)
+		.addr(is64, in_section ? 0 : ehsize)
+		.addr(is64, in_section ? ehsize : 0)
+		.u32(0).u16(ehsize)
+		.u16(in_section ? 0 : entsize).u16(in_section ? 0 : 1)
+		.u16(in_section ? entsize : 0).u16(in_section ? 2 : 0).u16(0);
+
+	if (in_section) {
+		elf.data.append(entsize, '\0');
+		elf.u32(0).u32(7).addr(is64, 2).addr(is64, 0)
+			.addr(is64, note_offset).addr(is64, note_size)
+			.u32(0).u32(0).addr(is64, 4).addr(is64, 0);
+	} else if (is64) {
+		elf.u32(4).u32(4).u64(note_offset).u64(0).u64(0)
+			.u64(note_size).u64(note_size).u64(4);
+	} else {
+		elf.u32(4).u32(note_offset).u32(0).u32(0)
+			.u32(note_size).u32(note_size).u32(4).u32(4);
+	}
+
+	elf.u32(4).u32(4).u32(3).u8('G').u8('N').u8('U').u8(0)
+		.u8(0xde).u8(0xad).u8(0xbe).u8(0xef);
+
+	return elf.data;
+}
+
+
+static void build_id_tests()
+{
+	for (int i = 0; i < 8; ++i) {
+		bool const is64 = i & 1;
+		bool const big = i & 2;
+		bool const in_section = i & 4;
+
+		ofstream out(image.c_str(), ios::binary);
+		out << make_elf(is64, big, in_section);
+		out.close();
+
+		if (get_build_id(image) != "\xde\xad\xbe\xef") {
+			cerr << "symbol_cache_tests: bad build-id of a "
+			     << (is64 ? "64" : "32") << " bits "
+			     << (big ? "big" : "little") << " endian ELF file"
+			     << (in_section ? " with no segment" : "") << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+
+static symbol_cache_entry make_entry()
+{
+	symbol_cache_entry entry;
+	entry.image_path = image;
+	entry.file_size = 4;
+	entry.has_debug_info = true;
+	entry.sections.push_back(make_pair(string(".text"), 0x400u));
+	entry.sections.push_back(make_pair(string(".init"), 0x300u));
+
+	cached_symbol sym;
+	sym.name = "main";
+	sym.value = 0x10;
+	sym.section_filepos = 0x400;
+	sym.section_vma = 0x8048400ULL;
+	sym.size = 0x20;
+	entry.symbols.push_back(sym);
+
+	sym.name = "static_fn";
+	sym.value = 0x30;
+	sym.size = 0x1000;
+	sym.hidden = true;
+	entry.symbols.push_back(sym);
+
+	sym.name = "";
+	sym.value = 0x1030;
+	sym.size = 1;
+	sym.hidden = false;
+	sym.weak = true;
+	entry.symbols.push_back(sym);
+
+	return entry;
+}
+
+
+static void round_trip_tests()
+{
+	symbol_cache_entry const saved = make_entry();
+	symbol_cache_entry entry;
+
+	write_image("abcd");
+	check(!load_symbol_cache(image, entry), "entry found before save");
+
+	save_symbol_cache(saved);
+	check(load_symbol_cache(image, entry), "entry not found after save");
+
+	check(entry.image_path == saved.image_path, "bad image path");
+	check(entry.file_size == saved.file_size, "bad file size");
+	check(entry.debug_filename.empty(), "bad debug filename");
+	check(entry.has_debug_info, "bad debug info");
+	check(entry.sections == saved.sections, "bad sections");
+	check(entry.symbols.size() == saved.symbols.size(), "bad nr symbols");
+	for (size_t i = 0; i < entry.symbols.size(); ++i) {
+		cached_symbol const & a = entry.symbols[i];
+		cached_symbol const & b = saved.symbols[i];
+		check(a.name == b.name && a.value == b.value &&
+		      a.section_filepos == b.section_filepos &&
+		      a.section_vma == b.section_vma && a.size == b.size &&
+		      a.hidden == b.hidden && a.weak == b.weak, "bad symbol");
+	}
+}
+
+
+static void invalidation_tests()
+{
+	symbol_cache_entry entry;
+
+	write_image("abcdef");
+	check(!load_symbol_cache(image, entry), "entry of a changed image");
+
+	// the size doesn't match the image any more, nothing is saved
+	save_symbol_cache(make_entry());
+	check(!load_symbol_cache(image, entry), "entry saved for wrong size");
+
+	write_image("abcd");
+	save_symbol_cache(make_entry());
+	unlink(image.c_str());
+	check(!load_symbol_cache(image, entry), "entry of a removed image");
+}
+
+
+int main()
+{
+	char dir[] = "/tmp/symbol_cache_tests.XXXXXX";
+	if (!mkdtemp(dir)) {
+		cerr << "can't create a temporary directory" << endl;
+		return EXIT_FAILURE;
+	}
+
+	string const cache_dir = string(dir) + "/cache";
+	image = string(dir) + "/image";
+
+	symbol_cache_entry entry;
+	check(!symbol_cache_enabled(), "cache enabled by default");
+	write_image("abcd");
+	save_symbol_cache(make_entry());
+	check(!load_symbol_cache(image, entry), "disabled cache used");
+
+	set_symbol_cache_dir(cache_dir);
+	check(symbol_cache_enabled(), "cache not enabled");
+
+	round_trip_tests();
+	invalidation_tests();
+
+	build_id_tests();
+
+	write_image("not an elf file");
+	check(get_build_id(image).empty(), "build-id of a non elf file");
+	check(get_build_id(string(dir) + "/none").empty(),
+	      "build-id of a missing file");
+
+	string const command = string("rm -rf ") + dir;
+	if (system(command.c_str()))
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -822,18 +822,15 @@ int opannotate(options::spec const & spec)
 
 	report_image_errors(iprofiles, classes.extra_found_images);
 
+	bool debug_info = false;
+	populate_for_images(*samples, iprofiles, options::symbol_filter,
+			    options::jobs, &debug_info);
+
 	list<inverted_profile>::iterator it = iprofiles.begin();
 	list<inverted_profile>::iterator const end = iprofiles.end();
 
-	bool debug_info = false;
-	for (; it != end; ++it) {
-		bool tmp = false;
-		populate_for_image(*samples, *it,
-				   options::symbol_filter, &tmp);
+	for (; it != end; ++it)
 		images.push_back(it->image);
-		if (tmp)
-			debug_info = true;
-	}
 
 	if (!debug_info && !options::assembly) {
 		cerr << "opannotate (warning): no debug information available for binary "
@@ -40,6 +40,7 @@ namespace options {
 	bool assembly;
 	vector<string> objdump_params;
 	bool exclude_dependent;
+	int jobs = 1;
 }
 
 
@@ -81,6 +82,8 @@ popt::option options_array[] = {
 	popt::option(options::threshold_opt, "threshold", 't',
 		     "minimum percentage needed to produce output",
 		     "percent"),
+	popt::option(options::jobs, "jobs", 'j',
+		     "nr of threads reading the sample files", "num"),
 };
 
 }  // anonymous namespace
@@ -117,6 +120,11 @@ void handle_options(options::spec const & spec)
 		exit(EXIT_FAILURE);
 	}
 
+	if (jobs < 1) {
+		cerr << "--jobs must be at least 1" << endl;
+		exit(EXIT_FAILURE);
+	}
+
 	options::symbol_filter = string_filter(include_symbols, exclude_symbols);
 
 	options::file_filter = path_filter(include_file, exclude_file);
@@ -16,6 +16,7 @@
 #include <sstream>
 #include <numeric>
 
+#include "op_config.h"
 #include "op_exception.h"
 #include "stream_util.h"
 #include "string_manip.h"
@@ -32,6 +33,7 @@
 #include "format_output.h"
 #include "xml_utils.h"
 #include "image_errors.h"
+#include "symbol_cache.h"
 
 using namespace std;
 
@@ -499,6 +501,11 @@ int opreport(options::spec const & spec)
 
 	handle_options(spec);
 
+	// a report with line numbers reads the debug info of each image
+	// through bfd anyway, the cached symbols wouldn't save anything
+	if (!options::debug_info)
+		set_symbol_cache_dir(op_symbol_cache_dir);
+
 	nr_classes = classes.v.size();
 
 	if (!options::symbols && !options::xml) {
@@ -535,12 +542,8 @@ int opreport(options::spec const & spec)
 		profile_container pc1(options::debug_info, options::details,
 				      classes.extra_found_images);
 
-		list<inverted_profile>::iterator it = iprofiles.begin();
-		list<inverted_profile>::iterator const end = iprofiles.end();
-
-		for (; it != end; ++it)
-			populate_for_image(pc1, *it,
-					   options::symbol_filter, 0);
+		populate_for_images(pc1, iprofiles, options::symbol_filter,
+				    options::jobs, 0);
 
 		list<inverted_profile> iprofiles2 = invert_profiles(classes2);
 
@@ -549,12 +552,8 @@ int opreport(options::spec const & spec)
 		profile_container pc2(options::debug_info, options::details,
 				      classes2.extra_found_images);
 
-		list<inverted_profile>::iterator it2 = iprofiles2.begin();
-		list<inverted_profile>::iterator const end2 = iprofiles2.end();
-
-		for (; it2 != end2; ++it2)
-			populate_for_image(pc2, *it2,
-					   options::symbol_filter, 0);
+		populate_for_images(pc2, iprofiles2, options::symbol_filter,
+				    options::jobs, 0);
 
 		output_diff_symbols(pc1, pc2, multiple_apps);
 	} else if (options::callgraph) {
@@ -568,12 +567,8 @@ int opreport(options::spec const & spec)
 		profile_container samples(options::debug_info,
 			options::details, classes.extra_found_images);
 
-		list<inverted_profile>::iterator it = iprofiles.begin();
-		list<inverted_profile>::iterator const end = iprofiles.end();
-
-		for (; it != end; ++it)
-			populate_for_image(samples, *it,
-					   options::symbol_filter, 0);
+		populate_for_images(samples, iprofiles, options::symbol_filter,
+				    options::jobs, 0);
 
 		output_symbols(samples, multiple_apps);
 	}
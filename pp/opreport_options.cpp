@@ -49,6 +49,7 @@ namespace options {
 	bool global_percent;
 	bool xml;
 	string xml_options;
+	int jobs = 1;
 }
 
 
@@ -108,6 +109,8 @@ popt::option options_array[] = {
 
 	popt::option(options::xml, "xml", 'X',
 		     "XML output"),
+	popt::option(options::jobs, "jobs", 'j',
+		     "nr of threads reading the sample files", "num"),
 
 };
 
@@ -235,6 +238,11 @@ void check_options(bool diff)
 		do_exit = true;
 	}
 
+	if (jobs < 1) {
+		cerr << "--jobs must be at least 1" << endl;
+		do_exit = true;
+	}
+
 	if (do_exit)
 		exit(EXIT_FAILURE);
 }
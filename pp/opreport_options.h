@@ -41,6 +41,7 @@ namespace options {
 	extern bool accumulated;
 	extern bool xml;
 	extern std::string xml_options;
+	extern int jobs;
 }
 
 /// All the chosen sample files.
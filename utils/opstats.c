@@ -0,0 +1,271 @@
+/**
+ * @file opstats.c
+ * Sample the oprofiled statistics page
+ *
+ * The page is mapped read only and copied without any lock, see
+ * op_stats_page.h, so it can be read at a high rate without slowing
+ * down the daemon.
+ *
+ * @remark Copyright 2026 OProfile authors
+ * @remark Read the file COPYING
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "op_version.h"
+#include "op_config.h"
+#include "op_popt.h"
+#include "op_stats_page.h"
+
+static char * session_dir = OP_SESSION_DIR_DEFAULT;
+static int interval = 1000;
+static int count;
+static int show_raw;
+static int show_all;
+static int show_vers;
+
+static struct poptOption options[] = {
+	{ "session-dir", '\0', POPT_ARG_STRING, &session_dir, 0,
+	  "read the statistics of the daemon using this session dir", "dir", },
+	{ "interval", 'i', POPT_ARG_INT, &interval, 0,
+	  "sample the statistics every msec milli-seconds", "msec", },
+	{ "count", 'c', POPT_ARG_INT, &count, 0,
+	  "stop after num samples, 0 for no limit", "num", },
+	{ "raw", 'r', POPT_ARG_NONE, &show_raw, 0,
+	  "print all the counters once and exit", NULL, },
+	{ "all", 'a', POPT_ARG_NONE, &show_all, 0,
+	  "print the counters which didn't change too", NULL, },
+	{ "version", 'v', POPT_ARG_NONE, &show_vers, 0,
+	   "show version", NULL, },
+	POPT_AUTOHELP
+	{ NULL, 0, 0, NULL, 0, NULL, NULL, },
+};
+
+
+static struct op_stats_page const * map_page(char const * path)
+{
+	struct op_stats_page const * page;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st)) {
+		fprintf(stderr, "opstats: couldn't open %s: %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	if (st.st_size < (off_t)sizeof(struct op_stats_page)) {
+		fprintf(stderr, "opstats: %s is not a statistics page\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	page = mmap(NULL, sizeof(struct op_stats_page), PROT_READ, MAP_SHARED,
+		    fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		fprintf(stderr, "opstats: couldn't map %s: %s\n", path,
+			strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	return page;
+}
+
+
+/** copy a consistent state of page in copy */
+static void read_page(struct op_stats_page const * page,
+                      struct op_stats_page * copy)
+{
+	uint32_t seq;
+
+	while (1) {
+		seq = *(uint32_t const volatile *)&page->seq;
+		__sync_synchronize();
+		if (seq & 1) {
+			usleep(10);
+			continue;
+		}
+		memcpy(copy, page, sizeof(struct op_stats_page));
+		__sync_synchronize();
+		if (*(uint32_t const volatile *)&page->seq == seq)
+			break;
+	}
+
+	if (copy->magic != OP_STATS_PAGE_MAGIC ||
+	    copy->version != OP_STATS_PAGE_VERSION ||
+	    copy->nr_counter > OP_STATS_MAX_COUNTERS ||
+	    copy->nr_cpu > OP_STATS_MAX_CPUS) {
+		fprintf(stderr, "opstats: bad statistics page\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+/** the value of counter name, 0 if the page has no such counter */
+static uint64_t counter(struct op_stats_page const * page, char const * name)
+{
+	uint32_t i;
+
+	for (i = 0; i < page->nr_counter; ++i) {
+		if (!strncmp(page->counter[i].name, name, OP_STATS_NAME_LEN))
+			return page->counter[i].value;
+	}
+
+	return 0;
+}
+
+
+static void print_raw(struct op_stats_page const * page)
+{
+	uint32_t i;
+
+	printf("pid %u\n", page->pid);
+	for (i = 0; i < page->nr_counter; ++i)
+		printf("%.*s %llu\n", OP_STATS_NAME_LEN, page->counter[i].name,
+		       (unsigned long long)page->counter[i].value);
+	for (i = 0; i < OP_STATS_NR_BUCKETS; ++i)
+		printf("latency_%u %llu\n", i,
+		       (unsigned long long)page->latency[i]);
+	for (i = 0; i < page->nr_cpu; ++i)
+		printf("cpu_samples_%u %llu\n", i,
+		       (unsigned long long)page->cpu_samples[i]);
+}
+
+
+/** ratio of the deltas of two counters, -1 when the divisor didn't change */
+static double delta_ratio(struct op_stats_page const * old,
+                          struct op_stats_page const * new,
+                          char const * num, char const * div)
+{
+	uint64_t d = counter(new, div) - counter(old, div);
+
+	if (!d)
+		return -1;
+	return (double)(counter(new, num) - counter(old, num)) / d;
+}
+
+
+/** upper bound in usec of the bucket holding percent of the buffers */
+static unsigned long latency_percentile(uint64_t const * buckets,
+                                        uint64_t total, unsigned int percent)
+{
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < OP_STATS_NR_BUCKETS; ++i) {
+		seen += buckets[i];
+		if (seen * 100 >= total * percent)
+			break;
+	}
+
+	return i ? 1UL << i : 1;
+}
+
+
+static void print_delta(struct op_stats_page const * old,
+                        struct op_stats_page const * new)
+{
+	double sec = (new->time - old->time) / 1000000.0;
+	uint64_t buckets[OP_STATS_NR_BUCKETS];
+	uint64_t nr_buffer = 0;
+	double ratio;
+	uint32_t i;
+
+	printf("\n-- %.3f sec\n", sec);
+	if (sec <= 0) {
+		printf("no update from the daemon\n");
+		return;
+	}
+
+	for (i = 0; i < new->nr_counter; ++i) {
+		struct op_stats_counter const * c = &new->counter[i];
+		uint64_t delta = c->value - old->counter[i].value;
+		if (!delta && !show_all)
+			continue;
+		printf("%-32.*s %14llu", OP_STATS_NAME_LEN, c->name,
+		       (unsigned long long)c->value);
+		if (c->type == OP_STATS_COUNTER)
+			printf(" %14.1f/s", delta / sec);
+		printf("\n");
+	}
+
+	if ((ratio = delta_ratio(old, new, "sfile_hit", "samples")) >= 0)
+		printf("sfile hit rate: %.1f%%\n", ratio * 100);
+	if ((ratio = delta_ratio(old, new, "sfile_last_hit", "samples")) >= 0)
+		printf("sfile per cpu cache hit rate: %.1f%%\n", ratio * 100);
+	if ((ratio = delta_ratio(old, new, "sfile_kernel_hit",
+	                         "kernel_samples")) >= 0)
+		printf("kernel image cache hit rate: %.1f%%\n", ratio * 100);
+	if ((ratio = delta_ratio(old, new, "cookie_usec", "cookie_resolve")) >= 0)
+		printf("usec per dcookie resolved: %.1f\n", ratio);
+	if ((ratio = delta_ratio(old, new, "anon_reload_usec", "anon_reload")) >= 0)
+		printf("usec per anon maps read: %.1f\n", ratio);
+
+	for (i = 0; i < OP_STATS_NR_BUCKETS; ++i) {
+		buckets[i] = new->latency[i] - old->latency[i];
+		nr_buffer += buckets[i];
+	}
+	if (nr_buffer) {
+		printf("buffer latency (usec): p50 <%lu p90 <%lu p99 <%lu "
+		       "max <%lu\n",
+		       latency_percentile(buckets, nr_buffer, 50),
+		       latency_percentile(buckets, nr_buffer, 90),
+		       latency_percentile(buckets, nr_buffer, 99),
+		       latency_percentile(buckets, nr_buffer, 100));
+	}
+
+	for (i = 0; i < new->nr_cpu; ++i) {
+		uint64_t before = i < old->nr_cpu ? old->cpu_samples[i] : 0;
+		uint64_t delta = new->cpu_samples[i] - before;
+		if (!delta && !show_all)
+			continue;
+		printf("cpu %u: %.1f samples/s\n", i, delta / sec);
+	}
+}
+
+
+int main(int argc, char const * argv[])
+{
+	static struct op_stats_page pages[2];
+	struct op_stats_page const * page;
+	poptContext optcon;
+	int current = 0;
+	int i;
+
+	optcon = op_poptGetContext(NULL, argc, argv, options, 0);
+	if (show_vers)
+		show_version(argv[0]);
+	if (interval <= 0) {
+		fprintf(stderr, "opstats: bad interval %d\n", interval);
+		exit(EXIT_FAILURE);
+	}
+
+	init_op_config_dirs(session_dir);
+	page = map_page(op_stats_file);
+
+	read_page(page, &pages[current]);
+	if (show_raw) {
+		print_raw(&pages[current]);
+		goto out;
+	}
+
+	for (i = 0; !count || i < count; ++i) {
+		usleep(interval * 1000);
+		read_page(page, &pages[!current]);
+		print_delta(&pages[current], &pages[!current]);
+		current = !current;
+		fflush(stdout);
+	}
+
+out:
+	poptFreeContext(optcon);
+	return EXIT_SUCCESS;
+}